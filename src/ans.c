@@ -0,0 +1,358 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ans.h"
+#include "huffman.h"
+
+// the position of the highest set bit of x (which isn't 0)
+static int highest_bit(uint32_t x) {
+    int bit = 0;
+    while (x >>= 1) {
+        bit++;
+    }
+    return bit;
+}
+
+// the bits a symbol seen `frequency` times would gain from going from count `from` to count `to`
+static double count_gain(long frequency, int from, int to) {
+    return frequency * log2((double)to / from);
+}
+
+void normalize_frequencies(const long *symbol_frequencies, uint16_t *counts) {
+    double total = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        total += symbol_frequencies[i];
+    }
+    memset(counts, 0, sizeof(uint16_t) * num_symbols);
+    if (total == 0) {
+        counts[0] = ANS_TABLE_SIZE;
+        return;
+    }
+
+    int sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        if (symbol_frequencies[i] > 0) {
+            long count = lround(symbol_frequencies[i] * ANS_TABLE_SIZE / total);
+            counts[i] = count < 1 ? 1 : count;
+            sum += counts[i];
+        }
+    }
+    // rounding (and rare symbols' minimum of 1) leaves the sum a little off,
+    // so take from or give to whichever symbols that costs or gains the most bits
+    while (sum != ANS_TABLE_SIZE) {
+        int best = -1;
+        double best_gain = 0;
+        for (int i = 0; i < num_symbols; i++) {
+            if (sum > ANS_TABLE_SIZE && counts[i] > 1) {
+                double gain = count_gain(symbol_frequencies[i], counts[i], counts[i] - 1);
+                if (best < 0 || gain > best_gain) {
+                    best = i;
+                    best_gain = gain;
+                }
+            }else if (sum < ANS_TABLE_SIZE && counts[i] > 0) {
+                double gain = count_gain(symbol_frequencies[i], counts[i], counts[i] + 1);
+                if (best < 0 || gain > best_gain) {
+                    best = i;
+                    best_gain = gain;
+                }
+            }
+        }
+        if (sum > ANS_TABLE_SIZE) {
+            counts[best]--;
+            sum--;
+        }else {
+            counts[best]++;
+            sum++;
+        }
+    }
+}
+
+uint64_t ans_encoded_size_bits(const long *symbol_frequencies, const uint16_t *counts) {
+    double bits = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        if (symbol_frequencies[i] > 0 && counts[i] == 0) {
+            return UINT64_MAX;
+        }
+        if (symbol_frequencies[i] > 0) {
+            bits += count_gain(symbol_frequencies[i], counts[i], ANS_TABLE_SIZE);
+        }
+    }
+    return ceil(bits);
+}
+
+// spread each symbol's states through the table, so each symbol's are evenly spaced.
+// (the step is odd, so coprime to the table size, and visits every state once)
+static bool spread_symbols(const uint16_t *counts, symbol *spread) {
+    int sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        sum += counts[i];
+    }
+    if (sum != ANS_TABLE_SIZE) {
+        return false;
+    }
+    const int step = (ANS_TABLE_SIZE >> 1) + (ANS_TABLE_SIZE >> 3) + 3;
+    int position = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        for (int j = 0; j < counts[i]; j++) {
+            spread[position] = i;
+            position = (position + step) & (ANS_TABLE_SIZE - 1);
+        }
+    }
+    return true;
+}
+
+bool ans_encode_table_init(const uint16_t *counts, ans_encode_table *table) {
+    symbol spread[ANS_TABLE_SIZE];
+    if (!spread_symbols(counts, spread)) {
+        return false;
+    }
+
+    // each symbol's next states are together, in the order they're spread
+    int starts[num_symbols];
+    int total = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        starts[i] = total;
+        total += counts[i];
+    }
+    int next[num_symbols];
+    memcpy(next, starts, sizeof(next));
+    for (int state = 0; state < ANS_TABLE_SIZE; state++) {
+        table->next_states[next[spread[state]]++] = ANS_TABLE_SIZE + state;
+    }
+
+    // a state in [ANS_TABLE_SIZE, 2 * ANS_TABLE_SIZE) has the symbol's count in the range of states
+    // it shrinks to: for a count of n, writing `max_bits` bits shrinks states from n << max_bits up,
+    // and one fewer those below
+    for (int i = 0; i < num_symbols; i++) {
+        if (counts[i] == 0) {
+            table->symbols[i] = (ans_symbol_transform) { .delta_bits = 0, .delta_state = 0 };
+            continue;
+        }
+        int max_bits = ANS_TABLE_LOG - (counts[i] == 1 ? 0 : highest_bit(counts[i] - 1));
+        table->symbols[i] = (ans_symbol_transform) {
+            .delta_bits = (max_bits << 16) - (counts[i] << max_bits),
+            .delta_state = starts[i] - counts[i]
+        };
+    }
+    return true;
+}
+
+bool ans_decode_table_init(const uint16_t *counts, ans_decode_table *table) {
+    symbol spread[ANS_TABLE_SIZE];
+    if (!spread_symbols(counts, spread)) {
+        return false;
+    }
+    // the reverse of encoding: a symbol's states, in order, come from states n to 2n - 1,
+    // which reading bits grows back to the whole table
+    int next[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        next[i] = counts[i];
+    }
+    for (int state = 0; state < ANS_TABLE_SIZE; state++) {
+        symbol s = spread[state];
+        int from = next[s]++;
+        int num_bits = ANS_TABLE_LOG - highest_bit(from);
+        table->entries[state] = (ans_decode_entry) {
+            .base = (from << num_bits) - ANS_TABLE_SIZE,
+            .symbol = s,
+            .num_bits = num_bits
+        };
+    }
+    return true;
+}
+
+size_t ans_encode_bound(size_t message_length) {
+    // at most ANS_TABLE_LOG bits a symbol, the final state, and the marker bit before it all
+    return (message_length * ANS_TABLE_LOG + ANS_TABLE_LOG + 8) / 8;
+}
+
+// the stream is written from the end of `out` backwards, as symbols are encoded last first,
+// then moved to the start. pending bits are the low `count` bits of the accumulator,
+// the latest highest, so each byte read from the start is most significant bit first.
+// the first bit is a 1 marking where the stream starts (after the first byte's zero padding)
+size_t ans_encode_bytes(const symbol *message, size_t message_length, const ans_encode_table *table,
+                        unsigned char *out) {
+    unsigned char *end = out + ans_encode_bound(message_length);
+    unsigned char *p = end;
+    uint64_t accumulator = 0;
+    int count = 0;
+    uint32_t state = ANS_TABLE_SIZE;
+
+    for (size_t i = message_length; i-- > 0;) {
+        ans_symbol_transform transform = table->symbols[message[i]];
+        int num_bits = (state + transform.delta_bits) >> 16;
+        accumulator |= (uint64_t)(state & ((1u << num_bits) - 1)) << count;
+        count += num_bits;
+        state = table->next_states[(state >> num_bits) + transform.delta_state];
+
+        if (count >= 32) {
+            p -= 4;
+            p[0] = accumulator >> 24;
+            p[1] = accumulator >> 16;
+            p[2] = accumulator >> 8;
+            p[3] = accumulator;
+            accumulator >>= 32;
+            count -= 32;
+        }
+    }
+    accumulator |= (uint64_t)(state - ANS_TABLE_SIZE) << count;
+    count += ANS_TABLE_LOG;
+    accumulator |= (uint64_t)1 << count;
+    count++;
+    while (count > 0) {
+        *--p = accumulator;
+        accumulator >>= 8;
+        count -= 8;
+    }
+
+    size_t size = end - p;
+    memmove(out, p, size);
+    return size;
+}
+
+// reads a byte array most significant bit first, keeping upcoming bits in a 64 bit buffer
+typedef struct {
+    const unsigned char *bytes;
+    size_t byte_length;
+    // next byte to load into the buffer
+    size_t next_byte;
+    // upcoming bits, left aligned. bits past the end of the input are zero
+    uint64_t buffer;
+    // number of valid bits in the buffer (negative after reading past the end)
+    int count;
+} ans_reader;
+
+static inline uint64_t load_big_endian_64(const unsigned char *p) {
+    return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48
+         | (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32
+         | (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16
+         | (uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
+
+// top up the buffer to at least 56 bits (or all remaining input)
+static inline void ans_reader_refill(ans_reader *r) {
+    if (r->count >= 0 && r->next_byte + 8 <= r->byte_length) {
+        r->buffer |= load_big_endian_64(r->bytes + r->next_byte) >> r->count;
+        r->next_byte += (63 - r->count) >> 3;
+        r->count |= 56;
+    }else {
+        while (r->count >= 0 && r->count <= 56 && r->next_byte < r->byte_length) {
+            r->buffer |= (uint64_t)r->bytes[r->next_byte++] << (56 - r->count);
+            r->count += 8;
+        }
+    }
+}
+
+// read n bits (at most 32, and maybe none)
+static inline uint32_t ans_reader_read(ans_reader *r, int n) {
+    uint32_t bits = (r->buffer >> 1) >> (63 - n);
+    r->buffer <<= n;
+    r->count -= n;
+    return bits;
+}
+
+// start reading a stream: past its marker bit, to its final state.
+// returns false if it has no marker
+static bool ans_reader_start(ans_reader *r, const unsigned char *bytes, size_t byte_length, uint32_t *statep) {
+    *r = (ans_reader) {
+        .bytes = bytes,
+        .byte_length = byte_length,
+        .next_byte = 0,
+        .buffer = 0,
+        .count = 0
+    };
+    ans_reader_refill(r);
+    if (byte_length == 0 || bytes[0] == 0) {
+        return false;
+    }
+    ans_reader_read(r, 8 - highest_bit(bytes[0]));
+    *statep = ans_reader_read(r, ANS_TABLE_LOG);
+    return true;
+}
+
+// whether the stream was read to exactly its end, ending in the state encoding started from
+static bool ans_reader_finished(const ans_reader *r, uint32_t state) {
+    return state == 0 && r->count >= 0 && (uint64_t)r->next_byte * 8 - r->count == (uint64_t)r->byte_length * 8;
+}
+
+// decode the next symbol, moving to the next state
+static inline symbol ans_decode_symbol(ans_reader *r, uint32_t *state, const ans_decode_entry *entries) {
+    if (r->count < ANS_TABLE_LOG) {
+        ans_reader_refill(r);
+    }
+    ans_decode_entry entry = entries[*state];
+    *state = entry.base + ans_reader_read(r, entry.num_bits);
+    return entry.symbol;
+}
+
+// decode `count` symbols from each of 4 streams in lockstep.
+// (with a fixed number of streams, their readers and states can all live in registers)
+static void ans_decode_four_streams(ans_reader *readers, uint32_t *states, const ans_decode_entry *entries,
+                                    symbol *out, size_t segment_length, size_t count) {
+    ans_reader r0 = readers[0], r1 = readers[1], r2 = readers[2], r3 = readers[3];
+    uint32_t s0 = states[0], s1 = states[1], s2 = states[2], s3 = states[3];
+    symbol *out0 = out, *out1 = out + segment_length,
+           *out2 = out + 2 * segment_length, *out3 = out + 3 * segment_length;
+
+    for (size_t i = 0; i < count; i++) {
+        out0[i] = ans_decode_symbol(&r0, &s0, entries);
+        out1[i] = ans_decode_symbol(&r1, &s1, entries);
+        out2[i] = ans_decode_symbol(&r2, &s2, entries);
+        out3[i] = ans_decode_symbol(&r3, &s3, entries);
+    }
+
+    readers[0] = r0;
+    readers[1] = r1;
+    readers[2] = r2;
+    readers[3] = r3;
+    states[0] = s0;
+    states[1] = s1;
+    states[2] = s2;
+    states[3] = s3;
+}
+
+bool ans_decode_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                            const ans_decode_table *table, symbol *out, size_t length) {
+    size_t segment_length = (length + num_streams - 1) / num_streams;
+
+    ans_reader readers[num_streams];
+    uint32_t states[num_streams];
+    size_t counts[num_streams];
+    size_t shortest = segment_length;
+    for (int k = 0; k < num_streams; k++) {
+        if (!ans_reader_start(&readers[k], streams[k], stream_lengths[k], &states[k])) {
+            return false;
+        }
+        size_t start = k * segment_length;
+        counts[k] = start >= length ? 0 : (length - start < segment_length ? length - start : segment_length);
+        if (counts[k] < shortest) shortest = counts[k];
+    }
+
+    // one symbol from each stream in turn, so their (independent)
+    // chains of lookups overlap in the processor's pipeline
+    const ans_decode_entry *entries = table->entries;
+    if (num_streams == 4) {
+        ans_decode_four_streams(readers, states, entries, out, segment_length, shortest);
+    }else {
+        for (size_t i = 0; i < shortest; i++) {
+            for (int k = 0; k < num_streams; k++) {
+                out[k * segment_length + i] = ans_decode_symbol(&readers[k], &states[k], entries);
+            }
+        }
+    }
+    // the shorter final segment leaves the others with a few more
+    for (int k = 0; k < num_streams; k++) {
+        for (size_t i = shortest; i < counts[k]; i++) {
+            out[k * segment_length + i] = ans_decode_symbol(&readers[k], &states[k], entries);
+        }
+    }
+
+    bool valid = true;
+    for (int k = 0; k < num_streams; k++) {
+        valid &= ans_reader_finished(&readers[k], states[k]);
+    }
+    return valid;
+}
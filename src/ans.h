@@ -0,0 +1,66 @@
+#ifndef ANS_H
+#define ANS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "huffman.h"
+
+// table-based asymmetric numeral systems (tANS): an alternative to prefix codes which can
+// spend fractions of a bit on a symbol, so very common symbols cost less than a bit each.
+// symbols' frequencies are normalised to counts summing to the table size, and a coder
+// moves between the table's states, each symbol writing (and reading) the few bits which
+// take it from one state to the next.
+// symbols are encoded last first, so they can be decoded first first: one table lookup each
+
+#define ANS_TABLE_LOG 12
+#define ANS_TABLE_SIZE (1 << ANS_TABLE_LOG)
+
+// how to encode a symbol from a state
+typedef struct {
+    // the number of bits to write is (state + delta_bits) >> 16
+    int32_t delta_bits;
+    // the next state is next_states[(state >> bits written) + delta_state]
+    int32_t delta_state;
+} ans_symbol_transform;
+
+typedef struct {
+    uint16_t next_states[ANS_TABLE_SIZE];
+    ans_symbol_transform symbols[1 << 8];
+} ans_encode_table;
+
+// a decoding state: its symbol, and the bits to read to add to `base` for the next state
+typedef struct {
+    uint16_t base;
+    uint8_t symbol;
+    uint8_t num_bits;
+} ans_decode_entry;
+
+typedef struct {
+    ans_decode_entry entries[ANS_TABLE_SIZE];
+} ans_decode_table;
+
+// normalise symbol frequencies to counts (one per symbol) summing to ANS_TABLE_SIZE,
+// giving every present symbol at least 1, as close to their share as that allows.
+// (with no symbols at all, symbol 0 gets the whole table)
+void normalize_frequencies(const long *symbol_frequencies, uint16_t *counts);
+// the number of bits symbols with these frequencies take to encode with these counts, roughly
+// (ignoring the final state), or UINT64_MAX if a symbol which is present has no count
+uint64_t ans_encoded_size_bits(const long *symbol_frequencies, const uint16_t *counts);
+
+// both return false if the counts don't sum to ANS_TABLE_SIZE
+bool ans_encode_table_init(const uint16_t *counts, ans_encode_table *);
+bool ans_decode_table_init(const uint16_t *counts, ans_decode_table *);
+
+// an upper bound on the bytes ans_encode_bytes will write
+size_t ans_encode_bound(size_t message_length);
+// encode a message into `out`, returning the number of bytes written
+size_t ans_encode_bytes(const symbol *message, size_t message_length, const ans_encode_table *, unsigned char *out);
+// decode `length` symbols, which were split into `num_streams` equal segments
+// (the last perhaps shorter) and each encoded with ans_encode_bytes, decoding the streams in lockstep.
+// returns false if any stream is invalid, or isn't exactly the length of its symbols
+bool ans_decode_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                            const ans_decode_table *, symbol *out, size_t length);
+
+#endif // ANS_H
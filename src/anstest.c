@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ans.h"
+#include "assert.h"
+#include "histogram.h"
+#include "huffman.h"
+
+void test_normalized(const long *symbol_frequencies, const uint16_t *counts) {
+    int sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        assert((counts[i] > 0) == (symbol_frequencies[i] > 0), "present symbols, and only they, should have counts");
+        sum += counts[i];
+    }
+    assert(sum == ANS_TABLE_SIZE, "counts should sum to the table size");
+}
+
+// encode the data split into streams, and check it decodes back
+void test_round_trip(const symbol *data, size_t length, int num_streams) {
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    histogram(data, length, symbol_frequencies);
+    uint16_t counts[num_symbols];
+    normalize_frequencies(symbol_frequencies, counts);
+    if (length > 0) {
+        test_normalized(symbol_frequencies, counts);
+    }
+
+    ans_encode_table encode_table;
+    ans_decode_table decode_table;
+    assert(ans_encode_table_init(counts, &encode_table), "encode table init should succeed");
+    assert(ans_decode_table_init(counts, &decode_table), "decode table init should succeed");
+
+    size_t segment = (length + num_streams - 1) / num_streams;
+    // (with a byte to spare, for the stream with a byte too many)
+    unsigned char *encoded = malloc(num_streams * ans_encode_bound(segment) + 1);
+    const unsigned char *streams[num_streams];
+    size_t stream_lengths[num_streams];
+    unsigned char *out = encoded;
+    size_t total = 0;
+    for (int k = 0; k < num_streams; k++) {
+        size_t start = k * segment;
+        size_t count = start >= length ? 0 : (length - start < segment ? length - start : segment);
+        stream_lengths[k] = ans_encode_bytes(data + start, count, &encode_table, out);
+        assert(stream_lengths[k] <= ans_encode_bound(count), "encoded stream should be within the bound");
+        streams[k] = out;
+        out += stream_lengths[k];
+        total += stream_lengths[k];
+    }
+    uint64_t estimate = ans_encoded_size_bits(symbol_frequencies, counts);
+    assert(total * 8 <= estimate + num_streams * (ANS_TABLE_LOG + 8) + 8 + length / 100,
+        "encoded size should be about as estimated");
+
+    symbol *decoded = malloc(length + 1);
+    assert(ans_decode_interleaved(streams, stream_lengths, num_streams, &decode_table, decoded, length),
+        "decode should succeed");
+    assert(memcmp(decoded, data, length) == 0, "decoded data should match the original");
+
+    if (length > 0) {
+        // cut short, or with a byte more
+        stream_lengths[0]--;
+        assert(!ans_decode_interleaved(streams, stream_lengths, num_streams, &decode_table, decoded, length),
+            "decode should reject a stream cut short");
+        stream_lengths[0] += 2;
+        assert(!ans_decode_interleaved(streams, stream_lengths, num_streams, &decode_table, decoded, length),
+            "decode should reject a stream with bytes left over");
+    }
+    free(encoded);
+    free(decoded);
+}
+
+int main() {
+    const size_t n = 100003;
+    symbol *data = malloc(n);
+    long symbol_frequencies[num_symbols];
+    uint16_t counts[num_symbols];
+
+    printf("test normalizing\n");
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    normalize_frequencies(symbol_frequencies, counts);
+    assert(counts[0] == ANS_TABLE_SIZE, "no symbols should give symbol 0 the whole table");
+    // every symbol, most of them rare, so their minimum counts must be taken from the common one
+    for (int i = 0; i < num_symbols; i++) {
+        symbol_frequencies[i] = i == 'e' ? 1000000 : 1;
+    }
+    normalize_frequencies(symbol_frequencies, counts);
+    test_normalized(symbol_frequencies, counts);
+    assert(counts['e'] == ANS_TABLE_SIZE - 255, "rare symbols should get a count of 1");
+    counts['e']--;
+    ans_decode_table decode_table;
+    assert(!ans_decode_table_init(counts, &decode_table), "decode table init should reject a bad sum");
+
+    printf("test skewed bytes\n");
+    // where a prefix code would spend a whole bit on the common byte
+    srand(42);
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand() % 10 == 0 ? 'a' + rand() % 4 : ' ';
+    }
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    histogram(data, n, symbol_frequencies);
+    normalize_frequencies(symbol_frequencies, counts);
+    uint8_t code_lengths[num_symbols];
+    build_huffman_code_lengths(symbol_frequencies, code_lengths);
+    assert(ans_encoded_size_bits(symbol_frequencies, counts) < encoded_size_bits(symbol_frequencies, code_lengths) * 6 / 10,
+        "skewed bytes should take far fewer bits than with a prefix code");
+    for (int streams = 1; streams <= 5; streams++) {
+        test_round_trip(data, n, streams);
+    }
+
+    printf("test random bytes\n");
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand();
+    }
+    test_round_trip(data, n, 4);
+    for (size_t length = 0; length < 20; length++) {
+        test_round_trip(data, length, 4);
+        test_round_trip(data, length, 3);
+    }
+
+    printf("test a single repeated byte\n");
+    memset(data, 'x', n);
+    test_round_trip(data, n, 4);
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,551 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+#include "block.h"
+#include "codec.h"
+#include "format.h"
+#include "histogram.h"
+#include "huffman.h"
+
+// times each stage of compression on generated corpora, which are the same on every run
+// (so results can be compared across versions of the program)
+
+// xorshift64*, for corpora which are random but reproducible
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static double random_fraction(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+// choose from `n` items, the item of rank r having a probability proportional to 1 / (r + 1)
+typedef struct {
+    double cumulative[256];
+    int n;
+} zipf;
+
+static void zipf_init(zipf *z, int n) {
+    double total = 0;
+    for (int r = 0; r < n; r++) {
+        total += 1.0 / (r + 1);
+        z->cumulative[r] = total;
+    }
+    for (int r = 0; r < n; r++) {
+        z->cumulative[r] /= total;
+    }
+    z->n = n;
+}
+
+static int zipf_next(const zipf *z, uint64_t *state) {
+    double u = random_fraction(state);
+    int low = 0, high = z->n - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (z->cumulative[mid] < u) {
+            low = mid + 1;
+        }else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// copy as much of `text` as fits at `*posp`
+static void append(uint8_t *out, size_t length, size_t *posp, const char *text) {
+    for (; *text != '\0' && *posp < length; text++) {
+        out[(*posp)++] = *text;
+    }
+}
+
+static const char *words[] = {
+    "the", "of", "and", "to", "a", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+    "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you",
+    "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when", "will",
+    "would", "who", "so", "no", "time", "people", "first", "new", "years", "world", "between", "during",
+    "government", "example", "history", "considered", "however", "important", "development"
+};
+
+// sentences of words with roughly english frequencies
+static void generate_text(uint8_t *out, size_t length, uint64_t *state) {
+    int num_words = sizeof(words) / sizeof(words[0]);
+    zipf z;
+    zipf_init(&z, num_words);
+    size_t pos = 0;
+    int sentence_words = 0;
+    while (pos < length) {
+        const char *word = words[zipf_next(&z, state)];
+        if (sentence_words == 0) {
+            out[pos++] = word[0] - 'a' + 'A';
+            word++;
+        }
+        append(out, length, &pos, word);
+        sentence_words++;
+        if (sentence_words > 6 && next_random(state) % 8 == 0) {
+            append(out, length, &pos, next_random(state) % 6 == 0 ? ".\n" : ". ");
+            sentence_words = 0;
+        }else {
+            append(out, length, &pos, next_random(state) % 12 == 0 ? ", " : " ");
+        }
+    }
+}
+
+// lines of a web server's log
+static void generate_logs(uint8_t *out, size_t length, uint64_t *state) {
+    static const char *levels[] = { "INFO", "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char *paths[] = { "users", "orders", "search", "login", "static/app.js", "health" };
+    static const int statuses[] = { 200, 200, 200, 200, 201, 304, 404, 500 };
+    size_t pos = 0;
+    uint64_t millis = 0;
+    char line[200];
+    while (pos < length) {
+        millis += next_random(state) % 50;
+        uint64_t seconds = millis / 1000;
+        snprintf(line, sizeof(line),
+            "2024-03-14T%02d:%02d:%02d.%03dZ %s [worker-%d] GET /api/v1/%s id=%08x status=%d latency=%dms\n",
+            (int)(seconds / 3600 % 24), (int)(seconds / 60 % 60), (int)(seconds % 60), (int)(millis % 1000),
+            levels[next_random(state) % 7], (int)(next_random(state) % 8), paths[next_random(state) % 6],
+            (unsigned)(next_random(state) & 0xffffffff), statuses[next_random(state) % 8],
+            (int)(next_random(state) % 400));
+        append(out, length, &pos, line);
+    }
+}
+
+// all byte values, a few much more often than the rest
+static void generate_skewed(uint8_t *out, size_t length, uint64_t *state) {
+    zipf z;
+    zipf_init(&z, 256);
+    for (size_t i = 0; i < length; i++) {
+        out[i] = zipf_next(&z, state);
+    }
+}
+
+static void generate_uniform(uint8_t *out, size_t length, uint64_t *state) {
+    for (size_t i = 0; i < length; i++) {
+        out[i] = next_random(state);
+    }
+}
+
+static void generate_single(uint8_t *out, size_t length, uint64_t *state) {
+    memset(out, 'x', length);
+}
+
+typedef struct {
+    const char *name;
+    void (*generate)(uint8_t *out, size_t length, uint64_t *state);
+} corpus;
+
+static const corpus corpora[] = {
+    { "text", generate_text },
+    { "logs", generate_logs },
+    { "skewed", generate_skewed },
+    { "uniform", generate_uniform },
+    { "single", generate_single }
+};
+static const int num_corpora = sizeof(corpora) / sizeof(corpora[0]);
+
+// a corpus split into blocks, and what each stage makes of them
+typedef struct {
+    const uint8_t *content;
+    size_t length;
+    size_t block_size;
+    int num_blocks;
+    int num_streams;
+    // per block
+    long *frequencies;
+    uint8_t *code_lengths;
+    code_entry *codes;
+    decode_table **decode_tables;
+    uint8_t **encoded;
+    size_t *encoded_sizes;
+    // storage for the tables built by the codes stage
+    decode_entry *scratch_entries;
+    uint8_t *decoded;
+    FILE *file;
+    // the whole corpus compressed by the library, and space for the result
+    uint8_t *compressed;
+    size_t compressed_capacity;
+    size_t compressed_size;
+} bench_data;
+
+static size_t block_length(const bench_data *b, int k) {
+    size_t start = k * b->block_size;
+    return b->length - start < b->block_size ? b->length - start : b->block_size;
+}
+
+static void run_histogram(bench_data *b) {
+    memset(b->frequencies, 0, b->num_blocks * num_symbols * sizeof(long));
+    for (int k = 0; k < b->num_blocks; k++) {
+        histogram(b->content + k * b->block_size, block_length(b, k), b->frequencies + k * num_symbols);
+    }
+}
+
+static void run_tree(bench_data *b) {
+    for (int k = 0; k < b->num_blocks; k++) {
+        build_code_lengths(b->frequencies + k * num_symbols, 0, b->code_lengths + k * num_symbols);
+    }
+}
+
+static void run_codes(bench_data *b) {
+    for (int k = 0; k < b->num_blocks; k++) {
+        decode_table table;
+        get_code_table(b->code_lengths + k * num_symbols, b->codes + k * num_symbols);
+        decode_table_init(&table, b->scratch_entries, b->code_lengths + k * num_symbols);
+    }
+}
+
+static void run_encode(bench_data *b) {
+    for (int k = 0; k < b->num_blocks; k++) {
+        b->encoded_sizes[k] = encode_block(b->content + k * b->block_size, block_length(b, k),
+            b->codes + k * num_symbols, b->num_streams, NULL, 0, b->encoded[k]);
+    }
+}
+
+static void run_decode(bench_data *b) {
+    for (int k = 0; k < b->num_blocks; k++) {
+        if (!decode_block(b->encoded[k], b->num_streams, b->decode_tables[k], b->decoded + k * b->block_size)) {
+            fprintf(stderr, "error decoding block %d\n", k);
+            exit(1);
+        }
+    }
+}
+
+static void run_write(bench_data *b) {
+    rewind(b->file);
+    for (int k = 0; k < b->num_blocks; k++) {
+        fwrite(b->encoded[k], 1, b->encoded_sizes[k], b->file);
+    }
+    fflush(b->file);
+}
+
+static void run_read(bench_data *b) {
+    rewind(b->file);
+    for (int k = 0; k < b->num_blocks; k++) {
+        if (fread(b->encoded[k], 1, b->encoded_sizes[k], b->file) != b->encoded_sizes[k]) {
+            fprintf(stderr, "error reading back block %d\n", k);
+            exit(1);
+        }
+    }
+}
+
+static void run_compress(bench_data *b) {
+    encoder_options options = {
+        .block_size = b->block_size,
+        .num_streams = b->num_streams,
+        .max_code_length = 0
+    };
+    codec_status status = compress_buffer(b->content, b->length, b->compressed, b->compressed_capacity,
+                                          &b->compressed_size, &options);
+    if (status != CODEC_OK) {
+        fprintf(stderr, "error compressing: %s\n", codec_status_message(status));
+        exit(1);
+    }
+}
+
+static void run_decompress(bench_data *b) {
+    size_t length;
+    codec_status status = decompress_buffer(b->compressed, b->compressed_size, b->decoded, b->length, &length);
+    if (status != CODEC_OK || length != b->length) {
+        fprintf(stderr, "error decompressing: %s\n", codec_status_message(status));
+        exit(1);
+    }
+}
+
+// stages run in this order, each using what the previous ones made
+typedef struct {
+    const char *name;
+    void (*run)(bench_data *);
+} stage;
+
+static const stage stages[] = {
+    { "histogram", run_histogram },
+    { "tree", run_tree },
+    { "codes", run_codes },
+    { "encode", run_encode },
+    { "decode", run_decode },
+    { "write", run_write },
+    { "read", run_read },
+    { "compress", run_compress },
+    { "decompress", run_decompress }
+};
+static const int num_stages = sizeof(stages) / sizeof(stages[0]);
+
+static void bench_data_init(bench_data *b, const uint8_t *content, size_t length, size_t block_size, int num_streams) {
+    b->content = content;
+    b->length = length;
+    b->block_size = block_size;
+    b->num_blocks = (length + block_size - 1) / block_size;
+    b->num_streams = num_streams;
+    b->frequencies = malloc(b->num_blocks * num_symbols * sizeof(long));
+    b->code_lengths = malloc(b->num_blocks * num_symbols);
+    b->codes = malloc(b->num_blocks * num_symbols * sizeof(code_entry));
+    b->decode_tables = calloc(b->num_blocks, sizeof(decode_table *));
+    b->encoded = malloc(b->num_blocks * sizeof(uint8_t *));
+    b->encoded_sizes = malloc(b->num_blocks * sizeof(size_t));
+    for (int k = 0; k < b->num_blocks; k++) {
+        b->encoded[k] = malloc(chosen_block_bound(block_size, num_streams));
+    }
+    b->scratch_entries = malloc(decode_table_max_entries() * sizeof(decode_entry));
+    b->decoded = malloc(length);
+    b->file = tmpfile();
+    encoder_options options = {
+        .block_size = block_size,
+        .num_streams = num_streams,
+        .max_code_length = 0
+    };
+    b->compressed_capacity = compress_bound(length, &options);
+    b->compressed = malloc(b->compressed_capacity);
+    if (b->file == NULL || b->compressed == NULL || b->decoded == NULL) {
+        fprintf(stderr, "error setting up the benchmark\n");
+        exit(1);
+    }
+    // for the compressed size, before the stages run
+    run_compress(b);
+}
+
+static void bench_data_delete(bench_data *b) {
+    for (int k = 0; k < b->num_blocks; k++) {
+        free(b->encoded[k]);
+        decode_table_delete(b->decode_tables[k]);
+    }
+    free(b->frequencies);
+    free(b->code_lengths);
+    free(b->codes);
+    free(b->decode_tables);
+    free(b->encoded);
+    free(b->encoded_sizes);
+    free(b->scratch_entries);
+    free(b->decoded);
+    free(b->compressed);
+    fclose(b->file);
+}
+
+// between stages: the decode tables for the decode stage, and checking what it decoded
+static void after_stage(bench_data *b, int s) {
+    if (stages[s].run == run_codes) {
+        for (int k = 0; k < b->num_blocks; k++) {
+            decode_table_delete(b->decode_tables[k]);
+            b->decode_tables[k] = decode_table_from_code_lengths(b->code_lengths + k * num_symbols);
+        }
+    }else if (stages[s].run == run_decode || stages[s].run == run_decompress) {
+        if (memcmp(b->decoded, b->content, b->length) != 0) {
+            fprintf(stderr, "%s didn't give back the original content\n", stages[s].name);
+            exit(1);
+        }
+    }
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t cycle_count() {
+#ifdef HAVE_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    double best_seconds;
+    double median_seconds;
+    // of the best repetition
+    uint64_t cycles;
+} timing;
+
+static timing time_stage(bench_data *b, int s, int warmup, int repetitions) {
+    for (int r = 0; r < warmup; r++) {
+        stages[s].run(b);
+    }
+    double seconds[repetitions];
+    timing t = { .best_seconds = 0, .median_seconds = 0, .cycles = 0 };
+    for (int r = 0; r < repetitions; r++) {
+        double start = now();
+        uint64_t start_cycles = cycle_count();
+        stages[s].run(b);
+        uint64_t cycles = cycle_count() - start_cycles;
+        seconds[r] = now() - start;
+        if (r == 0 || seconds[r] < t.best_seconds) {
+            t.best_seconds = seconds[r];
+            t.cycles = cycles;
+        }
+    }
+    qsort(seconds, repetitions, sizeof(double), compare_doubles);
+    t.median_seconds = seconds[repetitions / 2];
+    return t;
+}
+
+// time each stage on a corpus split into blocks of `block_size`, and print the results
+static void bench_corpus(const char *name, const uint8_t *content, size_t length, size_t block_size, int num_streams,
+                         int warmup, int repetitions, bool csv) {
+    bench_data b;
+    bench_data_init(&b, content, length, block_size, num_streams);
+    if (!csv) {
+        printf("%s (%zu bytes, in blocks of %zu)\n", name, length, block_size);
+    }
+    for (int s = 0; s < num_stages; s++) {
+        timing t = time_stage(&b, s, warmup, repetitions);
+        after_stage(&b, s);
+        double mb_per_second = length / t.best_seconds / 1e6;
+        double cycles_per_byte = (double)t.cycles / length;
+        if (csv) {
+            printf("%d,%s,%s,%zu,%zu,%d,%d,%.9f,%.9f,%.3f,", format_version, name, stages[s].name,
+                   length, block_size, num_streams, repetitions, t.best_seconds, t.median_seconds, mb_per_second);
+#ifdef HAVE_CYCLE_COUNTER
+            printf("%.4f", cycles_per_byte);
+#endif
+            printf(",%zu\n", b.compressed_size);
+        }else {
+            printf("  %-10s %10.1f MB/s", stages[s].name, mb_per_second);
+#ifdef HAVE_CYCLE_COUNTER
+            printf(" %9.3f cycles/byte", cycles_per_byte);
+#endif
+            printf("   (best %.6fs, median %.6fs)\n", t.best_seconds, t.median_seconds);
+        }
+    }
+    if (!csv) {
+        printf("  compressed to %zu bytes (%.1f%%)\n", b.compressed_size, 100.0 * b.compressed_size / length);
+    }
+    bench_data_delete(&b);
+}
+
+void usage() {
+    fprintf(stderr,
+        "usage: bench [options] [corpus...]\n"
+        "  --size <bytes>         bytes of each corpus (default 8MB)\n"
+        "  --block-size <sizes>   bytes per block, each with its own code (default 256KB), or auto\n"
+        "                         for what the huffman program would choose. several, separated by\n"
+        "                         commas, run each corpus with each, to compare them\n"
+        "  --streams <n>          split each block into n interleaved streams (1 to %d, default 4)\n"
+        "  --repetitions <n>      time each stage n times, reporting the best and median (default 5)\n"
+        "  --warmup <n>           run each stage n times first, untimed (default 1)\n"
+        "  --csv                  print comma separated values, for tracking across versions\n"
+        "corpora: text logs skewed uniform single (default all)\n",
+        MAX_STREAMS);
+    exit(1);
+}
+
+#define MAX_BLOCK_SIZES 16
+// 0 for auto
+#define AUTO_BLOCK_SIZE 0
+
+// a comma separated list of block sizes (or auto) into `sizes`.
+// returns how many there were, or 0 if the list is malformed
+static int parse_block_sizes(const char *text, size_t *sizes) {
+    int n = 0;
+    while (n < MAX_BLOCK_SIZES) {
+        char *end;
+        if (strncmp(text, "auto", 4) == 0) {
+            sizes[n] = AUTO_BLOCK_SIZE;
+            end = (char *)text + 4;
+        }else {
+            sizes[n] = strtoull(text, &end, 10);
+            if (end == text || sizes[n] == 0 || sizes[n] > MAX_BLOCK_LENGTH) {
+                return 0;
+            }
+        }
+        n++;
+        if (*end == '\0') {
+            return n;
+        }else if (*end != ',') {
+            return 0;
+        }
+        text = end + 1;
+    }
+    return 0;
+}
+
+int main(int argc, char const *argv[]) {
+    size_t length = 8 << 20;
+    size_t block_sizes[MAX_BLOCK_SIZES] = { 1 << 18 };
+    int num_block_sizes = 1;
+    int num_streams = 4;
+    int repetitions = 5;
+    int warmup = 1;
+    bool csv = false;
+    bool chosen[num_corpora];
+    bool any_chosen = false;
+    memset(chosen, 0, sizeof(chosen));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            length = strtoull(argv[++i], NULL, 10);
+            if (length == 0) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            num_block_sizes = parse_block_sizes(argv[++i], block_sizes);
+            if (num_block_sizes == 0) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            num_streams = atoi(argv[++i]);
+            if (num_streams < 1 || num_streams > MAX_STREAMS) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+            if (repetitions < 1) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+            if (warmup < 0) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        }else {
+            int c = 0;
+            while (c < num_corpora && strcmp(argv[i], corpora[c].name) != 0) {
+                c++;
+            }
+            if (c == num_corpora) {
+                usage();
+            }
+            chosen[c] = true;
+            any_chosen = true;
+        }
+    }
+
+    if (csv) {
+        printf("format_version,corpus,stage,bytes,block_size,streams,repetitions,"
+               "best_seconds,median_seconds,mb_per_second,cycles_per_byte,compressed_bytes\n");
+    }
+    uint8_t *content = malloc(length);
+    for (int c = 0; c < num_corpora; c++) {
+        if (any_chosen && !chosen[c]) {
+            continue;
+        }
+        // the same seed for every corpus, so each is the same every time
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        corpora[c].generate(content, length, &state);
+
+        for (int k = 0; k < num_block_sizes; k++) {
+            size_t block_size = block_sizes[k] == AUTO_BLOCK_SIZE ? choose_block_size(length, 1, true) : block_sizes[k];
+            bench_corpus(corpora[c].name, content, length, block_size, num_streams, warmup, repetitions, csv);
+        }
+    }
+    free(content);
+    return 0;
+}
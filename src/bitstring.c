@@ -1,5 +1,6 @@
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -35,7 +36,7 @@ bitstring *bitstring_copy(const bitstring *original) {
     // TODO: power of two size?
     bitstring *bits = bitstring_new_with_capacity((original->length + 7) / 8);
 
-    for (int i = 0; i < original->length; i++) {
+    for (size_t i = 0; i < original->length; i++) {
         bits->length++;
         bitstring_set(bits, i, bitstring_get(original, i));
     }
@@ -43,8 +44,8 @@ bitstring *bitstring_copy(const bitstring *original) {
     return bits;
 }
 
-bool bitstring_get(const bitstring *bits, int i) {
-    if (i < 0 || i >= bits->length) {
+bool bitstring_get(const bitstring *bits, size_t i) {
+    if (i >= bits->length) {
         return false;
     }
     char byte = bits->bytes[i / 8];
@@ -53,8 +54,8 @@ bool bitstring_get(const bitstring *bits, int i) {
     return (byte >> j) & 1;
 }
 
-void bitstring_set(bitstring *bits, int i, bool b) {
-    if (i < 0 || i >= bits->length) {
+void bitstring_set(bitstring *bits, size_t i, bool b) {
+    if (i >= bits->length) {
         return;
     }
     // bit 0 is highest, 7 is lowest
@@ -105,12 +106,12 @@ void bitstring_concat(bitstring *bits, const bitstring *other_bits) {
     
     int offset = bits->length % 8;
 
-    int num_bytes_to_copy = (other_bits->length + 7) / 8;
-    int start_byte = bits->length / 8;
+    size_t num_bytes_to_copy = (other_bits->length + 7) / 8;
+    size_t start_byte = bits->length / 8;
 
     // copy bytes from other_bits (src) to bits (dest), 
     // shifting along if bits doesn't end on a byte boundary
-    for (int i = 0; i < num_bytes_to_copy; i++) {
+    for (size_t i = 0; i < num_bytes_to_copy; i++) {
         if (i == 0) {
             // zero only the last `8 - offset` bits
             bits->bytes[start_byte + i] &= ~ ((1 << (8 - offset)) - 1);
@@ -134,19 +135,18 @@ void bitstring_concat(bitstring *bits, const bitstring *other_bits) {
     bits->length = new_length;
 }
 
-bitstring *bitstring_substring(const bitstring *bits, int start, int stop) {
-    if (start < 0) start = 0;
+bitstring *bitstring_substring(const bitstring *bits, size_t start, size_t stop) {
     if (stop >= bits->length) stop = bits->length;
 
-    int length = stop - start;
-    if (length <= 0) {
+    if (start >= stop) {
         return bitstring_new_empty();
     }
+    size_t length = stop - start;
 
     bitstring *sub_bits = bitstring_new_with_capacity((length + 7) / 8);
     sub_bits->length = length;
 
-    for (int i = 0; i < length; i++) {
+    for (size_t i = 0; i < length; i++) {
         bitstring_set(sub_bits, i, bitstring_get(bits, start + i));
     }
 
@@ -161,13 +161,13 @@ const char *bitstring_to_bytes(const bitstring *bits) {
 char *bitstring_show(const bitstring *bits) {
     char *str = malloc(sizeof(char) * (bits->length + 1));
     str[bits->length] = '\0';
-    for (int i = 0; i < bits->length; i++) {
+    for (size_t i = 0; i < bits->length; i++) {
         str[i] = bitstring_get(bits, i) ? '1' : '0';
     }
     return str;
 }
 
-int bitstring_bitlength(const bitstring *bits) {
+size_t bitstring_bitlength(const bitstring *bits) {
     return bits->length;
 }
 
@@ -176,7 +176,7 @@ bool bitstring_equals(const bitstring *bits1, const bitstring *bits2) {
         return false;
     }
     // TODO: speedup by comparing full bytes
-    for (int i = 0; i < bits1->length; i++) {
+    for (size_t i = 0; i < bits1->length; i++) {
         if (bitstring_get(bits1, i) != bitstring_get(bits2, i)) {
             return false;
         }
@@ -185,16 +185,16 @@ bool bitstring_equals(const bitstring *bits1, const bitstring *bits2) {
 }
 
 bool bitstring_write(const bitstring *bits, FILE *f) {
-    int bitlength = bits->length;
+    uint64_t bitlength = bits->length;
 
-    if (!write_int(bitlength, f)) {
+    if (!write_ulong(bitlength, f)) {
         return false;
     }
     if (bitlength == 0) {
         return true;
     }
 
-    int byte_length = (bitlength + 7) / 8; // round up
+    size_t byte_length = (bitlength + 7) / 8; // round up
 
     // zero out the bits which pad this to a whole number of bytes
     // (so we totally control what is written)
@@ -208,21 +208,25 @@ bool bitstring_write(const bitstring *bits, FILE *f) {
 }
 
 bitstring *bitstring_read(FILE *f) {
-    int bitlength = -1;
+    uint64_t bitlength;
 
-    if (!read_int(&bitlength, f)) {
+    if (!read_ulong(&bitlength, f)) {
         return NULL;
     }
     
-    if (bitlength < 0) {
+    if (bitlength > SIZE_MAX - 7) {
         return NULL;
     }else if (bitlength == 0) {
         return bitstring_new_empty();
     }
 
-    bitstring *bits = bitstring_new_with_capacity(bitlength);
+    size_t bytelength = (bitlength + 7) / 8;
+    bitstring *bits = bitstring_new_with_capacity(bytelength);
+    if (bits == NULL || bits->bytes == NULL) {
+        bitstring_delete(bits);
+        return NULL;
+    }
 
-    int bytelength = (bitlength + 7) / 8;
     if (fread(bits->bytes, sizeof(char), bytelength, f) != bytelength) {
         bitstring_delete(bits);
         return NULL;
@@ -19,19 +19,21 @@ typedef struct {
 } bitstring;
 
 bitstring *bitstring_new_empty();
+bitstring *bitstring_new_with_capacity(size_t byte_capacity);
 // free a bitstring's memory. does nothing if given NULL
 void bitstring_delete(bitstring *);
 bitstring *bitstring_copy(const bitstring *);
 
-bool bitstring_get(const bitstring *, int i);
-void bitstring_set(bitstring *, int i, bool b);
+// bits past the end read as false, and can't be set
+bool bitstring_get(const bitstring *, size_t i);
+void bitstring_set(bitstring *, size_t i, bool b);
 
 void bitstring_append(bitstring *, bool b);
 bool bitstring_pop(bitstring *);
 
 void bitstring_concat(bitstring *bits, const bitstring *other_bits);
 
-bitstring *bitstring_substring(const bitstring *, int start, int stop);
+bitstring *bitstring_substring(const bitstring *, size_t start, size_t stop);
 
 // TODO: is this a bit pointless ?
 //  have a serialization + (deserialisation) function ?
@@ -41,11 +43,11 @@ const char *bitstring_to_bytes(const bitstring *);
 
 char *bitstring_show(const bitstring *);
 
-int bitstring_bitlength(const bitstring *);
+size_t bitstring_bitlength(const bitstring *);
 
 bool bitstring_equals(const bitstring *, const bitstring *);
 
-// write a bitstring to a stream.
+// write a bitstring to a stream: its length in bits (a uint64), then its bytes.
 // returns false on failure
 bool bitstring_write(const bitstring *, FILE *);
 // read a bitstring (in the format of bitstring_write) from a stream
@@ -1,10 +1,12 @@
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "bitstring.h"
 #include "assert.h"
+#include "writeutils.h"
 
 #define BIN_FORMAT "%d%d%d%d%d%d%d%d"
 #define BIN_PRINTF(n) \
@@ -146,6 +148,21 @@ int main() {
         bitstring_delete(sub);
         bitstring_delete(strings[i]);
     }
+
+    // written with a 64 bit length
+    FILE *f = tmpfile();
+    assert(bitstring_write(all, f), "write should succeed");
+    assert(ftell(f) == sizeof(uint64_t) + (all->length + 7) / 8, "write should give the length as 8 bytes, then the bytes");
+    rewind(f);
+    bitstring *read_bits = bitstring_read(f);
+    assert(read_bits != NULL && bitstring_equals(read_bits, all), "read should recover the written bits");
+    bitstring_delete(read_bits);
+    rewind(f);
+    write_ulong(UINT64_MAX, f);
+    rewind(f);
+    assert(bitstring_read(f) == NULL, "read should reject an impossible length");
+    fclose(f);
+
     bitstring_delete(all);
     free(strings);
     
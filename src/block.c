@@ -0,0 +1,366 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "ans.h"
+#include "block.h"
+#include "context.h"
+#include "crc32c.h"
+#include "format.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "writeutils.h"
+
+size_t block_header_size(int num_streams) {
+    return sizeof(uint64_t) * (2 + num_streams);
+}
+
+// (after the decoded length and the checksum)
+static size_t get_block_table_size(const uint8_t *block) {
+    return get_uint(block + sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+// the cache each core has to itself (or a guess, if the system doesn't say)
+static size_t core_cache_size() {
+    long size = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return size > 0 ? size : 1 << 20;
+}
+
+size_t choose_block_size(uint64_t input_size, int num_threads, bool own_tables) {
+    // a block and its encoding in half the cache, leaving the rest for tables and the like.
+    // a block's own code adapts to it, so smaller blocks compress better with their own tables,
+    // until the tables cost more than that gains
+    size_t size = core_cache_size() / (own_tables ? 8 : 4);
+    if (num_threads > 1 && input_size != UINT64_MAX && input_size / (4 * num_threads) < size) {
+        size = input_size / (4 * num_threads);
+    }
+    // (below these, headers and tables start to take more than a fraction of a percent)
+    size_t smallest = own_tables ? 1 << 16 : 1 << 15;
+    size_t largest = 1 << 22;
+    size = size < smallest ? smallest : (size > largest ? largest : size);
+    // no bigger than the input needs
+    if (input_size < size) {
+        size = input_size < 1024 ? 1024 : input_size;
+    }
+    return size;
+}
+
+static size_t segment_length(size_t length, int num_streams) {
+    return (length + num_streams - 1) / num_streams;
+}
+
+size_t block_bound(size_t length, int num_streams, const code_entry *table) {
+    // the segments' padding, and the final stream's slack
+    return block_header_size(num_streams) + num_symbols + 1 + encode_bound(length, table) + num_streams;
+}
+
+// encodes a segment of a block with some code, returning the number of bytes written
+typedef size_t (*segment_encoder)(const symbol *src, size_t length, const void *code, uint8_t *out);
+
+static size_t encode_with_table(const symbol *src, size_t length, const void *table, uint8_t *out) {
+    return encode_bytes(src, length, table, out);
+}
+
+static size_t encode_with_contexts(const symbol *src, size_t length, const void *context_codes, uint8_t *out) {
+    return encode_bytes_in_context(src, length, context_codes, out);
+}
+
+static size_t encode_with_ans(const symbol *src, size_t length, const void *table, uint8_t *out) {
+    return ans_encode_bytes(src, length, table, out);
+}
+
+static size_t encode_with_wide_table(const symbol *src, size_t length, const void *table, uint8_t *out) {
+    return encode_wide_bytes(src, length, table, out);
+}
+
+// (segments are split between symbols, of `symbol_size` bytes)
+static size_t encode_segments(const symbol *src, size_t length, int symbol_size, segment_encoder encoder, 
+                              const void *code, int num_streams, const uint8_t *packed_table, size_t table_size,
+                              uint8_t *dest) {
+    put_ulong(length, dest);
+    put_uint(0, dest + sizeof(uint64_t));
+    put_uint(table_size, dest + sizeof(uint64_t) + sizeof(uint32_t));
+    uint8_t *stream_lengths = dest + 2 * sizeof(uint64_t);
+    uint8_t *out = dest + block_header_size(num_streams);
+    if (table_size > 0) {
+        memcpy(out, packed_table, table_size);
+        out += table_size;
+    }
+
+    size_t segment = symbol_size * segment_length((length + symbol_size - 1) / symbol_size, num_streams);
+    for (int k = 0; k < num_streams; k++) {
+        size_t start = k * segment;
+        size_t count = start >= length ? 0 : (length - start < segment ? length - start : segment);
+
+        // each stream overwrites the slack left after the previous one
+        size_t stream_length = encoder(src + start, count, code, out);
+        put_ulong(stream_length, stream_lengths + k * sizeof(uint64_t));
+        out += stream_length;
+    }
+
+    return out - dest;
+}
+
+size_t encode_block(const symbol *src, size_t length, const code_entry *table, int num_streams, 
+                    const uint8_t *packed_table, size_t table_size, uint8_t *dest) {
+    return encode_segments(src, length, 1, encode_with_table, table, num_streams, packed_table, table_size, dest);
+}
+
+size_t context_block_bound(size_t length, int num_streams, const context_code *code) {
+    // as if every symbol had its longest code in any group
+    code_entry longest[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        longest[i] = (code_entry) { .bits = 0, .length = 0 };
+        for (int g = 0; g < code->num_groups; g++) {
+            if (code->code_lengths[g][i] > longest[i].length) {
+                longest[i].length = code->code_lengths[g][i];
+            }
+        }
+    }
+    return block_bound(length, num_streams, longest);
+}
+
+size_t encode_context_block(const symbol *src, size_t length, const code_entry *const *context_codes,
+                            int num_streams, uint8_t *dest) {
+    return encode_segments(src, length, 1, encode_with_contexts, context_codes, num_streams, NULL, 0, dest);
+}
+
+size_t ans_block_bound(size_t length, int num_streams) {
+    return block_header_size(num_streams) + num_streams * ans_encode_bound(segment_length(length, num_streams));
+}
+
+size_t encode_ans_block(const symbol *src, size_t length, const ans_encode_table *table, int num_streams, uint8_t *dest) {
+    return encode_segments(src, length, 1, encode_with_ans, table, num_streams, NULL, 0, dest);
+}
+
+size_t wide_block_bound(size_t length, int num_streams, const code_entry *table) {
+    return block_header_size(num_streams) + wide_encode_bound(length, table) + num_streams;
+}
+
+size_t encode_wide_block(const uint8_t *src, size_t length, const code_entry *table, int num_streams, uint8_t *dest) {
+    return encode_segments(src, length, 2, encode_with_wide_table, table, num_streams, NULL, 0, dest);
+}
+
+size_t chosen_block_bound(size_t length, int num_streams) {
+    // a block's own optimal code never takes more bits than one of all `symbol_bitsize` bit codes,
+    // and it only reuses the current code when that takes no more than its own and its table
+    code_entry uniform[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        uniform[i] = (code_entry) { .bits = i, .length = symbol_bitsize };
+    }
+    return block_bound(length, num_streams, uniform);
+}
+
+bool choose_block_code(const symbol *src, size_t length, int max_code_length, current_code *current,
+                       code_entry *codes, uint8_t *table, size_t *table_sizep) {
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    histogram(src, length, symbol_frequencies);
+    return choose_code_for_frequencies(symbol_frequencies, max_code_length, current, codes, table, table_sizep);
+}
+
+bool choose_code_for_frequencies(const long *symbol_frequencies, int max_code_length, current_code *current,
+                                 code_entry *codes, uint8_t *table, size_t *table_sizep) {
+    uint8_t code_lengths[num_symbols];
+    if (!build_code_lengths(symbol_frequencies, max_code_length, code_lengths)) {
+        return false;
+    }
+
+    *table_sizep = pack_block_table(code_lengths, NULL, table);
+    if (current->has_code) {
+        uint8_t changes[num_symbols + 1];
+        size_t changes_size = pack_block_table(code_lengths, current->lengths, changes);
+        if (changes_size < *table_sizep) {
+            memcpy(table, changes, changes_size);
+            *table_sizep = changes_size;
+        }
+
+        // (in whole bytes, ignoring the streams' padding)
+        uint64_t current_bits = encoded_size_bits(symbol_frequencies, current->lengths);
+        uint64_t own_bits = encoded_size_bits(symbol_frequencies, code_lengths);
+        if (current_bits != UINT64_MAX && (current_bits + 7) / 8 <= (own_bits + 7) / 8 + *table_sizep) {
+            *table_sizep = 0;
+            get_code_table(current->lengths, codes);
+            return true;
+        }
+    }
+
+    memcpy(current->lengths, code_lengths, num_symbols);
+    current->has_code = true;
+    get_code_table(code_lengths, codes);
+    return true;
+}
+
+void set_block_checksum(uint8_t *block, const uint8_t *src, size_t length) {
+    put_uint(crc32c(0, src, length), block + sizeof(uint64_t));
+}
+
+bool check_block_checksum(const uint8_t *block, const uint8_t *decoded) {
+    return crc32c(0, decoded, get_ulong(block)) == get_uint(block + sizeof(uint64_t));
+}
+
+size_t max_streams_size(size_t length, int num_streams) {
+    // every symbol with the longest prefix code, and each stream's padding,
+    // or for tANS, its final state and the marker before it
+    return (length * MAX_CODE_LENGTH + 7) / 8 + 3 * num_streams;
+}
+
+bool parse_block_header(const uint8_t *header, int num_streams, uint8_t flags,
+                        size_t *decoded_lengthp, size_t *block_sizep) {
+    uint64_t length = get_ulong(header);
+    uint64_t table_size = get_block_table_size(header);
+    // (so neither the bound below, nor the sum of the streams, can overflow)
+    if (length > MAX_BLOCK_LENGTH || table_size > num_symbols + 1) {
+        return false;
+    }
+
+    size_t max_size = max_streams_size(length, num_streams);
+    size_t streams_size = 0;
+    for (int k = 0; k < num_streams; k++) {
+        uint64_t stream_length = get_ulong(header + sizeof(uint64_t) * (2 + k));
+        if (stream_length > max_size) {
+            return false;
+        }
+        streams_size += stream_length;
+    }
+    // no valid block is bigger than this, so don't trust a header which says so
+    if (streams_size > max_size) {
+        return false;
+    }
+    // and a prefix code spends at least a bit on every symbol (or with wide symbols, every two),
+    // so nor is one with fewer bits than that. (tANS can spend less, so its blocks can't be held to it)
+    if (!(flags & FLAG_ANS_CODE) && length > (flags & FLAG_WIDE_SYMBOLS ? 16 : 8) * (uint64_t)streams_size) {
+        return false;
+    }
+
+    *decoded_lengthp = length;
+    *block_sizep = block_header_size(num_streams) + table_size + streams_size;
+    return true;
+}
+
+const uint8_t *get_block_table(const uint8_t *block, int num_streams, size_t *table_sizep) {
+    *table_sizep = get_block_table_size(block);
+    return block + block_header_size(num_streams);
+}
+
+bool update_current_code(const uint8_t *block, int num_streams, current_code *current, bool *changedp) {
+    size_t table_size;
+    const uint8_t *packed = get_block_table(block, num_streams, &table_size);
+    *changedp = table_size > 0;
+    if (table_size == 0) {
+        return true;
+    }
+    uint8_t code_lengths[num_symbols];
+    if (!unpack_block_table(packed, table_size, current->has_code ? current->lengths : NULL, code_lengths)) {
+        return false;
+    }
+    memcpy(current->lengths, code_lengths, num_symbols);
+    current->has_code = true;
+    return true;
+}
+
+// decodes the segments of a block, encoded with some code
+typedef bool (*segment_decoder)(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                const void *code, symbol *out, size_t length);
+
+static bool decode_with_table(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                              const void *table, symbol *out, size_t length) {
+    return decode_interleaved(streams, stream_lengths, num_streams, table, out, length);
+}
+
+static bool decode_with_contexts(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                 const void *context_entries, symbol *out, size_t length) {
+    return decode_interleaved_in_context(streams, stream_lengths, num_streams, context_entries, out, length);
+}
+
+static bool decode_with_ans(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                            const void *table, symbol *out, size_t length) {
+    return ans_decode_interleaved(streams, stream_lengths, num_streams, table, out, length);
+}
+
+static bool decode_with_wide_table(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                   const void *table, symbol *out, size_t length) {
+    return decode_wide_interleaved(streams, stream_lengths, num_streams, table, out, length);
+}
+
+static bool decode_segments(const uint8_t *block, int num_streams, segment_decoder decoder, const void *code,
+                            symbol *out) {
+    size_t length = get_ulong(block);
+    size_t table_size = get_block_table_size(block);
+
+    const uint8_t *streams[MAX_STREAMS];
+    size_t stream_lengths[MAX_STREAMS];
+    const uint8_t *stream = block + block_header_size(num_streams) + table_size;
+    for (int k = 0; k < num_streams; k++) {
+        streams[k] = stream;
+        stream_lengths[k] = get_ulong(block + sizeof(uint64_t) * (2 + k));
+        stream += stream_lengths[k];
+    }
+
+    return decoder(streams, stream_lengths, num_streams, code, out, length);
+}
+
+// decode only the segments bytes [from, to) of a block are in, each from its start (where its stream starts)
+// to as far as they need, in whole symbols of `symbol_size` bytes
+static bool decode_segments_part(const uint8_t *block, int num_streams, int symbol_size, segment_decoder decoder,
+                                 const void *code, size_t from, size_t to, symbol *out) {
+    size_t length = get_ulong(block);
+    size_t table_size = get_block_table_size(block);
+
+    size_t segment = symbol_size * segment_length((length + symbol_size - 1) / symbol_size, num_streams);
+    const uint8_t *stream = block + block_header_size(num_streams) + table_size;
+    for (int k = 0; k < num_streams; k++) {
+        size_t stream_length = get_ulong(block + sizeof(uint64_t) * (2 + k));
+        size_t start = k * segment;
+        size_t count = start >= length ? 0 : (length - start < segment ? length - start : segment);
+        if (start < to && start + count > from) {
+            size_t needed = to - start < count ? to - start : count;
+            needed += (symbol_size - needed % symbol_size) % symbol_size;
+            needed = needed < count ? needed : count;
+            if (!decoder(&stream, &stream_length, 1, code, out + start, needed)) {
+                return false;
+            }
+        }
+        stream += stream_length;
+    }
+    return true;
+}
+
+bool decode_block(const uint8_t *block, int num_streams, const decode_table *table, symbol *out) {
+    return decode_segments(block, num_streams, decode_with_table, table, out);
+}
+
+bool decode_context_block(const uint8_t *block, int num_streams, const decode_entry *const *context_entries,
+                          symbol *out) {
+    return decode_segments(block, num_streams, decode_with_contexts, context_entries, out);
+}
+
+bool decode_ans_block(const uint8_t *block, int num_streams, const ans_decode_table *table, symbol *out) {
+    return decode_segments(block, num_streams, decode_with_ans, table, out);
+}
+
+bool decode_wide_block(const uint8_t *block, int num_streams, const decode_table *table, uint8_t *out) {
+    return decode_segments(block, num_streams, decode_with_wide_table, table, out);
+}
+
+bool decode_block_part(const uint8_t *block, int num_streams, const decode_table *table, size_t from, size_t to,
+                       symbol *out) {
+    return decode_segments_part(block, num_streams, 1, decode_with_table, table, from, to, out);
+}
+
+bool decode_context_block_part(const uint8_t *block, int num_streams, const decode_entry *const *context_entries,
+                               size_t from, size_t to, symbol *out) {
+    return decode_segments_part(block, num_streams, 1, decode_with_contexts, context_entries, from, to, out);
+}
+
+bool decode_wide_block_part(const uint8_t *block, int num_streams, const decode_table *table, size_t from, size_t to,
+                            uint8_t *out) {
+    return decode_segments_part(block, num_streams, 2, decode_with_wide_table, table, from, to, out);
+}
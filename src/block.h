@@ -0,0 +1,130 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ans.h"
+#include "context.h"
+#include "huffman.h"
+
+// layout of an encoded block:
+//   decoded length (uint64)
+//   the CRC-32C of its decoded content (uint32), if the file has FLAG_BLOCK_CHECKSUMS, or else 0
+//   the byte length of the block's code table (uint32), 0 if it doesn't have one
+//   the byte length of each stream (uint64 each)
+//   the block's code table, packed as by pack_block_table
+//   the streams
+// a block without a code table is coded with the current code: the code of the
+// last block which had a table, or if none has yet, the file's
+// the block is split into `num_streams` equal segments (the last perhaps shorter, and with wide
+// symbols, each a whole number of them),
+// each encoded as a separate stream, so they can be decoded in lockstep.
+// a decoded length of 0, with nothing following, marks the end of the blocks
+
+#define MAX_STREAMS 16
+
+// the longest decoded length a block can have (so no bound on its size can overflow)
+#define MAX_BLOCK_LENGTH (SIZE_MAX / MAX_CODE_LENGTH / 2)
+
+// the size of the marker at the end of the blocks (a decoded length of 0)
+#define END_OF_BLOCKS_SIZE sizeof(uint64_t)
+
+size_t block_header_size(int num_streams);
+
+// a good number of bytes of input per block for `input_size` bytes (UINT64_MAX if unknown)
+// encoded on `num_threads` threads: big enough that block headers (and with `own_tables`,
+// each block's code table) cost little, small enough that a block and its encoding stay in
+// a core's cache, and that every thread gets several blocks
+size_t choose_block_size(uint64_t input_size, int num_threads, bool own_tables);
+
+// an upper bound on the bytes encode_block will write
+// (including a code table of up to num_symbols + 1 bytes)
+size_t block_bound(size_t length, int num_streams, const code_entry *table);
+// returns the number of bytes of encoded block written to `dest`.
+// `packed_table` is the block's own code table, of `table_size` bytes (NULL and 0 for none)
+size_t encode_block(const symbol *src, size_t length, const code_entry *table, int num_streams, 
+                    const uint8_t *packed_table, size_t table_size, uint8_t *dest);
+
+// an upper bound on the bytes encode_context_block will write, with this order-1 code
+size_t context_block_bound(size_t length, int num_streams, const context_code *);
+// encode a block with an order-1 code (see context.h): `context_codes` has the code table for each
+// context. such blocks never have their own code table.
+// returns the number of bytes written
+size_t encode_context_block(const symbol *src, size_t length, const code_entry *const *context_codes,
+                            int num_streams, uint8_t *dest);
+
+// an upper bound on the bytes encode_ans_block will write
+size_t ans_block_bound(size_t length, int num_streams);
+// encode a block with tANS (see ans.h) rather than a prefix code. such blocks never have
+// their own code table. returns the number of bytes written
+size_t encode_ans_block(const symbol *src, size_t length, const ans_encode_table *table, int num_streams, uint8_t *dest);
+
+// an upper bound on the bytes encode_wide_block will write
+size_t wide_block_bound(size_t length, int num_streams, const code_entry *table);
+// encode a block of `length` bytes as wide symbols (see huffman.h), with the code for them in `table`.
+// its segments are split between symbols, and it never has its own code table.
+// returns the number of bytes written
+size_t encode_wide_block(const uint8_t *src, size_t length, const code_entry *table, int num_streams, uint8_t *dest);
+
+// the code blocks are coded with, which changes when a block brings a code table
+typedef struct {
+    // the current code's lengths (num_symbols of them), if there's a current code yet
+    uint8_t *lengths;
+    bool has_code;
+} current_code;
+
+// an upper bound on the bytes encode_block will write for a block coded by choose_block_code
+size_t chosen_block_bound(size_t length, int num_streams);
+// choose the cheapest way to code a block: with the current code (sending no table),
+// or with the block's own code, sending its table as changes to the current one, or in full.
+// fills `codes` with the chosen code, and `table` (with space for num_symbols + 1 bytes)
+// with the table to send, of `*table_sizep` bytes (0 for none), updating `current` to match.
+// returns false if the block's code can't be limited to `max_code_length` (0 for no limit)
+bool choose_block_code(const symbol *src, size_t length, int max_code_length, current_code *current,
+                       code_entry *codes, uint8_t *table, size_t *table_sizep);
+// the same, for a block whose symbols have already been counted
+bool choose_code_for_frequencies(const long *symbol_frequencies, int max_code_length, current_code *current,
+                                 code_entry *codes, uint8_t *table, size_t *table_sizep);
+
+// store the CRC-32C of a block's `length` bytes of content, `src`, in its header (after encoding it)
+void set_block_checksum(uint8_t *block, const uint8_t *src, size_t length);
+// whether a block decoded to `decoded` (its decoded length of bytes) matches the CRC in its header
+bool check_block_checksum(const uint8_t *block, const uint8_t *decoded);
+
+// the most bytes the streams of any valid block of `length` symbols take
+size_t max_streams_size(size_t length, int num_streams);
+// read a block's header (of a file with these flags), finding its decoded length, and its total size
+// (including the header). returns false if the header is malformed, or its streams are too short for its length
+bool parse_block_header(const uint8_t *header, int num_streams, uint8_t flags,
+                        size_t *decoded_lengthp, size_t *block_sizep);
+// find a block's own code table, and its size (0 if it doesn't have one)
+const uint8_t *get_block_table(const uint8_t *block, int num_streams, size_t *table_sizep);
+// update the current code to a block's, if it brings a code table (setting `*changedp`).
+// returns false if the block's code table is malformed
+bool update_current_code(const uint8_t *block, int num_streams, current_code *current, bool *changedp);
+// decode a whole block (of size found by parse_block_header) into `out`,
+// which must have space for its decoded length.
+// returns false if the block is malformed
+bool decode_block(const uint8_t *block, int num_streams, const decode_table *table, symbol *out);
+// the same, for a block encoded by encode_context_block, with the decode table entries for each context
+bool decode_context_block(const uint8_t *block, int num_streams, const decode_entry *const *context_entries,
+                          symbol *out);
+// the same, for a block encoded by encode_ans_block
+bool decode_ans_block(const uint8_t *block, int num_streams, const ans_decode_table *table, symbol *out);
+// the same, for a block encoded by encode_wide_block, with the wide code's table
+bool decode_wide_block(const uint8_t *block, int num_streams, const decode_table *table, uint8_t *out);
+
+// decode only enough of a block for bytes [from, to) of it: the segments they're in, each from its start
+// (where its stream starts) to as far as they need, into their places in `out` (which must have space
+// for the block's decoded length, as for decode_block; the rest is left as it was).
+// returns false if the block is malformed. (tANS decodes each segment last first, so has no such part)
+bool decode_block_part(const uint8_t *block, int num_streams, const decode_table *table, size_t from, size_t to,
+                       symbol *out);
+bool decode_context_block_part(const uint8_t *block, int num_streams, const decode_entry *const *context_entries,
+                               size_t from, size_t to, symbol *out);
+bool decode_wide_block_part(const uint8_t *block, int num_streams, const decode_table *table, size_t from, size_t to,
+                            uint8_t *out);
+
+#endif // BLOCK_H
@@ -0,0 +1,1257 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "codec.h"
+#include "context.h"
+#include "format.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "writeutils.h"
+
+const encoder_options default_encoder_options = {
+    .block_size = 1 << 18,
+    .num_streams = 4,
+    .max_code_length = 0,
+    .table = NULL,
+    .checksums = false
+};
+
+const char *codec_status_message(codec_status status) {
+    switch (status) {
+    case CODEC_OK:
+        return "ok";
+    case CODEC_MORE_OUTPUT:
+        return "more output to come";
+    case CODEC_TRUNCATED:
+        return "compressed data ends too soon";
+    case CODEC_CORRUPT:
+        return "compressed data is malformed";
+    case CODEC_BLOCK_TOO_BIG:
+        return "block is bigger than the max block size";
+    case CODEC_OUTPUT_TOO_SMALL:
+        return "output buffer is too small";
+    case CODEC_CODES_TOO_LONG:
+        return "too many different bytes for codes of the max length";
+    case CODEC_BAD_OPTIONS:
+        return "options out of range";
+    case CODEC_OUT_OF_MEMORY:
+        return "out of memory";
+    case CODEC_WRONG_TABLE:
+        return "compressed with a shared table which wasn't given";
+    case CODEC_NO_SUCH_RECORD:
+        return "no such record";
+    case CODEC_BAD_CHECKSUM:
+        return "a block's content doesn't match its checksum";
+    }
+    return "unknown status";
+}
+
+static bool valid_options(const encoder_options *options) {
+    return options->block_size > 0 && options->block_size <= MAX_BLOCK_LENGTH &&
+           options->num_streams >= 1 && options->num_streams <= MAX_STREAMS &&
+           options->max_code_length >= 0 && options->max_code_length <= MAX_CODE_LENGTH;
+}
+
+struct codec_table {
+    uint32_t id;
+    uint8_t lengths[1 << 8];
+    code_entry codes[1 << 8];
+    decode_table *table;
+};
+
+codec_table *codec_table_new(const uint8_t *data, size_t size, codec_status *statusp) {
+    codec_table *t = malloc(sizeof(codec_table));
+    if (t == NULL) {
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    if (!unpack_table_file(data, size, t->lengths, &t->id) || !get_code_table(t->lengths, t->codes)) {
+        free(t);
+        *statusp = CODEC_CORRUPT;
+        return NULL;
+    }
+    t->table = decode_table_from_code_lengths(t->lengths);
+    if (t->table == NULL) {
+        free(t);
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    *statusp = CODEC_OK;
+    return t;
+}
+
+void codec_table_delete(codec_table *t) {
+    if (t == NULL) {
+        return;
+    }
+    decode_table_delete(t->table);
+    free(t);
+}
+
+uint32_t codec_table_id(const codec_table *t) {
+    return t->id;
+}
+
+// the size of the file header, and with a shared table, its ID
+static size_t header_size(const encoder_options *options) {
+    return file_header_size + (options->table != NULL ? sizeof(uint32_t) : 0);
+}
+
+// the file header, and with a shared table, its ID
+static size_t put_header(const encoder_options *options, uint8_t *out) {
+    file_header header = {
+        .flags = (options->table != NULL ? FLAG_SHARED_TABLE : FLAG_BLOCK_TABLES)
+               | (options->checksums ? FLAG_BLOCK_CHECKSUMS : 0),
+        .num_streams = options->num_streams
+    };
+    size_t size = put_file_header(&header, out);
+    if (options->table != NULL) {
+        put_uint(options->table->id, out + size);
+        size += sizeof(uint32_t);
+    }
+    return size;
+}
+
+// an upper bound on the bytes a block of `length` bytes encodes to:
+// with the shared table's code, or else the one chosen for it
+static size_t encoded_block_bound(const encoder_options *options, size_t length) {
+    return options->table != NULL ? block_bound(length, options->num_streams, options->table->codes)
+                                  : chosen_block_bound(length, options->num_streams);
+}
+
+// encode a block as the options say, into `dest` (with space for encoded_block_bound bytes).
+// returns the number of bytes written, or 0 if its code can't be limited to the max code length
+static size_t encode_with_options(const encoder_options *options, const uint8_t *src, size_t length,
+                                  current_code *current, code_entry *codes, uint8_t *table, uint8_t *dest) {
+    size_t size;
+    if (options->table != NULL) {
+        size = encode_block(src, length, options->table->codes, options->num_streams, NULL, 0, dest);
+    }else {
+        size_t table_size;
+        if (!choose_block_code(src, length, options->max_code_length, current, codes, table, &table_size)) {
+            return 0;
+        }
+        size = encode_block(src, length, codes, options->num_streams, table, table_size, dest);
+    }
+    if (options->checksums) {
+        set_block_checksum(dest, src, length);
+    }
+    return size;
+}
+
+// copy as much of `size` bytes from `*posp` in `pending` as fits in the output.
+// returns whether it's all been copied
+static bool drain(const uint8_t *pending, size_t size, size_t *posp, codec_output *out) {
+    size_t n = size - *posp;
+    if (n > out->size - out->pos) {
+        n = out->size - out->pos;
+    }
+    if (n > 0) {
+        memcpy(out->data + out->pos, pending + *posp, n);
+    }
+    out->pos += n;
+    *posp += n;
+    return *posp == size;
+}
+
+struct encoder {
+    encoder_options options;
+    // input collected until there's a whole block of it
+    uint8_t *block;
+    size_t block_length;
+    // encoded output waiting for space
+    uint8_t *pending;
+    size_t pending_size;
+    size_t pending_pos;
+    current_code current;
+    // the code and table chosen for each block
+    code_entry *codes;
+    uint8_t *table;
+    bool finished;
+    // errors stick until a reset
+    codec_status error;
+};
+
+encoder *encoder_new(const encoder_options *options, codec_status *statusp) {
+    if (!valid_options(options)) {
+        *statusp = CODEC_BAD_OPTIONS;
+        return NULL;
+    }
+    encoder *e = calloc(1, sizeof(encoder));
+    if (e == NULL) {
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    e->options = *options;
+    e->block = malloc(options->block_size);
+    // a block and the end marker after it
+    e->pending = malloc(encoded_block_bound(options, options->block_size) + END_OF_BLOCKS_SIZE);
+    e->current.lengths = malloc(num_symbols);
+    e->codes = malloc(num_symbols * sizeof(code_entry));
+    e->table = malloc(num_symbols + 1);
+    if (e->block == NULL || e->pending == NULL || e->current.lengths == NULL || e->codes == NULL || e->table == NULL) {
+        encoder_delete(e);
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    encoder_reset(e);
+    *statusp = CODEC_OK;
+    return e;
+}
+
+void encoder_delete(encoder *e) {
+    if (e == NULL) {
+        return;
+    }
+    free(e->block);
+    free(e->pending);
+    free(e->current.lengths);
+    free(e->codes);
+    free(e->table);
+    free(e);
+}
+
+void encoder_reset(encoder *e) {
+    e->block_length = 0;
+    e->pending_size = put_header(&e->options, e->pending);
+    e->pending_pos = 0;
+    e->current.has_code = false;
+    e->finished = false;
+    e->error = CODEC_OK;
+}
+
+// encode a block straight into the output if it's sure to fit, or else into the pending output
+static codec_status encode_next_block(encoder *e, const uint8_t *src, size_t length, codec_output *out) {
+    bool direct = out->size - out->pos >= encoded_block_bound(&e->options, length);
+    size_t size = encode_with_options(&e->options, src, length, &e->current, e->codes, e->table,
+                                      direct ? out->data + out->pos : e->pending);
+    if (size == 0) {
+        return e->error = CODEC_CODES_TOO_LONG;
+    }
+    if (direct) {
+        out->pos += size;
+    }else {
+        e->pending_size = size;
+        e->pending_pos = 0;
+    }
+    return CODEC_OK;
+}
+
+codec_status encoder_update(encoder *e, codec_input *in, codec_output *out) {
+    if (e->error != CODEC_OK) {
+        return e->error;
+    }
+    size_t block_size = e->options.block_size;
+    while (true) {
+        if (!drain(e->pending, e->pending_size, &e->pending_pos, out)) {
+            return CODEC_MORE_OUTPUT;
+        }
+        size_t available = in->size - in->pos;
+        if (available == 0) {
+            return CODEC_OK;
+        }
+
+        const uint8_t *src;
+        if (e->block_length == 0 && available >= block_size) {
+            // a whole block of input, which can be encoded where it is
+            src = in->data + in->pos;
+            in->pos += block_size;
+        }else {
+            size_t n = block_size - e->block_length;
+            if (n > available) {
+                n = available;
+            }
+            memcpy(e->block + e->block_length, in->data + in->pos, n);
+            e->block_length += n;
+            in->pos += n;
+            if (e->block_length < block_size) {
+                return CODEC_OK;
+            }
+            src = e->block;
+            e->block_length = 0;
+        }
+        codec_status status = encode_next_block(e, src, block_size, out);
+        if (status != CODEC_OK) {
+            return status;
+        }
+    }
+}
+
+codec_status encoder_finish(encoder *e, codec_output *out) {
+    if (e->error != CODEC_OK) {
+        return e->error;
+    }
+    if (!drain(e->pending, e->pending_size, &e->pending_pos, out)) {
+        return CODEC_MORE_OUTPUT;
+    }
+    if (!e->finished) {
+        e->finished = true;
+        // the last, partial block and the end marker, all together in the pending output
+        e->pending_size = 0;
+        e->pending_pos = 0;
+        if (e->block_length > 0) {
+            codec_output none = { .data = NULL, .size = 0, .pos = 0 };
+            codec_status status = encode_next_block(e, e->block, e->block_length, &none);
+            if (status != CODEC_OK) {
+                return status;
+            }
+            e->block_length = 0;
+        }
+        put_ulong(0, e->pending + e->pending_size);
+        e->pending_size += END_OF_BLOCKS_SIZE;
+    }
+    return drain(e->pending, e->pending_size, &e->pending_pos, out) ? CODEC_OK : CODEC_MORE_OUTPUT;
+}
+
+// the code blocks are decoded with, and its decode table
+typedef struct {
+    current_code current;
+    decode_table table;
+    decode_entry *entries;
+    // whether `table` is for the current code
+    bool table_built;
+    // if the file has an order-1 code, which blocks are decoded with until one brings
+    // a code of its own: the table for each group of contexts, and the entries for each context
+    decode_table *group_tables[MAX_CONTEXT_GROUPS];
+    int num_group_tables;
+    const decode_entry *context_entries[NUM_CONTEXTS];
+    // or if its blocks are coded with tANS, the table for its counts (kept here, so reading a file's
+    // counts needs no memory of its own), and whether it's for this file's
+    ans_decode_table ans;
+    bool has_ans;
+    // or if its blocks are coded as wide symbols, the table for their code
+    decode_table *wide;
+    // the shared table given to decode with (NULL for none), and whether the file's code is it
+    const codec_table *shared;
+    bool use_shared;
+} decoding_code;
+
+// drop the file's order-1 code, tANS table or wide code's table
+static void delete_file_code(decoding_code *code) {
+    code->use_shared = false;
+    for (int g = 0; g < code->num_group_tables; g++) {
+        decode_table_delete(code->group_tables[g]);
+    }
+    code->num_group_tables = 0;
+    code->has_ans = false;
+    decode_table_delete(code->wide);
+    code->wide = NULL;
+}
+
+// take the file's code, packed in `size` bytes: its code lengths, order-1 code, tANS counts,
+// wide code lengths or shared table's ID
+static codec_status set_file_code(decoding_code *code, const file_header *header, const uint8_t *packed, size_t size) {
+    if (header->flags & FLAG_SHARED_TABLE) {
+        if (code->shared == NULL || get_uint(packed) != code->shared->id) {
+            return CODEC_WRONG_TABLE;
+        }
+        code->use_shared = true;
+        return CODEC_OK;
+    }
+    if (header->flags & FLAG_WIDE_SYMBOLS) {
+        uint8_t *lengths = malloc(NUM_WIDE_SYMBOLS);
+        if (lengths == NULL) {
+            return CODEC_OUT_OF_MEMORY;
+        }
+        if (unpack_wide_code_lengths(packed, size, lengths)) {
+            code->wide = wide_decode_table_from_code_lengths(lengths);
+        }
+        free(lengths);
+        return code->wide != NULL ? CODEC_OK : CODEC_CORRUPT;
+    }
+    if (header->flags & FLAG_ANS_CODE) {
+        uint16_t counts[num_symbols];
+        if (!unpack_ans_counts(packed, size, counts)) {
+            return CODEC_CORRUPT;
+        }
+        code->has_ans = ans_decode_table_init(counts, &code->ans);
+        return code->has_ans ? CODEC_OK : CODEC_CORRUPT;
+    }
+    if (!(header->flags & FLAG_CONTEXT_CODE)) {
+        if (!unpack_code_lengths(packed, size, code->current.lengths)) {
+            return CODEC_CORRUPT;
+        }
+        code->current.has_code = true;
+        return CODEC_OK;
+    }
+    context_code context;
+    if (!unpack_context_code(packed, size, &context)
+        || !get_context_decode_tables(&context, code->group_tables, code->context_entries)) {
+        return CODEC_CORRUPT;
+    }
+    code->num_group_tables = context.num_groups;
+    return CODEC_OK;
+}
+
+// the size of the file's code at `packed`, or 0 if it doesn't end within `available` bytes
+static size_t file_code_size(const file_header *header, const uint8_t *packed, size_t available) {
+    if (header->flags & FLAG_SHARED_TABLE) {
+        return available >= sizeof(uint32_t) ? sizeof(uint32_t) : 0;
+    }
+    return header->flags & FLAG_CONTEXT_CODE ? packed_context_code_size(packed, available)
+         : header->flags & FLAG_ANS_CODE ? packed_ans_counts_size(packed, available)
+         : header->flags & FLAG_WIDE_SYMBOLS ? packed_wide_code_lengths_size(packed, available)
+                                             : packed_code_lengths_size(packed, available);
+}
+
+// how much of the file's code to collect before checking whether it's all there:
+// for wide code lengths, as much as they must take, and for the others (which are small), a byte more
+static size_t file_code_needed(const file_header *header, const uint8_t *packed, size_t available) {
+    return header->flags & FLAG_WIDE_SYMBOLS ? min_packed_wide_code_lengths_size(packed, available) : available + 1;
+}
+
+// follow a block's code table, if it has one, and make sure the decode table matches
+static codec_status prepare_block_code(decoding_code *code, const uint8_t *block, int num_streams) {
+    bool changed;
+    if (!update_current_code(block, num_streams, &code->current, &changed)) {
+        return CODEC_CORRUPT;
+    }
+    if (changed || !code->table_built) {
+        if (!code->current.has_code) {
+            // (then blocks are decoded with the file's order-1 code, tANS, wide or shared table, if it has one)
+            return code->num_group_tables > 0 || code->has_ans || code->wide != NULL || code->use_shared
+                 ? CODEC_OK : CODEC_CORRUPT;
+        }
+        if (!decode_table_init(&code->table, code->entries, code->current.lengths)) {
+            return CODEC_CORRUPT;
+        }
+        code->table_built = true;
+    }
+    return CODEC_OK;
+}
+
+// decode a block prepared by prepare_block_code
+static bool decode_with_code(const decoding_code *code, const uint8_t *block, int num_streams, uint8_t *dest) {
+    if (code->current.has_code) {
+        return decode_block(block, num_streams, &code->table, dest);
+    }
+    if (code->wide != NULL) {
+        return decode_wide_block(block, num_streams, code->wide, dest);
+    }
+    if (code->use_shared) {
+        return decode_block(block, num_streams, code->shared->table, dest);
+    }
+    return code->has_ans ? decode_ans_block(block, num_streams, &code->ans, dest)
+                             : decode_context_block(block, num_streams, code->context_entries, dest);
+}
+
+// decode only enough of a block prepared by prepare_block_code for bytes [from, to) of it
+// (or with tANS, all of it) into their places in `dest`
+static bool decode_part_with_code(const decoding_code *code, const uint8_t *block, int num_streams,
+                                  size_t from, size_t to, uint8_t *dest) {
+    if (code->current.has_code) {
+        return decode_block_part(block, num_streams, &code->table, from, to, dest);
+    }
+    if (code->wide != NULL) {
+        return decode_wide_block_part(block, num_streams, code->wide, from, to, dest);
+    }
+    if (code->use_shared) {
+        return decode_block_part(block, num_streams, code->shared->table, from, to, dest);
+    }
+    return code->has_ans ? decode_ans_block(block, num_streams, &code->ans, dest)
+                             : decode_context_block_part(block, num_streams, code->context_entries, from, to, dest);
+}
+
+// the blocks of compressed data in `size` bytes start at `*offsetp`, after the file header and
+// any code for the whole file (which goes in `code`, if it isn't NULL)
+static codec_status find_first_block(const uint8_t *src, size_t size, file_header *header,
+                                     decoding_code *code, size_t *offsetp) {
+    if (size < file_header_size) {
+        return CODEC_TRUNCATED;
+    }
+    if (!get_file_header(src, header) || header->num_streams < 1 || header->num_streams > MAX_STREAMS) {
+        return CODEC_CORRUPT;
+    }
+    if (header->flags & FLAG_RECORDS) {
+        // (which has no blocks)
+        return CODEC_CORRUPT;
+    }
+    size_t offset = file_header_size;
+    if (!(header->flags & FLAG_BLOCK_TABLES)) {
+        size_t packed_size = file_code_size(header, src + offset, size - offset);
+        if (packed_size == 0) {
+            return CODEC_TRUNCATED;
+        }
+        if (code != NULL) {
+            codec_status status = set_file_code(code, header, src + offset, packed_size);
+            if (status != CODEC_OK) {
+                return status;
+            }
+        }
+        offset += packed_size;
+    }
+    *offsetp = offset;
+    return CODEC_OK;
+}
+
+typedef enum {
+    READ_FILE_HEADER,
+    READ_FILE_CODE,
+    READ_BLOCKS,
+    READ_DONE
+} decoder_state;
+
+struct decoder {
+    size_t max_block_size;
+    decoder_state state;
+    file_header header;
+    // a piece of input (a header, the file's code or a block) collected as it arrives
+    uint8_t *piece;
+    size_t piece_capacity;
+    size_t piece_length;
+    // decoded output waiting for space
+    uint8_t *decoded;
+    size_t decoded_size;
+    size_t decoded_pos;
+    decoding_code code;
+    // errors stick until a reset
+    codec_status error;
+};
+
+// the largest compressed block which decodes to `length` bytes
+static size_t max_compressed_block_size(size_t length) {
+    return block_header_size(MAX_STREAMS) + num_symbols + 1 + max_streams_size(length, MAX_STREAMS);
+}
+
+decoder *decoder_new(size_t max_block_size, codec_status *statusp) {
+    decoder *d = calloc(1, sizeof(decoder));
+    if (d == NULL) {
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    d->max_block_size = max_block_size;
+    // big enough for the file's code too
+    d->piece_capacity = max_compressed_block_size(max_block_size);
+    if (d->piece_capacity < MAX_PACKED_WIDE_CODE_LENGTHS) {
+        d->piece_capacity = MAX_PACKED_WIDE_CODE_LENGTHS;
+    }
+    d->piece = malloc(d->piece_capacity);
+    d->decoded = malloc(max_block_size > 0 ? max_block_size : 1);
+    d->code.current.lengths = malloc(num_symbols);
+    d->code.entries = malloc(decode_table_max_entries() * sizeof(decode_entry));
+    if (d->piece == NULL || d->decoded == NULL || d->code.current.lengths == NULL || d->code.entries == NULL) {
+        decoder_delete(d);
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    decoder_reset(d);
+    *statusp = CODEC_OK;
+    return d;
+}
+
+void decoder_delete(decoder *d) {
+    if (d == NULL) {
+        return;
+    }
+    free(d->piece);
+    free(d->decoded);
+    free(d->code.current.lengths);
+    free(d->code.entries);
+    delete_file_code(&d->code);
+    free(d);
+}
+
+void decoder_reset(decoder *d) {
+    d->state = READ_FILE_HEADER;
+    d->piece_length = 0;
+    d->decoded_size = 0;
+    d->decoded_pos = 0;
+    d->code.current.has_code = false;
+    d->code.table_built = false;
+    delete_file_code(&d->code);
+    d->error = CODEC_OK;
+}
+
+void decoder_set_table(decoder *d, const codec_table *table) {
+    d->code.shared = table;
+}
+
+// add input to the piece until it's at least `length` bytes. returns whether it is
+static bool collect(decoder *d, codec_input *in, size_t length) {
+    if (d->piece_length >= length) {
+        return true;
+    }
+    size_t n = length - d->piece_length;
+    if (n > in->size - in->pos) {
+        n = in->size - in->pos;
+    }
+    memcpy(d->piece + d->piece_length, in->data + in->pos, n);
+    d->piece_length += n;
+    in->pos += n;
+    return d->piece_length == length;
+}
+
+// check a block's header, finding its size
+static codec_status check_block_header(decoder *d, const uint8_t *header, size_t *decoded_lengthp, size_t *block_sizep) {
+    if (!parse_block_header(header, d->header.num_streams, d->header.flags, decoded_lengthp, block_sizep)) {
+        return CODEC_CORRUPT;
+    }
+    return *decoded_lengthp > d->max_block_size ? CODEC_BLOCK_TOO_BIG : CODEC_OK;
+}
+
+// decode a whole block, and if the file has checksums, check it against its own
+static codec_status decode_and_check(const decoding_code *code, const file_header *header, const uint8_t *block,
+                                     uint8_t *dest) {
+    if (!decode_with_code(code, block, header->num_streams, dest)) {
+        return CODEC_CORRUPT;
+    }
+    return !(header->flags & FLAG_BLOCK_CHECKSUMS) || check_block_checksum(block, dest) ? CODEC_OK : CODEC_BAD_CHECKSUM;
+}
+
+// decode a whole block straight into the output if it fits, or else into the pending output
+static codec_status decode_next_block(decoder *d, const uint8_t *block, size_t decoded_length, codec_output *out) {
+    codec_status status = prepare_block_code(&d->code, block, d->header.num_streams);
+    if (status != CODEC_OK) {
+        return status;
+    }
+    uint8_t *dest;
+    if (out->size - out->pos >= decoded_length) {
+        dest = out->data + out->pos;
+        out->pos += decoded_length;
+    }else {
+        dest = d->decoded;
+        d->decoded_size = decoded_length;
+        d->decoded_pos = 0;
+    }
+    return decode_and_check(&d->code, &d->header, block, dest);
+}
+
+// read blocks until the input runs out, or a block's output doesn't all fit
+static codec_status read_blocks(decoder *d, codec_input *in, codec_output *out) {
+    size_t header_size = block_header_size(d->header.num_streams);
+    while (d->decoded_pos == d->decoded_size) {
+        size_t available = in->size - in->pos;
+        const uint8_t *next = in->data + in->pos;
+        size_t decoded_length, block_size;
+        codec_status status;
+
+        if (d->piece_length == 0 && available >= END_OF_BLOCKS_SIZE && get_ulong(next) == 0) {
+            in->pos += END_OF_BLOCKS_SIZE;
+            d->state = READ_DONE;
+            return CODEC_OK;
+        }
+        if (d->piece_length == 0 && available >= header_size) {
+            status = check_block_header(d, next, &decoded_length, &block_size);
+            if (status != CODEC_OK) {
+                return status;
+            }
+            if (available >= block_size) {
+                // the whole block is in the input already
+                in->pos += block_size;
+                status = decode_next_block(d, next, decoded_length, out);
+                if (status != CODEC_OK) {
+                    return status;
+                }
+                continue;
+            }
+        }
+
+        if (!collect(d, in, END_OF_BLOCKS_SIZE)) {
+            return CODEC_OK;
+        }
+        if (get_ulong(d->piece) == 0) {
+            d->piece_length = 0;
+            d->state = READ_DONE;
+            return CODEC_OK;
+        }
+        if (!collect(d, in, header_size)) {
+            return CODEC_OK;
+        }
+        status = check_block_header(d, d->piece, &decoded_length, &block_size);
+        if (status != CODEC_OK) {
+            return status;
+        }
+        if (!collect(d, in, block_size)) {
+            return CODEC_OK;
+        }
+        d->piece_length = 0;
+        status = decode_next_block(d, d->piece, decoded_length, out);
+        if (status != CODEC_OK) {
+            return status;
+        }
+    }
+    return CODEC_OK;
+}
+
+codec_status decoder_update(decoder *d, codec_input *in, codec_output *out) {
+    if (d->error != CODEC_OK) {
+        return d->error;
+    }
+    codec_status status = CODEC_OK;
+    while (status == CODEC_OK) {
+        if (!drain(d->decoded, d->decoded_size, &d->decoded_pos, out)) {
+            return CODEC_MORE_OUTPUT;
+        }
+        if (in->pos == in->size && d->state != READ_DONE) {
+            return CODEC_OK;
+        }
+
+        switch (d->state) {
+        case READ_FILE_HEADER:
+            if (!collect(d, in, file_header_size)) {
+                return CODEC_OK;
+            }
+            d->piece_length = 0;
+            if (!get_file_header(d->piece, &d->header) || d->header.num_streams < 1 || d->header.num_streams > MAX_STREAMS
+                || (d->header.flags & FLAG_RECORDS)) {
+                status = CODEC_CORRUPT;
+            }else {
+                d->state = d->header.flags & FLAG_BLOCK_TABLES ? READ_BLOCKS : READ_FILE_CODE;
+            }
+            break;
+        case READ_FILE_CODE:
+            // their size isn't known until they end, so take a little at a time
+            if (file_code_needed(&d->header, d->piece, d->piece_length) > d->piece_capacity) {
+                status = CODEC_CORRUPT;
+                break;
+            }
+            if (!collect(d, in, file_code_needed(&d->header, d->piece, d->piece_length))) {
+                return CODEC_OK;
+            }
+            if (file_code_size(&d->header, d->piece, d->piece_length) != 0) {
+                status = set_file_code(&d->code, &d->header, d->piece, d->piece_length);
+                d->piece_length = 0;
+                d->state = READ_BLOCKS;
+            }
+            break;
+        case READ_BLOCKS:
+            status = read_blocks(d, in, out);
+            break;
+        case READ_DONE:
+            // skip whatever follows the blocks
+            in->pos = in->size;
+            return drain(d->decoded, d->decoded_size, &d->decoded_pos, out) ? CODEC_OK : CODEC_MORE_OUTPUT;
+        }
+    }
+    return d->error = status;
+}
+
+codec_status decoder_finish(decoder *d, codec_output *out) {
+    if (d->error != CODEC_OK) {
+        return d->error;
+    }
+    if (!drain(d->decoded, d->decoded_size, &d->decoded_pos, out)) {
+        return CODEC_MORE_OUTPUT;
+    }
+    return d->state == READ_DONE ? CODEC_OK : CODEC_TRUNCATED;
+}
+
+size_t compress_bound(size_t length, const encoder_options *options) {
+    if (!valid_options(options)) {
+        return 0;
+    }
+    size_t num_blocks = (length + options->block_size - 1) / options->block_size;
+    size_t bound = header_size(options) + END_OF_BLOCKS_SIZE;
+    if (num_blocks > 0) {
+        size_t last_length = length - (num_blocks - 1) * options->block_size;
+        bound += (num_blocks - 1) * encoded_block_bound(options, options->block_size) +
+                 encoded_block_bound(options, last_length);
+    }
+    return bound;
+}
+
+codec_status compress_buffer(const uint8_t *src, size_t length, uint8_t *dest, size_t capacity,
+                             size_t *compressed_sizep, const encoder_options *options) {
+    if (!valid_options(options)) {
+        return CODEC_BAD_OPTIONS;
+    }
+    if (capacity < header_size(options) + END_OF_BLOCKS_SIZE) {
+        return CODEC_OUTPUT_TOO_SMALL;
+    }
+    uint8_t lengths[num_symbols];
+    current_code current = { .lengths = lengths, .has_code = false };
+    code_entry codes[num_symbols];
+    uint8_t table[num_symbols + 1];
+
+    size_t size = put_header(options, dest);
+    for (size_t start = 0; start < length; start += options->block_size) {
+        size_t block_length = length - start < options->block_size ? length - start : options->block_size;
+        // leaving space for the end marker
+        if (capacity - size < encoded_block_bound(options, block_length) + END_OF_BLOCKS_SIZE) {
+            return CODEC_OUTPUT_TOO_SMALL;
+        }
+        size_t encoded_size = encode_with_options(options, src + start, block_length, &current, codes, table, dest + size);
+        if (encoded_size == 0) {
+            return CODEC_CODES_TOO_LONG;
+        }
+        size += encoded_size;
+    }
+    put_ulong(0, dest + size);
+    *compressed_sizep = size + END_OF_BLOCKS_SIZE;
+    return CODEC_OK;
+}
+
+// the size of the records' encodings in all is at most this:
+// their own code never takes more bits in all than one of all `symbol_bitsize` bit codes,
+// each record is padded by less than a byte, and the last leaves encode_bytes' slack after it
+static size_t encoded_records_bound(size_t num_records, size_t total_length, const encoder_options *options) {
+    return num_records + (options->table != NULL ? encode_bound(total_length, options->table->codes)
+                                                 : total_length + sizeof(uint32_t));
+}
+
+size_t compress_records_bound(size_t num_records, size_t total_length, const encoder_options *options) {
+    size_t code_size = options->table != NULL ? sizeof(uint32_t) : num_symbols;
+    size_t encoded_bound = encoded_records_bound(num_records, total_length, options);
+    return file_header_size + code_size + RECORDS_HEADER_SIZE
+         + num_records * 2 * record_field_size(total_length, encoded_bound) + encoded_bound;
+}
+
+codec_status compress_records(const uint8_t *const *records, const size_t *lengths, size_t num_records,
+                              uint8_t *dest, size_t capacity, size_t *compressed_sizep, const encoder_options *options) {
+    if (options->max_code_length < 0 || options->max_code_length > MAX_CODE_LENGTH) {
+        return CODEC_BAD_OPTIONS;
+    }
+    size_t total_length = 0;
+    for (size_t i = 0; i < num_records; i++) {
+        total_length += lengths[i];
+    }
+    if (capacity < compress_records_bound(num_records, total_length, options)) {
+        return CODEC_OUTPUT_TOO_SMALL;
+    }
+    code_entry own_codes[num_symbols];
+    const code_entry *codes = own_codes;
+    file_header header = { .flags = FLAG_RECORDS, .num_streams = 1 };
+    size_t size;
+    if (options->table != NULL) {
+        header.flags |= FLAG_SHARED_TABLE;
+        size = put_file_header(&header, dest);
+        put_uint(options->table->id, dest + size);
+        size += sizeof(uint32_t);
+        codes = options->table->codes;
+    }else {
+        long symbol_frequencies[num_symbols];
+        memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+        for (size_t i = 0; i < num_records; i++) {
+            histogram(records[i], lengths[i], symbol_frequencies);
+        }
+        uint8_t code_lengths[num_symbols];
+        if (!build_code_lengths(symbol_frequencies, options->max_code_length, code_lengths)
+            || !get_code_table(code_lengths, own_codes)) {
+            return CODEC_CODES_TOO_LONG;
+        }
+        size = put_file_header(&header, dest);
+        size += pack_code_lengths(code_lengths, dest + size);
+    }
+
+    // (the index comes before the encodings, so its fields are sized for as big as they might be)
+    records_header records_header = {
+        .num_records = num_records,
+        .decoded_size = total_length,
+        .encoded_size = 0,
+        .field_size = record_field_size(total_length, encoded_records_bound(num_records, total_length, options))
+    };
+    uint8_t *index = dest + size + RECORDS_HEADER_SIZE;
+    uint8_t *encoded = index + record_index_size(&records_header);
+    // each record's encoding overwrites the slack encode_bytes leaves after the one before
+    for (size_t i = 0; i < num_records; i++) {
+        record_entry entry = { .offset = records_header.encoded_size, .length = lengths[i] };
+        put_record_entry(&entry, records_header.field_size, index + i * 2 * records_header.field_size);
+        records_header.encoded_size += encode_bytes(records[i], lengths[i], codes, encoded + records_header.encoded_size);
+    }
+    put_records_header(&records_header, dest + size);
+    *compressed_sizep = (size_t)(encoded - dest) + records_header.encoded_size;
+    return CODEC_OK;
+}
+
+struct record_reader {
+    records_header header;
+    const uint8_t *index;
+    const uint8_t *encoded;
+    // the records' own code, or NULL if they were coded with the shared table
+    decode_table *own_table;
+    const decode_table *table;
+};
+
+// find the index and encodings of the records compressed in `size` bytes, for `r`.
+// (the file's code is right after the file header)
+static codec_status find_records(const uint8_t *src, size_t size, file_header *header, record_reader *r) {
+    if (size < file_header_size) {
+        return CODEC_TRUNCATED;
+    }
+    if (!get_file_header(src, header) || !(header->flags & FLAG_RECORDS)) {
+        return CODEC_CORRUPT;
+    }
+    size_t offset = file_header_size;
+    size_t code_size = file_code_size(header, src + offset, size - offset);
+    if (code_size == 0 || size - offset - code_size < RECORDS_HEADER_SIZE) {
+        return CODEC_TRUNCATED;
+    }
+    offset += code_size;
+    if (!get_records_header(src + offset, &r->header)) {
+        return CODEC_CORRUPT;
+    }
+    offset += RECORDS_HEADER_SIZE;
+    if (r->header.num_records > (size - offset) / (2 * r->header.field_size)
+        || r->header.encoded_size > size - offset - record_index_size(&r->header)) {
+        return CODEC_TRUNCATED;
+    }
+    r->index = src + offset;
+    r->encoded = r->index + record_index_size(&r->header);
+    return CODEC_OK;
+}
+
+// the index entry for record `i` (which there must be)
+static void get_entry(const record_reader *r, uint64_t i, record_entry *entry) {
+    get_record_entry(r->index + i * 2 * r->header.field_size, r->header.field_size, entry);
+}
+
+record_reader *record_reader_new(const uint8_t *src, size_t size, const codec_table *shared, codec_status *statusp) {
+    record_reader found;
+    file_header header;
+    codec_status status = find_records(src, size, &header, &found);
+    if (status != CODEC_OK) {
+        *statusp = status;
+        return NULL;
+    }
+    const uint8_t *code = src + file_header_size;
+    uint8_t code_lengths[num_symbols];
+    if (header.flags & FLAG_SHARED_TABLE) {
+        if (shared == NULL || get_uint(code) != shared->id) {
+            *statusp = CODEC_WRONG_TABLE;
+            return NULL;
+        }
+    }else if (!unpack_code_lengths(code, packed_code_lengths_size(code, size - file_header_size), code_lengths)) {
+        *statusp = CODEC_CORRUPT;
+        return NULL;
+    }
+
+    record_reader *r = malloc(sizeof(record_reader));
+    if (r == NULL) {
+        *statusp = CODEC_OUT_OF_MEMORY;
+        return NULL;
+    }
+    *r = found;
+    r->own_table = NULL;
+    r->table = NULL;
+    if (header.flags & FLAG_SHARED_TABLE) {
+        r->table = shared->table;
+    }else {
+        r->own_table = decode_table_from_code_lengths(code_lengths);
+        if (r->own_table == NULL) {
+            free(r);
+            *statusp = CODEC_CORRUPT;
+            return NULL;
+        }
+        r->table = r->own_table;
+    }
+    *statusp = CODEC_OK;
+    return r;
+}
+
+void record_reader_delete(record_reader *r) {
+    if (r == NULL) {
+        return;
+    }
+    decode_table_delete(r->own_table);
+    free(r);
+}
+
+uint64_t record_count(const record_reader *r) {
+    return r->header.num_records;
+}
+
+// find record `i`'s entry, and the size of its encoding.
+// returns CODEC_CORRUPT if they're not ones a record could have
+static codec_status find_record(const record_reader *r, uint64_t i, record_entry *entry, size_t *stream_lengthp) {
+    if (i >= r->header.num_records) {
+        return CODEC_NO_SUCH_RECORD;
+    }
+    record_entry next = { .offset = r->header.encoded_size };
+    get_entry(r, i, entry);
+    if (i + 1 < r->header.num_records) {
+        get_entry(r, i + 1, &next);
+    }
+    if (entry->offset > next.offset || next.offset > r->header.encoded_size) {
+        return CODEC_CORRUPT;
+    }
+    // (its code spends at least a bit on each byte, so a longer one is corrupt, not just big)
+    *stream_lengthp = next.offset - entry->offset;
+    if (entry->length > 8 * (uint64_t)*stream_lengthp) {
+        return CODEC_CORRUPT;
+    }
+    return CODEC_OK;
+}
+
+codec_status record_length(const record_reader *r, uint64_t i, uint64_t *lengthp) {
+    record_entry entry;
+    size_t stream_length;
+    codec_status status = find_record(r, i, &entry, &stream_length);
+    if (status == CODEC_OK) {
+        *lengthp = entry.length;
+    }
+    return status;
+}
+
+codec_status read_record(const record_reader *r, uint64_t i, uint8_t *dest, size_t capacity, size_t *lengthp) {
+    record_entry entry;
+    size_t stream_length;
+    codec_status status = find_record(r, i, &entry, &stream_length);
+    if (status != CODEC_OK) {
+        return status;
+    }
+    if (capacity < entry.length) {
+        return CODEC_OUTPUT_TOO_SMALL;
+    }
+    const unsigned char *stream = r->encoded + entry.offset;
+    if (!decode_interleaved(&stream, &stream_length, 1, r->table, dest, entry.length)) {
+        return CODEC_CORRUPT;
+    }
+    *lengthp = entry.length;
+    return CODEC_OK;
+}
+
+// whether compressed data is records rather than blocks
+static bool has_records(const uint8_t *src, size_t size) {
+    file_header header;
+    return size >= file_header_size && get_file_header(src, &header) && (header.flags & FLAG_RECORDS);
+}
+
+// decompressed_length, for records (which needs no table)
+static codec_status records_length(const uint8_t *src, size_t size, uint64_t *lengthp) {
+    record_reader r;
+    file_header header;
+    codec_status status = find_records(src, size, &header, &r);
+    if (status == CODEC_OK) {
+        *lengthp = r.header.decoded_size;
+    }
+    return status;
+}
+
+// decompress_buffer_with_table, for records: all of them, one after another
+static codec_status decompress_records(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity,
+                                       size_t *decompressed_sizep, const codec_table *table) {
+    codec_status status;
+    record_reader *r = record_reader_new(src, size, table, &status);
+    if (r == NULL) {
+        return status;
+    }
+    size_t written = 0;
+    for (uint64_t i = 0; i < r->header.num_records && status == CODEC_OK; i++) {
+        size_t length;
+        status = read_record(r, i, dest + written, capacity - written, &length);
+        written += status == CODEC_OK ? length : 0;
+    }
+    record_reader_delete(r);
+    if (status == CODEC_OK) {
+        *decompressed_sizep = written;
+    }
+    return status;
+}
+
+codec_status decompressed_length(const uint8_t *src, size_t size, uint64_t *lengthp) {
+    if (has_records(src, size)) {
+        return records_length(src, size, lengthp);
+    }
+    file_header header;
+    size_t offset;
+    codec_status status = find_first_block(src, size, &header, NULL, &offset);
+    if (status != CODEC_OK) {
+        return status;
+    }
+    size_t header_size = block_header_size(header.num_streams);
+    uint64_t length = 0;
+    while (true) {
+        if (size - offset < END_OF_BLOCKS_SIZE) {
+            return CODEC_TRUNCATED;
+        }
+        if (get_ulong(src + offset) == 0) {
+            *lengthp = length;
+            return CODEC_OK;
+        }
+        if (size - offset < header_size) {
+            return CODEC_TRUNCATED;
+        }
+        size_t decoded_length, block_size;
+        if (!parse_block_header(src + offset, header.num_streams, header.flags, &decoded_length, &block_size)) {
+            return CODEC_CORRUPT;
+        }
+        if (size - offset < block_size) {
+            return CODEC_TRUNCATED;
+        }
+        length += decoded_length;
+        offset += block_size;
+    }
+}
+
+codec_status decompress_buffer(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity,
+                               size_t *decompressed_sizep) {
+    return decompress_buffer_with_table(src, size, dest, capacity, decompressed_sizep, NULL);
+}
+
+codec_status decompress_buffer_with_table(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity,
+                                          size_t *decompressed_sizep, const codec_table *table) {
+    if (has_records(src, size)) {
+        return decompress_records(src, size, dest, capacity, decompressed_sizep, table);
+    }
+    uint8_t lengths[num_symbols];
+    decoding_code code = {
+        .current = { .lengths = lengths, .has_code = false },
+        .table_built = false,
+        .num_group_tables = 0,
+        .has_ans = false,
+        .wide = NULL,
+        .shared = table,
+        .use_shared = false
+    };
+    file_header header;
+    size_t offset;
+    codec_status status = find_first_block(src, size, &header, &code, &offset);
+    if (status != CODEC_OK) {
+        return status;
+    }
+    code.entries = malloc(decode_table_max_entries() * sizeof(decode_entry));
+    if (code.entries == NULL) {
+        delete_file_code(&code);
+        return CODEC_OUT_OF_MEMORY;
+    }
+
+    size_t header_size = block_header_size(header.num_streams);
+    size_t written = 0;
+    while (status == CODEC_OK) {
+        if (size - offset < END_OF_BLOCKS_SIZE) {
+            status = CODEC_TRUNCATED;
+            break;
+        }
+        if (get_ulong(src + offset) == 0) {
+            *decompressed_sizep = written;
+            break;
+        }
+        size_t decoded_length, block_size;
+        if (size - offset < header_size) {
+            status = CODEC_TRUNCATED;
+        }else if (!parse_block_header(src + offset, header.num_streams, header.flags, &decoded_length, &block_size)) {
+            status = CODEC_CORRUPT;
+        }else if (size - offset < block_size) {
+            status = CODEC_TRUNCATED;
+        }else if (capacity - written < decoded_length) {
+            status = CODEC_OUTPUT_TOO_SMALL;
+        }else if ((status = prepare_block_code(&code, src + offset, header.num_streams)) == CODEC_OK) {
+            status = decode_and_check(&code, &header, src + offset, dest + written);
+            written += decoded_length;
+            offset += block_size;
+        }
+    }
+    free(code.entries);
+    delete_file_code(&code);
+    return status;
+}
+
+codec_status decompress_range(const uint8_t *src, size_t size, uint64_t offset, size_t length,
+                              uint8_t *dest, size_t capacity, size_t *decompressed_sizep, const codec_table *table) {
+    if (capacity < length) {
+        return CODEC_OUTPUT_TOO_SMALL;
+    }
+    uint8_t lengths[num_symbols];
+    decoding_code code = {
+        .current = { .lengths = lengths, .has_code = false },
+        .table_built = false,
+        .num_group_tables = 0,
+        .has_ans = false,
+        .wide = NULL,
+        .shared = table,
+        .use_shared = false
+    };
+    file_header header;
+    size_t offset_in_src;
+    codec_status status = find_first_block(src, size, &header, &code, &offset_in_src);
+    if (status != CODEC_OK) {
+        return status;
+    }
+    uint64_t num_indexed = 0;
+    const uint8_t *index = header.flags & FLAG_BLOCK_INDEX ? locate_block_index(src, size, &num_indexed) : NULL;
+    code.entries = malloc(decode_table_max_entries() * sizeof(decode_entry));
+    if (code.entries == NULL) {
+        delete_file_code(&code);
+        return CODEC_OUT_OF_MEMORY;
+    }
+    if ((header.flags & FLAG_BLOCK_INDEX) && index == NULL) {
+        status = CODEC_CORRUPT;
+    }
+
+    size_t header_size = block_header_size(header.num_streams);
+    uint64_t end = length <= UINT64_MAX - offset ? offset + length : UINT64_MAX;
+    // where the block starts in the decompressed data, and how much of the range is written
+    uint64_t position = 0;
+    size_t written = 0;
+    // a block only part of which is in the range
+    uint8_t *partial = NULL;
+    size_t partial_capacity = 0;
+    for (uint64_t i = 0; status == CODEC_OK && position < end; i++) {
+        block_index_entry entry;
+        if (index != NULL) {
+            if (i == num_indexed) {
+                break;
+            }
+            get_block_index_entry(index, i, &entry);
+            // (blocks before the range can be skipped unread, unless they might bring codes)
+            if (entry.length <= offset - position && position < offset && !(header.flags & FLAG_BLOCK_TABLES)) {
+                position += entry.length;
+                continue;
+            }
+            if (entry.offset > size) {
+                status = CODEC_CORRUPT;
+                break;
+            }
+            offset_in_src = entry.offset;
+        }
+        if (size - offset_in_src < END_OF_BLOCKS_SIZE) {
+            status = CODEC_TRUNCATED;
+            break;
+        }
+        if (index == NULL && get_ulong(src + offset_in_src) == 0) {
+            break;
+        }
+        size_t decoded_length, block_size;
+        if (size - offset_in_src < header_size) {
+            status = CODEC_TRUNCATED;
+        }else if (!parse_block_header(src + offset_in_src, header.num_streams, header.flags, &decoded_length, &block_size)
+                  || (index != NULL && decoded_length != entry.length)) {
+            status = CODEC_CORRUPT;
+        }else if (size - offset_in_src < block_size) {
+            status = CODEC_TRUNCATED;
+        }else if (decoded_length <= offset - position && position < offset) {
+            // before the range: only its code matters
+            bool changed;
+            if (!update_current_code(src + offset_in_src, header.num_streams, &code.current, &changed)) {
+                status = CODEC_CORRUPT;
+            }
+            code.table_built = code.table_built && !changed;
+        }else if ((status = prepare_block_code(&code, src + offset_in_src, header.num_streams)) == CODEC_OK) {
+            // decode straight into place if the whole block is wanted, or else only as much as the part
+            // that is needs, and copy that
+            bool whole = position >= offset && decoded_length <= end - position;
+            size_t from = position < offset ? offset - position : 0;
+            size_t to = decoded_length < end - position ? decoded_length : end - position;
+            if (!whole && partial_capacity < decoded_length) {
+                free(partial);
+                partial = malloc(decoded_length);
+                partial_capacity = partial != NULL ? decoded_length : 0;
+            }
+            // (a part of a block can't be checked against the block's checksum)
+            if (!whole && partial == NULL) {
+                status = CODEC_OUT_OF_MEMORY;
+            }else if (whole) {
+                status = decode_and_check(&code, &header, src + offset_in_src, dest + written);
+                written += decoded_length;
+            }else if (!decode_part_with_code(&code, src + offset_in_src, header.num_streams, from, to, partial)) {
+                status = CODEC_CORRUPT;
+            }else {
+                memcpy(dest + written, partial + from, to - from);
+                written += to - from;
+            }
+        }
+        position += decoded_length;
+        offset_in_src += block_size;
+    }
+    if (status == CODEC_OK) {
+        *decompressed_sizep = written;
+    }
+    free(partial);
+    free(code.entries);
+    delete_file_code(&code);
+    return status;
+}
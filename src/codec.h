@@ -0,0 +1,173 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// compressing and decompressing in memory, for use from other programs.
+// the compressed format is the huffman program's: its output can be decompressed
+// here, and what's compressed here can be decompressed by it.
+// encoders and decoders only allocate when they're made, never while they work, except that a decoder
+// reading a file of wide symbols or with an order-1 code (which only the huffman program's -w and -o write)
+// allocates that file's decode tables once, as it reads the file's code at the start (a wide code's can
+// take up to 64MB, so there's no room kept for them), and frees them at decoder_reset or decoder_delete.
+// (tANS files need nothing more.) each one can be used on a different thread
+
+typedef enum {
+    CODEC_OK = 0,
+    // the output is full, but there's more to come: call again with more space
+    CODEC_MORE_OUTPUT,
+    // the compressed data ended too soon
+    CODEC_TRUNCATED,
+    // the compressed data is malformed, or from another version
+    CODEC_CORRUPT,
+    // a block decodes to more than the decoder's max block size
+    CODEC_BLOCK_TOO_BIG,
+    // the output buffer is too small for the whole result
+    CODEC_OUTPUT_TOO_SMALL,
+    // too many different bytes for codes of at most the max code length
+    CODEC_CODES_TOO_LONG,
+    CODEC_BAD_OPTIONS,
+    CODEC_OUT_OF_MEMORY,
+    // the compressed data was coded with a shared table, which the decoder wasn't given
+    CODEC_WRONG_TABLE,
+    // there's no record with that number
+    CODEC_NO_SUCH_RECORD,
+    // a block decoded to other content than was compressed (with checksums, which it doesn't match)
+    CODEC_BAD_CHECKSUM
+} codec_status;
+
+const char *codec_status_message(codec_status);
+
+// input, of which the first `pos` bytes have been consumed
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} codec_input;
+
+// space for output, of which the first `pos` bytes have been written
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+} codec_output;
+
+// a code trained on samples of what's to be compressed (by the huffman program's --train),
+// shared by the encoder and decoder: compressed data only refers to it, by its ID,
+// so small inputs needn't carry a code bigger than themselves, nor spend time building one
+typedef struct codec_table codec_table;
+
+// load a table from the content of a table file.
+// returns NULL (and why in `*statusp`) if it's malformed, or there's no memory
+codec_table *codec_table_new(const uint8_t *data, size_t size, codec_status *statusp);
+void codec_table_delete(codec_table *);
+// the ID compressed data refers to the table by
+uint32_t codec_table_id(const codec_table *);
+
+typedef struct {
+    // bytes of input per block, each of which gets its own code (at least 1)
+    size_t block_size;
+    // number of interleaved streams each block is split into (1 to 16)
+    int num_streams;
+    // limit codes to at most this many bits (1 to 32), or 0 for no limit
+    int max_code_length;
+    // code every block with this table (which must outlive the encoder), rather than
+    // each choosing its own code (then max_code_length doesn't matter), or NULL
+    const codec_table *table;
+    // give each block a checksum of its content, which decoding checks it against
+    bool checksums;
+} encoder_options;
+
+// what the huffman program uses when streaming
+extern const encoder_options default_encoder_options;
+
+typedef struct encoder encoder;
+
+// returns NULL (and why in `*statusp`) if the options are out of range, or there's no memory
+encoder *encoder_new(const encoder_options *, codec_status *statusp);
+void encoder_delete(encoder *);
+// forget any input so far, to start compressing something else
+void encoder_reset(encoder *);
+// compress as much input as there is, writing what output fits.
+// returns CODEC_OK when all the input is consumed,
+// CODEC_MORE_OUTPUT if the output filled up first, or an error
+codec_status encoder_update(encoder *, codec_input *in, codec_output *out);
+// after all the input, write the rest of the output.
+// returns CODEC_OK once it's all written, CODEC_MORE_OUTPUT if there's more, or an error
+codec_status encoder_finish(encoder *, codec_output *out);
+
+typedef struct decoder decoder;
+
+// a decoder for blocks of up to `max_block_size` bytes decoded
+// (at least the block size they were compressed with).
+// returns NULL (and why in `*statusp`) if there's no memory
+decoder *decoder_new(size_t max_block_size, codec_status *statusp);
+void decoder_delete(decoder *);
+// forget any input so far, to start decompressing something else
+void decoder_reset(decoder *);
+// decode data compressed with this shared table (which must outlive its use) from now on,
+// or with NULL, with none. data compressed with another is CODEC_WRONG_TABLE
+void decoder_set_table(decoder *, const codec_table *);
+// decompress as much input as there is, writing what output fits.
+// (compressed records can't be decoded as they arrive: they're CODEC_CORRUPT here.)
+// anything after the end of the compressed blocks (such as their index) is skipped.
+// returns CODEC_OK when all the input is consumed,
+// CODEC_MORE_OUTPUT if the output filled up first, or an error
+codec_status decoder_update(decoder *, codec_input *in, codec_output *out);
+// after all the input, write the rest of the output.
+// returns CODEC_OK once it's all written, CODEC_MORE_OUTPUT if there's more,
+// CODEC_TRUNCATED if the input ended before the compressed data did, or an error
+codec_status decoder_finish(decoder *, codec_output *out);
+
+// the most bytes compress_buffer can write for `length` bytes of input
+size_t compress_bound(size_t length, const encoder_options *);
+// compress all of `src` into `dest` (which should have space for compress_bound bytes)
+codec_status compress_buffer(const uint8_t *src, size_t length, uint8_t *dest, size_t capacity,
+                             size_t *compressed_sizep, const encoder_options *);
+// the length compressed data (blocks or records) decompresses to, from its block headers or record index
+codec_status decompressed_length(const uint8_t *src, size_t size, uint64_t *lengthp);
+// decompress all of `src` into `dest` (or for records, all of them, one after another).
+// (unlike a decoder, this allocates its decode table for each call)
+codec_status decompress_buffer(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity,
+                               size_t *decompressed_sizep);
+// the same, for data which may have been compressed with a shared table (NULL for none)
+codec_status decompress_buffer_with_table(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity,
+                                          size_t *decompressed_sizep, const codec_table *);
+// decompress only the `length` bytes from `offset` in what `src` decompresses to (fewer if it ends first)
+// into `dest`, which must have space for `length`, with the shared table if any (NULL for none).
+// only the blocks they're in are decoded (and of a block they're only partly in, only the streams
+// they're in, as far as they need): with an index, the blocks before them are skipped unread,
+// and without one, only their headers are read. (codes that blocks bring, as when streaming,
+// are followed from the first block, reading only the blocks' tables.) not for records.
+// (only blocks which are decoded whole are checked against their checksums)
+codec_status decompress_range(const uint8_t *src, size_t size, uint64_t offset, size_t length,
+                              uint8_t *dest, size_t capacity, size_t *decompressed_sizep, const codec_table *);
+
+// many small records (such as lines, or messages) compressed together, with one code for them all
+// (or a shared table's): each record is coded on its own, and listed in an index,
+// so any one can be decoded without reading the others
+
+// the most bytes compress_records can write for `num_records` records of `total_length` bytes in all
+size_t compress_records_bound(size_t num_records, size_t total_length, const encoder_options *);
+// compress `num_records` records, the i'th `lengths[i]` bytes at `records[i]`, into `dest`
+// (which must have space for compress_records_bound bytes).
+// of the options, only max_code_length and table matter (records have no checksums)
+codec_status compress_records(const uint8_t *const *records, const size_t *lengths, size_t num_records,
+                              uint8_t *dest, size_t capacity, size_t *compressed_sizep, const encoder_options *);
+
+typedef struct record_reader record_reader;
+
+// read the records compressed in `src` (which must outlive the reader), decoding them
+// with the shared table they were compressed with, if any (or NULL for none).
+// returns NULL (and why in `*statusp`) if the data isn't records, is malformed, or there's no memory
+record_reader *record_reader_new(const uint8_t *src, size_t size, const codec_table *, codec_status *statusp);
+void record_reader_delete(record_reader *);
+uint64_t record_count(const record_reader *);
+// the decoded length of record `i` (or CODEC_CORRUPT if its encoding is too short for it)
+codec_status record_length(const record_reader *, uint64_t i, uint64_t *lengthp);
+// decode record `i` (and only it) into `dest`
+codec_status read_record(const record_reader *, uint64_t i, uint8_t *dest, size_t capacity, size_t *lengthp);
+
+#endif // CODEC_H
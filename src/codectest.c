@@ -0,0 +1,690 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "ans.h"
+#include "assert.h"
+#include "block.h"
+#include "codec.h"
+#include "context.h"
+#include "format.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "writeutils.h"
+
+static const encoder_options small_blocks = {
+    .block_size = 1000,
+    .num_streams = 3,
+    .max_code_length = 0
+};
+
+// text whose mix of bytes changes along the way, so blocks get different codes
+static uint8_t *make_content(size_t length) {
+    uint8_t *content = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        content[i] = i < length / 2 ? "the quick brown fox "[i % 20] : 'a' + (i * i) % 7;
+    }
+    return content;
+}
+
+static size_t space(size_t remaining, size_t chunk) {
+    return remaining < chunk ? remaining : chunk;
+}
+
+// feed the encoder `chunk` bytes of input at a time, with `chunk` bytes of space for output
+static size_t encode_in_chunks(encoder *e, const uint8_t *src, size_t length, uint8_t *dest, size_t capacity, size_t chunk) {
+    size_t size = 0;
+    for (size_t start = 0; start < length; start += chunk) {
+        codec_input in = { .data = src + start, .size = length - start < chunk ? length - start : chunk, .pos = 0 };
+        codec_status status;
+        do {
+            codec_output out = { .data = dest + size, .size = space(capacity - size, chunk), .pos = 0 };
+            status = encoder_update(e, &in, &out);
+            size += out.pos;
+        } while (status == CODEC_MORE_OUTPUT);
+        assert(status == CODEC_OK && in.pos == in.size, "encoder update should consume all its input");
+    }
+    codec_status status;
+    do {
+        codec_output out = { .data = dest + size, .size = space(capacity - size, chunk), .pos = 0 };
+        status = encoder_finish(e, &out);
+        size += out.pos;
+    } while (status == CODEC_MORE_OUTPUT);
+    assert(status == CODEC_OK, "encoder finish should succeed");
+    return size;
+}
+
+// feed the decoder `chunk` bytes of input at a time, with `chunk` bytes of space for output.
+// returns the status of finishing
+static codec_status decode_in_chunks(decoder *d, const uint8_t *src, size_t size, uint8_t *dest, size_t capacity, size_t chunk,
+                                     size_t *lengthp) {
+    size_t length = 0;
+    for (size_t start = 0; start < size; start += chunk) {
+        codec_input in = { .data = src + start, .size = size - start < chunk ? size - start : chunk, .pos = 0 };
+        codec_status status;
+        do {
+            codec_output out = { .data = dest + length, .size = space(capacity - length, chunk), .pos = 0 };
+            status = decoder_update(d, &in, &out);
+            length += out.pos;
+        } while (status == CODEC_MORE_OUTPUT);
+        if (status != CODEC_OK) {
+            return status;
+        }
+        assert(in.pos == in.size, "decoder update should consume all its input");
+    }
+    codec_status status;
+    do {
+        codec_output out = { .data = dest + length, .size = space(capacity - length, chunk), .pos = 0 };
+        status = decoder_finish(d, &out);
+        length += out.pos;
+    } while (status == CODEC_MORE_OUTPUT);
+    *lengthp = length;
+    return status;
+}
+
+static void *round_trip_on_thread(void *arg) {
+    size_t length = 50000 + (size_t)arg * 1234;
+    uint8_t *content = make_content(length);
+    size_t bound = compress_bound(length, &default_encoder_options);
+    uint8_t *compressed = malloc(bound);
+    uint8_t *decompressed = malloc(length);
+    size_t size, decompressed_size;
+    bool ok = compress_buffer(content, length, compressed, bound, &size, &default_encoder_options) == CODEC_OK &&
+              decompress_buffer(compressed, size, decompressed, length, &decompressed_size) == CODEC_OK &&
+              decompressed_size == length && memcmp(decompressed, content, length) == 0;
+    free(content);
+    free(compressed);
+    free(decompressed);
+    return ok ? arg : NULL;
+}
+
+int main() {
+    size_t length = 20000;
+    uint8_t *content = make_content(length);
+    size_t bound = compress_bound(length, &small_blocks);
+    uint8_t *compressed = malloc(bound);
+    uint8_t *decompressed = malloc(length);
+    size_t size, decompressed_size;
+    uint64_t total_length;
+
+    // in one go
+    assert(compress_buffer(content, length, compressed, bound, &size, &small_blocks) == CODEC_OK,
+        "compress buffer should succeed");
+    assert(size <= bound && size < length, "compressed size should be within the bound, and smaller");
+    assert(decompressed_length(compressed, size, &total_length) == CODEC_OK && total_length == length,
+        "decompressed length should be the original length");
+    assert(decompress_buffer(compressed, size, decompressed, length, &decompressed_size) == CODEC_OK,
+        "decompress buffer should succeed");
+    assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+        "decompressed content should match the original");
+
+    uint8_t empty[16];
+    size_t empty_size;
+    assert(compress_buffer(content, 0, empty, sizeof(empty), &empty_size, &small_blocks) == CODEC_OK,
+        "compressing nothing should succeed");
+    assert(decompress_buffer(empty, empty_size, decompressed, 0, &decompressed_size) == CODEC_OK && decompressed_size == 0,
+        "decompressing nothing should give nothing");
+
+    // in chunks, which should give the same compressed data
+    codec_status status;
+    encoder *e = encoder_new(&small_blocks, &status);
+    assert(e != NULL && status == CODEC_OK, "encoder new should succeed");
+    uint8_t *streamed = malloc(bound);
+    size_t chunks[] = { 1, 7, 1000, 100000 };
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        encoder_reset(e);
+        size_t streamed_size = encode_in_chunks(e, content, length, streamed, bound, chunks[c]);
+        assert(streamed_size == size && memcmp(streamed, compressed, size) == 0,
+            "encoding in chunks should match compressing in one go");
+    }
+    encoder_delete(e);
+    free(streamed);
+
+    decoder *d = decoder_new(small_blocks.block_size, &status);
+    assert(d != NULL && status == CODEC_OK, "decoder new should succeed");
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        decoder_reset(d);
+        memset(decompressed, 0, length);
+        assert(decode_in_chunks(d, compressed, size, decompressed, length, chunks[c], &decompressed_size) == CODEC_OK,
+            "decoding in chunks should succeed");
+        assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+            "decoding in chunks should give the original content");
+    }
+
+    // the format with one code for the whole file, and an index after the blocks
+    uint8_t lengths[num_symbols];
+    memset(lengths, 0, num_symbols);
+    lengths['a'] = 1;
+    lengths['b'] = 2;
+    lengths['c'] = 2;
+    code_entry codes[num_symbols];
+    assert(get_code_table(lengths, codes), "get code table should succeed");
+    const uint8_t abc[] = "abacabcaabbcca";
+    size_t abc_length = sizeof(abc) - 1;
+    uint8_t file[1000];
+    file_header header = { .flags = FLAG_BLOCK_INDEX, .num_streams = 2 };
+    size_t file_size = put_file_header(&header, file);
+    file_size += pack_code_lengths(lengths, file + file_size);
+    size_t abc_first_block = file_size;
+    for (int k = 0; k < 2; k++) {
+        file_size += encode_block(abc, abc_length, codes, 2, NULL, 0, file + file_size);
+    }
+    put_ulong(0, file + file_size);
+    file_size += END_OF_BLOCKS_SIZE;
+    memset(file + file_size, 0xff, 20);
+    file_size += 20;
+    uint8_t abc_out[2 * sizeof(abc)];
+    assert(decompress_buffer(file, file_size, abc_out, sizeof(abc_out), &decompressed_size) == CODEC_OK,
+        "decompress buffer should read a file with one code");
+    assert(decompressed_size == 2 * abc_length && memcmp(abc_out, abc, abc_length) == 0 &&
+        memcmp(abc_out + abc_length, abc, abc_length) == 0, "a file with one code should decompress to its content");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, file, file_size, abc_out, sizeof(abc_out), 1, &decompressed_size) == CODEC_OK,
+        "decoder should read a file with one code, skipping its index");
+    assert(decompressed_size == 2 * abc_length && memcmp(abc_out + abc_length, abc, abc_length) == 0,
+        "decoder should give a file with one code's content");
+    // a corrupt length, more than the block's streams have a bit for
+    put_ulong(1000, file + abc_first_block);
+    assert(decompress_buffer(file, file_size, abc_out, sizeof(abc_out), &decompressed_size) == CODEC_CORRUPT,
+        "decompress buffer should refuse a block longer than its streams could code");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, file, file_size, abc_out, sizeof(abc_out), 1, &decompressed_size) == CODEC_CORRUPT,
+        "decoder should refuse a block longer than its streams could code");
+    put_ulong(abc_length, file + abc_first_block);
+
+    // ranges, decoding only the blocks they're in: following the codes blocks bring from the start,
+    // and in a file with one code, skipping to them with its index
+    long content_frequencies[num_symbols];
+    memset(content_frequencies, 0, sizeof(content_frequencies));
+    histogram(content, length, content_frequencies);
+    uint8_t content_lengths[num_symbols];
+    code_entry content_codes[num_symbols];
+    assert(build_code_lengths(content_frequencies, 0, content_lengths) && get_code_table(content_lengths, content_codes),
+        "build code lengths should succeed");
+    size_t num_blocks = (length + small_blocks.block_size - 1) / small_blocks.block_size;
+    uint8_t *indexed = malloc(file_header_size + num_symbols + num_blocks * block_bound(small_blocks.block_size,
+        small_blocks.num_streams, content_codes) + END_OF_BLOCKS_SIZE + block_index_size(num_blocks));
+    header = (file_header) { .flags = FLAG_BLOCK_INDEX, .num_streams = small_blocks.num_streams };
+    size_t indexed_size = put_file_header(&header, indexed);
+    indexed_size += pack_code_lengths(content_lengths, indexed + indexed_size);
+    block_index_entry *blocks = malloc(sizeof(block_index_entry) * num_blocks);
+    for (size_t k = 0; k < num_blocks; k++) {
+        size_t block_length = length - k * small_blocks.block_size < small_blocks.block_size
+                            ? length - k * small_blocks.block_size : small_blocks.block_size;
+        blocks[k] = (block_index_entry) { .offset = indexed_size, .length = block_length };
+        indexed_size += encode_block(content + k * small_blocks.block_size, block_length, content_codes,
+                                     small_blocks.num_streams, NULL, 0, indexed + indexed_size);
+    }
+    put_ulong(0, indexed + indexed_size);
+    indexed_size += END_OF_BLOCKS_SIZE;
+    FILE *f = tmpfile();
+    assert(write_block_index(blocks, num_blocks, indexed_size, f), "write block index should succeed");
+    rewind(f);
+    indexed_size += fread(indexed + indexed_size, 1, block_index_size(num_blocks), f);
+    fclose(f);
+    free(blocks);
+    const uint8_t *range_files[] = { compressed, indexed };
+    size_t range_sizes[] = { size, indexed_size };
+    uint64_t ranges[][2] = { { 0, 0 }, { 0, 10 }, { 999, 2 }, { 1000, 1000 }, { 2500, 7777 }, { 19990, 100 }, { 30000, 5 } };
+    for (size_t r = 0; r < 2; r++) {
+        for (size_t k = 0; k < sizeof(ranges) / sizeof(ranges[0]); k++) {
+            uint64_t from = ranges[k][0];
+            size_t expected = from >= length ? 0 : ranges[k][1] < length - from ? ranges[k][1] : length - from;
+            memset(decompressed, 0, length);
+            assert(decompress_range(range_files[r], range_sizes[r], from, ranges[k][1], decompressed, length,
+                &decompressed_size, NULL) == CODEC_OK, "decompress range should succeed");
+            assert(decompressed_size == expected && memcmp(decompressed, content + from, expected) == 0,
+                "a range should decompress to that part of the content");
+        }
+    }
+    assert(decompress_range(indexed, indexed_size, 0, length, decompressed, length - 1, &decompressed_size, NULL)
+        == CODEC_OUTPUT_TOO_SMALL, "decompress range should refuse too little space");
+    assert(decompress_range(indexed, indexed_size - 1, 0, 10, decompressed, length, &decompressed_size, NULL)
+        == CODEC_CORRUPT, "decompress range should refuse a malformed index");
+    free(indexed);
+
+    // a file with an order-1 code, as the huffman program writes it
+    long *pairs = calloc(NUM_CONTEXTS * num_symbols, sizeof(long));
+    for (size_t start = 0; start < length; start += small_blocks.block_size) {
+        count_context_pairs(content + start, small_blocks.block_size, 3, pairs);
+    }
+    context_code context;
+    assert(build_context_code(pairs, 0, &context) && context.num_groups > 1, "build context code should find groups");
+    code_entry group_codes[MAX_CONTEXT_GROUPS * num_symbols];
+    const code_entry *context_codes[NUM_CONTEXTS];
+    assert(get_context_code_tables(&context, group_codes, context_codes), "get context code tables should succeed");
+    uint8_t *context_file = malloc(bound + MAX_PACKED_CONTEXT_CODE);
+    header = (file_header) { .flags = FLAG_CONTEXT_CODE, .num_streams = 3 };
+    size_t context_file_size = put_file_header(&header, context_file);
+    context_file_size += pack_context_code(&context, context_file + context_file_size);
+    for (size_t start = 0; start < length; start += small_blocks.block_size) {
+        context_file_size += encode_context_block(content + start, small_blocks.block_size, context_codes, 3,
+                                                  context_file + context_file_size);
+    }
+    put_ulong(0, context_file + context_file_size);
+    context_file_size += END_OF_BLOCKS_SIZE;
+    assert(context_file_size < size, "an order-1 code should compress better");
+    memset(decompressed, 0, length);
+    assert(decompress_buffer(context_file, context_file_size, decompressed, length, &decompressed_size) == CODEC_OK,
+        "decompress buffer should read a file with an order-1 code");
+    assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+        "a file with an order-1 code should decompress to its content");
+    for (size_t c = 0; c < 2; c++) {
+        decoder_reset(d);
+        memset(decompressed, 0, length);
+        assert(decode_in_chunks(d, context_file, context_file_size, decompressed, length, chunks[c], &decompressed_size) == CODEC_OK,
+            "decoder should read a file with an order-1 code");
+        assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+            "decoder should give a file with an order-1 code's content");
+    }
+    context_file[file_header_size] = MAX_CONTEXT_GROUPS + 1;
+    assert(decompress_buffer(context_file, context_file_size, decompressed, length, &decompressed_size) == CODEC_CORRUPT,
+        "decompress buffer should refuse a malformed order-1 code");
+    free(pairs);
+    free(context_file);
+
+    // a file coded with tANS
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    histogram(content, length, symbol_frequencies);
+    uint16_t ans_counts[num_symbols];
+    normalize_frequencies(symbol_frequencies, ans_counts);
+    ans_encode_table *ans_table = malloc(sizeof(ans_encode_table));
+    assert(ans_encode_table_init(ans_counts, ans_table), "ans encode table init should succeed");
+    uint8_t *ans_file = malloc(file_header_size + MAX_PACKED_ANS_COUNTS + END_OF_BLOCKS_SIZE
+                               + length / small_blocks.block_size * ans_block_bound(small_blocks.block_size, 4));
+    header = (file_header) { .flags = FLAG_ANS_CODE, .num_streams = 4 };
+    size_t ans_file_size = put_file_header(&header, ans_file);
+    ans_file_size += pack_ans_counts(ans_counts, ans_file + ans_file_size);
+    for (size_t start = 0; start < length; start += small_blocks.block_size) {
+        ans_file_size += encode_ans_block(content + start, small_blocks.block_size, ans_table, 4, ans_file + ans_file_size);
+    }
+    put_ulong(0, ans_file + ans_file_size);
+    ans_file_size += END_OF_BLOCKS_SIZE;
+    memset(decompressed, 0, length);
+    assert(decompress_buffer(ans_file, ans_file_size, decompressed, length, &decompressed_size) == CODEC_OK,
+        "decompress buffer should read a file coded with tANS");
+    assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+        "a file coded with tANS should decompress to its content");
+    for (size_t c = 0; c < 2; c++) {
+        decoder_reset(d);
+        memset(decompressed, 0, length);
+        assert(decode_in_chunks(d, ans_file, ans_file_size, decompressed, length, chunks[c], &decompressed_size) == CODEC_OK,
+            "decoder should read a file coded with tANS");
+        assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+            "decoder should give a file coded with tANS's content");
+    }
+    // (the same decoder, for a file with codes of its own, and then tANS again)
+    decoder_reset(d);
+    assert(decode_in_chunks(d, compressed, size, decompressed, length, 1000, &decompressed_size) == CODEC_OK
+        && memcmp(decompressed, content, length) == 0, "a decoder after tANS should read a file with its own codes");
+    decoder_reset(d);
+    memset(decompressed, 0, length);
+    assert(decode_in_chunks(d, ans_file, ans_file_size, decompressed, length, 1000, &decompressed_size) == CODEC_OK
+        && memcmp(decompressed, content, length) == 0, "a decoder should read tANS again after other files");
+    // (the first block's first stream, one byte shorter)
+    size_t first_block = file_header_size + packed_ans_counts_size(ans_file + file_header_size, MAX_PACKED_ANS_COUNTS);
+    put_ulong(get_ulong(ans_file + first_block + 2 * sizeof(uint64_t)) - 1, ans_file + first_block + 2 * sizeof(uint64_t));
+    assert(decompress_buffer(ans_file, ans_file_size, decompressed, length, &decompressed_size) == CODEC_CORRUPT,
+        "decompress buffer should refuse a malformed tANS stream");
+    free(ans_table);
+    free(ans_file);
+
+    // a file of wide symbols, of an odd length so the last block ends in a lone byte
+    size_t wide_length = length - 1;
+    long *wide_frequencies = calloc(NUM_WIDE_SYMBOLS, sizeof(long));
+    wide_histogram(content, wide_length, wide_frequencies);
+    uint8_t *wide_lengths = malloc(NUM_WIDE_SYMBOLS);
+    code_entry *wide_codes = malloc(sizeof(code_entry) * NUM_WIDE_SYMBOLS);
+    assert(build_wide_code_lengths(wide_frequencies, 0, wide_lengths) && get_wide_code_table(wide_lengths, wide_codes),
+        "wide codes should build");
+    uint8_t *wide_file = malloc(file_header_size + MAX_PACKED_WIDE_CODE_LENGTHS + END_OF_BLOCKS_SIZE
+                                + (length / small_blocks.block_size + 1) * wide_block_bound(small_blocks.block_size, 3, wide_codes));
+    header = (file_header) { .flags = FLAG_WIDE_SYMBOLS, .num_streams = 3 };
+    size_t wide_file_size = put_file_header(&header, wide_file);
+    wide_file_size += pack_wide_code_lengths(wide_lengths, wide_file + wide_file_size);
+    for (size_t start = 0; start < wide_length; start += small_blocks.block_size) {
+        size_t block_length = wide_length - start < small_blocks.block_size ? wide_length - start : small_blocks.block_size;
+        wide_file_size += encode_wide_block(content + start, block_length, wide_codes, 3, wide_file + wide_file_size);
+    }
+    put_ulong(0, wide_file + wide_file_size);
+    wide_file_size += END_OF_BLOCKS_SIZE;
+    memset(decompressed, 0, length);
+    assert(decompress_buffer(wide_file, wide_file_size, decompressed, length, &decompressed_size) == CODEC_OK,
+        "decompress buffer should read a file of wide symbols");
+    assert(decompressed_size == wide_length && memcmp(decompressed, content, wide_length) == 0,
+        "a file of wide symbols should decompress to its content");
+    for (size_t c = 0; c < 2; c++) {
+        decoder_reset(d);
+        memset(decompressed, 0, length);
+        assert(decode_in_chunks(d, wide_file, wide_file_size, decompressed, length, chunks[c], &decompressed_size) == CODEC_OK,
+            "decoder should read a file of wide symbols");
+        assert(decompressed_size == wide_length && memcmp(decompressed, content, wide_length) == 0,
+            "decoder should give a file of wide symbols' content");
+    }
+    // another file of wide symbols, paired a byte later, so with another code, which the same decoder
+    // should read after the first, and then the first again
+    size_t other_wide_length = length - 2;
+    memset(wide_frequencies, 0, NUM_WIDE_SYMBOLS * sizeof(long));
+    wide_histogram(content + 1, other_wide_length, wide_frequencies);
+    assert(build_wide_code_lengths(wide_frequencies, 0, wide_lengths) && get_wide_code_table(wide_lengths, wide_codes),
+        "wide codes should build");
+    uint8_t *other_wide_file = malloc(file_header_size + MAX_PACKED_WIDE_CODE_LENGTHS + END_OF_BLOCKS_SIZE
+                                      + (length / small_blocks.block_size + 1) * wide_block_bound(small_blocks.block_size, 3, wide_codes));
+    size_t other_wide_file_size = put_file_header(&header, other_wide_file);
+    other_wide_file_size += pack_wide_code_lengths(wide_lengths, other_wide_file + other_wide_file_size);
+    for (size_t start = 0; start < other_wide_length; start += small_blocks.block_size) {
+        size_t block_length = other_wide_length - start < small_blocks.block_size
+                            ? other_wide_length - start : small_blocks.block_size;
+        other_wide_file_size += encode_wide_block(content + 1 + start, block_length, wide_codes, 3,
+                                                  other_wide_file + other_wide_file_size);
+    }
+    put_ulong(0, other_wide_file + other_wide_file_size);
+    other_wide_file_size += END_OF_BLOCKS_SIZE;
+    decoder_reset(d);
+    memset(decompressed, 0, length);
+    assert(decode_in_chunks(d, other_wide_file, other_wide_file_size, decompressed, length, 1000, &decompressed_size)
+        == CODEC_OK && decompressed_size == other_wide_length
+        && memcmp(decompressed, content + 1, other_wide_length) == 0,
+        "a decoder should read a second file of wide symbols, with another code");
+    decoder_reset(d);
+    memset(decompressed, 0, length);
+    assert(decode_in_chunks(d, wide_file, wide_file_size, decompressed, length, 1000, &decompressed_size) == CODEC_OK
+        && decompressed_size == wide_length && memcmp(decompressed, content, wide_length) == 0,
+        "a decoder should read the first file of wide symbols again, with its code");
+    free(other_wide_file);
+    free(wide_frequencies);
+    free(wide_lengths);
+    free(wide_codes);
+    free(wide_file);
+
+    // with a shared table, trained on the content (every byte getting a code)
+    long trained[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        trained[i] = 1;
+    }
+    histogram(content, length, trained);
+    uint8_t trained_lengths[num_symbols];
+    assert(build_code_lengths(trained, 0, trained_lengths), "build code lengths should succeed");
+    uint8_t table_file[MAX_TABLE_FILE_SIZE];
+    size_t table_file_size = pack_table_file(trained_lengths, table_file);
+    codec_table *table = codec_table_new(table_file, table_file_size, &status);
+    assert(table != NULL && status == CODEC_OK, "codec table new should succeed");
+    assert(codec_table_id(table) == table_id(trained_lengths), "the table's ID should be its lengths'");
+    encoder_options with_table = small_blocks;
+    with_table.table = table;
+    size_t table_bound = compress_bound(length, &with_table);
+    uint8_t *shared_file = malloc(table_bound);
+    size_t shared_size;
+    assert(compress_buffer(content, length, shared_file, table_bound, &shared_size, &with_table) == CODEC_OK,
+        "compress buffer should succeed with a table");
+    assert(decompressed_length(shared_file, shared_size, &total_length) == CODEC_OK && total_length == length,
+        "decompressed length should be the original length with a table");
+    assert(decompress_buffer(shared_file, shared_size, decompressed, length, &decompressed_size) == CODEC_WRONG_TABLE,
+        "decompress buffer should need the table");
+    memset(decompressed, 0, length);
+    assert(decompress_buffer_with_table(shared_file, shared_size, decompressed, length, &decompressed_size, table)
+        == CODEC_OK, "decompress buffer should succeed with the table");
+    assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+        "a file with a table should decompress to its content");
+    e = encoder_new(&with_table, &status);
+    streamed = malloc(table_bound);
+    for (size_t c = 0; c < 2; c++) {
+        encoder_reset(e);
+        size_t streamed_size = encode_in_chunks(e, content, length, streamed, table_bound, chunks[c]);
+        assert(streamed_size == shared_size && memcmp(streamed, shared_file, shared_size) == 0,
+            "encoding in chunks with a table should match compressing in one go");
+    }
+    encoder_delete(e);
+    free(streamed);
+    decoder_reset(d);
+    assert(decode_in_chunks(d, shared_file, shared_size, decompressed, length, 100, &decompressed_size)
+        == CODEC_WRONG_TABLE, "decoder should need the table");
+    decoder_set_table(d, table);
+    for (size_t c = 0; c < 2; c++) {
+        decoder_reset(d);
+        memset(decompressed, 0, length);
+        assert(decode_in_chunks(d, shared_file, shared_size, decompressed, length, chunks[c], &decompressed_size)
+            == CODEC_OK, "decoder should read a file with its table");
+        assert(decompressed_size == length && memcmp(decompressed, content, length) == 0,
+            "decoder should give a file with a table's content");
+    }
+    // a small input costs less without a code table of its own
+    uint8_t small[1000];
+    size_t small_size;
+    assert(compress_buffer(content, 200, small, sizeof(small), &small_size, &small_blocks) == CODEC_OK
+        && compress_buffer(content, 200, shared_file, table_bound, &shared_size, &with_table) == CODEC_OK,
+        "compress buffer should succeed");
+    assert(shared_size < small_size, "a small input should be smaller with a table");
+    // another table, trained again on something else
+    trained['q'] += 1000;
+    assert(build_code_lengths(trained, 0, trained_lengths), "build code lengths should succeed");
+    uint8_t other_file[MAX_TABLE_FILE_SIZE];
+    codec_table *other = codec_table_new(other_file, pack_table_file(trained_lengths, other_file), &status);
+    assert(other != NULL && codec_table_id(other) != codec_table_id(table), "another table should have another ID");
+    assert(decompress_buffer_with_table(shared_file, shared_size, decompressed, length, &decompressed_size, other)
+        == CODEC_WRONG_TABLE, "decompress buffer should refuse another table");
+    decoder_set_table(d, other);
+    decoder_reset(d);
+    assert(decode_in_chunks(d, shared_file, shared_size, decompressed, length, 7, &decompressed_size)
+        == CODEC_WRONG_TABLE, "decoder should refuse another table");
+    decoder_set_table(d, NULL);
+    table_file[table_file_size - 1] ^= 1;
+    assert(codec_table_new(table_file, table_file_size, &status) == NULL && status == CODEC_CORRUPT,
+        "codec table new should refuse a malformed table");
+    codec_table_delete(other);
+    free(shared_file);
+
+    // records, of assorted lengths (some empty), with one code for them all
+    size_t num_records = 60;
+    const uint8_t *records[60];
+    size_t record_lengths[60];
+    size_t records_length = 0;
+    for (size_t i = 0; i < num_records; i++) {
+        records[i] = content + records_length;
+        record_lengths[i] = i % 7 == 0 ? 0 : (i * 37) % 500;
+        records_length += record_lengths[i];
+    }
+    size_t records_bound = compress_records_bound(num_records, records_length, &small_blocks);
+    uint8_t *records_file = malloc(records_bound);
+    size_t records_size;
+    assert(compress_records(records, record_lengths, num_records, records_file, records_bound, &records_size,
+        &small_blocks) == CODEC_OK, "compress records should succeed");
+    assert(records_size < records_bound, "compressed records should be within their bound");
+    record_reader *reader = record_reader_new(records_file, records_size, NULL, &status);
+    assert(reader != NULL && status == CODEC_OK, "record reader new should succeed");
+    assert(record_count(reader) == num_records, "the record count should be the number compressed");
+    // in any order
+    for (size_t i = num_records; i-- > 0;) {
+        uint64_t record_length_i;
+        memset(decompressed, 0, length);
+        assert(record_length(reader, i, &record_length_i) == CODEC_OK && record_length_i == record_lengths[i],
+            "a record's length should be its length compressed");
+        assert(read_record(reader, i, decompressed, record_lengths[i], &decompressed_size) == CODEC_OK,
+            "read record should succeed");
+        assert(decompressed_size == record_lengths[i] && memcmp(decompressed, records[i], record_lengths[i]) == 0,
+            "a record should decode to itself");
+    }
+    assert(read_record(reader, num_records, decompressed, length, &decompressed_size) == CODEC_NO_SUCH_RECORD,
+        "read record should refuse a record past the last");
+    assert(read_record(reader, 1, decompressed, record_lengths[1] - 1, &decompressed_size) == CODEC_OUTPUT_TOO_SMALL,
+        "read record should refuse too little space");
+    record_reader_delete(reader);
+    assert(decompressed_length(records_file, records_size, &total_length) == CODEC_OK && total_length == records_length,
+        "the decompressed length of records should be their total length");
+    memset(decompressed, 0, length);
+    assert(decompress_buffer(records_file, records_size, decompressed, length, &decompressed_size) == CODEC_OK,
+        "decompress buffer should succeed on records");
+    assert(decompressed_size == records_length && memcmp(decompressed, content, records_length) == 0,
+        "decompress buffer should give the records one after another");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, records_file, records_size, decompressed, length, 100, &decompressed_size)
+        == CODEC_CORRUPT, "decoder should refuse records");
+    assert(record_reader_new(compressed, size, NULL, &status) == NULL && status == CODEC_CORRUPT,
+        "record reader new should refuse blocks");
+    assert(record_reader_new(records_file, records_size - 1, NULL, &status) == NULL && status == CODEC_TRUNCATED,
+        "record reader new should notice cut short records");
+    assert(compress_records(records, record_lengths, num_records, records_file, records_bound - 1, &records_size,
+        &small_blocks) == CODEC_OUTPUT_TOO_SMALL, "compress records should refuse too little space");
+    encoder_options short_records = small_blocks;
+    short_records.max_code_length = 1;
+    assert(compress_records(records, record_lengths, num_records, records_file, records_bound, &records_size,
+        &short_records) == CODEC_CODES_TOO_LONG, "compress records should refuse codes over the max length");
+    // (record 3 starting after record 4)
+    assert(compress_records(records, record_lengths, num_records, records_file, records_bound, &records_size,
+        &small_blocks) == CODEC_OK, "compress records should succeed");
+    uint8_t *records_start = records_file + file_header_size
+                           + packed_code_lengths_size(records_file + file_header_size, records_size - file_header_size);
+    records_header records_header;
+    assert(get_records_header(records_start, &records_header) && records_header.num_records == num_records
+        && records_header.decoded_size == records_length && records_header.field_size == sizeof(uint32_t),
+        "a small batch of records should have a small index");
+    uint8_t *index = records_start + RECORDS_HEADER_SIZE;
+    int entry_size = 2 * records_header.field_size;
+    record_entry entry;
+    get_record_entry(index + 4 * entry_size, records_header.field_size, &entry);
+    entry.offset++;
+    put_record_entry(&entry, records_header.field_size, index + 3 * entry_size);
+    reader = record_reader_new(records_file, records_size, NULL, &status);
+    assert(reader != NULL, "record reader new should succeed");
+    assert(read_record(reader, 3, decompressed, length, &decompressed_size) == CODEC_CORRUPT,
+        "read record should refuse a record ending before it starts");
+    assert(read_record(reader, 5, decompressed, length, &decompressed_size) == CODEC_OK,
+        "other records should still be read");
+    // (a corrupt length, more than record 5's encoding has a bit for)
+    get_record_entry(index + 5 * entry_size, records_header.field_size, &entry);
+    entry.length = UINT32_MAX;
+    put_record_entry(&entry, records_header.field_size, index + 5 * entry_size);
+    uint64_t corrupt_length;
+    assert(record_length(reader, 5, &corrupt_length) == CODEC_CORRUPT,
+        "record length should refuse a length the record's encoding is too short for");
+    assert(read_record(reader, 5, decompressed, length, &decompressed_size) == CODEC_CORRUPT,
+        "read record should refuse a length the record's encoding is too short for");
+    record_reader_delete(reader);
+    free(records_file);
+
+    // records with a shared table
+    encoder_options records_with_table = small_blocks;
+    records_with_table.table = table;
+    records_bound = compress_records_bound(num_records, records_length, &records_with_table);
+    records_file = malloc(records_bound);
+    assert(compress_records(records, record_lengths, num_records, records_file, records_bound, &records_size,
+        &records_with_table) == CODEC_OK, "compress records should succeed with a table");
+    assert(record_reader_new(records_file, records_size, NULL, &status) == NULL && status == CODEC_WRONG_TABLE,
+        "record reader new should need the table");
+    assert(decompressed_length(records_file, records_size, &total_length) == CODEC_OK && total_length == records_length,
+        "the decompressed length of records shouldn't need the table");
+    reader = record_reader_new(records_file, records_size, table, &status);
+    assert(reader != NULL && status == CODEC_OK, "record reader new should succeed with the table");
+    for (size_t i = 0; i < num_records; i++) {
+        assert(read_record(reader, i, decompressed, length, &decompressed_size) == CODEC_OK
+            && decompressed_size == record_lengths[i] && memcmp(decompressed, records[i], record_lengths[i]) == 0,
+            "a record should decode to itself with the table");
+    }
+    record_reader_delete(reader);
+    free(records_file);
+    codec_table_delete(table);
+
+    // with checksums, which only the block headers' checksums change
+    encoder_options with_checksums = small_blocks;
+    with_checksums.checksums = true;
+    uint8_t *checked = malloc(bound);
+    size_t checked_size;
+    assert(compress_buffer(content, length, checked, bound, &checked_size, &with_checksums) == CODEC_OK
+        && checked_size == size, "compress buffer should succeed with checksums, at the same size");
+    assert(decompress_buffer(checked, checked_size, decompressed, length, &decompressed_size) == CODEC_OK
+        && decompressed_size == length && memcmp(decompressed, content, length) == 0,
+        "a file with checksums should decompress to its content");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, checked, checked_size, decompressed, length, 7, &decompressed_size) == CODEC_OK
+        && memcmp(decompressed, content, length) == 0, "decoder should read a file with checksums");
+    // (the first block's checksum)
+    checked[file_header_size + sizeof(uint64_t)] ^= 1;
+    assert(decompress_buffer(checked, checked_size, decompressed, length, &decompressed_size) == CODEC_BAD_CHECKSUM,
+        "decompress buffer should notice a block which doesn't match its checksum");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, checked, checked_size, decompressed, length, 7, &decompressed_size) == CODEC_BAD_CHECKSUM,
+        "decoder should notice a block which doesn't match its checksum");
+    assert(decompress_range(checked, checked_size, 0, 10, decompressed, length, &decompressed_size, NULL) == CODEC_OK
+        && decompress_range(checked, checked_size, 0, 1000, decompressed, length, &decompressed_size, NULL)
+        == CODEC_BAD_CHECKSUM, "decompress range should check only blocks it decodes whole");
+    checked[file_header_size + sizeof(uint64_t)] ^= 1;
+    // any bit changed in a block either makes it malformed, or changes nothing it decodes to
+    // (as in the padding at the end of a stream), or is caught by the checksum
+    for (size_t i = file_header_size; i < checked_size; i += 13) {
+        checked[i] ^= 1 << i % 8;
+        codec_status checked_status = decompress_buffer(checked, checked_size, decompressed, length, &decompressed_size);
+        assert(checked_status != CODEC_OK || memcmp(decompressed, content, length) == 0,
+            "a changed block shouldn't decompress to other content");
+        checked[i] ^= 1 << i % 8;
+    }
+    free(checked);
+
+    // errors
+    for (size_t cut = 0; cut < size; cut += 97) {
+        assert(decompress_buffer(compressed, cut, decompressed, length, &decompressed_size) == CODEC_TRUNCATED,
+            "decompress buffer should notice cut short data");
+        decoder_reset(d);
+        assert(decode_in_chunks(d, compressed, cut, decompressed, length, 100, &decompressed_size) == CODEC_TRUNCATED,
+            "decoder should notice cut short data");
+    }
+    assert(decompress_buffer(compressed, size, decompressed, length - 1, &decompressed_size) == CODEC_OUTPUT_TOO_SMALL,
+        "decompress buffer should refuse too little space");
+    assert(compress_buffer(content, length, compressed, size / 2, &size, &small_blocks) == CODEC_OUTPUT_TOO_SMALL,
+        "compress buffer should refuse too little space");
+
+    compressed[0] = 'X';
+    assert(decompress_buffer(compressed, size, decompressed, length, &decompressed_size) == CODEC_CORRUPT,
+        "decompress buffer should refuse a bad header");
+    decoder_reset(d);
+    assert(decode_in_chunks(d, compressed, size, decompressed, length, 100, &decompressed_size) == CODEC_CORRUPT,
+        "decoder should refuse a bad header");
+    codec_output nowhere = { .data = decompressed, .size = length, .pos = 0 };
+    assert(decoder_finish(d, &nowhere) == CODEC_CORRUPT, "decoder errors should stick");
+    decoder_delete(d);
+
+    assert(compress_buffer(content, length, compressed, bound, &size, &small_blocks) == CODEC_OK,
+        "compress buffer should succeed");
+    d = decoder_new(small_blocks.block_size - 1, &status);
+    assert(d != NULL, "decoder new should succeed");
+    assert(decode_in_chunks(d, compressed, size, decompressed, length, 100, &decompressed_size) == CODEC_BLOCK_TOO_BIG,
+        "decoder should refuse blocks over its max block size");
+    decoder_delete(d);
+
+    encoder_options short_codes = small_blocks;
+    short_codes.max_code_length = 1;
+    assert(compress_buffer(content, length, compressed, bound, &size, &short_codes) == CODEC_CODES_TOO_LONG,
+        "compress buffer should refuse codes over the max length");
+    e = encoder_new(&short_codes, &status);
+    codec_input in = { .data = content, .size = length, .pos = 0 };
+    codec_output out = { .data = compressed, .size = bound, .pos = 0 };
+    assert(encoder_update(e, &in, &out) == CODEC_CODES_TOO_LONG, "encoder should refuse codes over the max length");
+    assert(encoder_finish(e, &out) == CODEC_CODES_TOO_LONG, "encoder errors should stick");
+    encoder_delete(e);
+
+    encoder_options bad = small_blocks;
+    bad.num_streams = MAX_STREAMS + 1;
+    assert(encoder_new(&bad, &status) == NULL && status == CODEC_BAD_OPTIONS, "encoder new should refuse bad options");
+    assert(compress_buffer(content, length, compressed, bound, &size, &bad) == CODEC_BAD_OPTIONS,
+        "compress buffer should refuse bad options");
+
+    // independent contexts on several threads
+    pthread_t threads[4];
+    for (size_t t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, round_trip_on_thread, (void *)(t + 1));
+    }
+    for (size_t t = 0; t < 4; t++) {
+        void *result;
+        pthread_join(threads[t], &result);
+        assert(result == (void *)(t + 1), "round trips on other threads should succeed");
+    }
+
+    free(content);
+    free(compressed);
+    free(decompressed);
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "format.h"
+#include "huffman.h"
+
+// rounds of moving contexts to the group which codes them best
+static const int max_cluster_iterations = 8;
+
+void count_context_pairs(const symbol *data, size_t length, int num_streams, long *pair_frequencies) {
+    if (length == 0) {
+        return;
+    }
+    size_t segment = (length + num_streams - 1) / num_streams;
+    for (size_t start = 0; start < length; start += segment) {
+        size_t end = length - start < segment ? length : start + segment;
+        symbol previous = 0;
+        for (size_t i = start; i < end; i++) {
+            pair_frequencies[previous * num_symbols + data[i]]++;
+            previous = data[i];
+        }
+    }
+}
+
+uint64_t context_encoded_size_bits(const long *pair_frequencies, const context_code *code) {
+    uint64_t bits = 0;
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        uint64_t context_bits = encoded_size_bits(pair_frequencies + c * num_symbols, code->code_lengths[code->group_of[c]]);
+        if (context_bits == UINT64_MAX) {
+            return UINT64_MAX;
+        }
+        bits += context_bits;
+    }
+    return bits;
+}
+
+// the bits each symbol would take in a group's code, roughly: -log2 of its probability
+// (smoothed, so a symbol new to the group isn't free or infinitely expensive)
+static void estimate_costs(const long *group_frequencies, double *costs) {
+    double total = 0;
+    for (int s = 0; s < num_symbols; s++) {
+        total += group_frequencies[s];
+    }
+    for (int s = 0; s < num_symbols; s++) {
+        costs[s] = -log2((group_frequencies[s] + 0.5) / (total + 0.5 * num_symbols));
+    }
+}
+
+static void sum_groups(const long *pair_frequencies, const uint8_t *group_of, int num_groups, long *group_frequencies) {
+    memset(group_frequencies, 0, sizeof(long) * num_groups * num_symbols);
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        long *group = group_frequencies + group_of[c] * num_symbols;
+        for (int s = 0; s < num_symbols; s++) {
+            group[s] += pair_frequencies[c * num_symbols + s];
+        }
+    }
+}
+
+// put each context in one of `num_groups` groups, starting from the busiest contexts in groups of
+// their own, then moving each context to the group which would code it in the fewest bits
+static void cluster_contexts(const long *pair_frequencies, const long *context_totals, int num_groups, uint8_t *group_of) {
+    long group_frequencies[num_groups * num_symbols];
+    double costs[num_groups * num_symbols];
+
+    // the busiest contexts, by selection
+    bool seeded[NUM_CONTEXTS];
+    memset(seeded, 0, sizeof(seeded));
+    for (int g = 0; g < num_groups; g++) {
+        int busiest = -1;
+        for (int c = 0; c < NUM_CONTEXTS; c++) {
+            if (!seeded[c] && (busiest < 0 || context_totals[c] > context_totals[busiest])) {
+                busiest = c;
+            }
+        }
+        seeded[busiest] = true;
+        memcpy(group_frequencies + g * num_symbols, pair_frequencies + busiest * num_symbols, sizeof(long) * num_symbols);
+    }
+
+    memset(group_of, 0, NUM_CONTEXTS);
+    for (int iteration = 0; iteration < max_cluster_iterations; iteration++) {
+        for (int g = 0; g < num_groups; g++) {
+            estimate_costs(group_frequencies + g * num_symbols, costs + g * num_symbols);
+        }
+        bool changed = false;
+        for (int c = 0; c < NUM_CONTEXTS; c++) {
+            if (context_totals[c] == 0) {
+                continue;
+            }
+            const long *row = pair_frequencies + c * num_symbols;
+            int best_group = 0;
+            double best_cost = INFINITY;
+            for (int g = 0; g < num_groups; g++) {
+                double cost = 0;
+                for (int s = 0; s < num_symbols; s++) {
+                    cost += row[s] * costs[g * num_symbols + s];
+                }
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_group = g;
+                }
+            }
+            changed |= best_group != group_of[c] || iteration == 0;
+            group_of[c] = best_group;
+        }
+        if (!changed) {
+            break;
+        }
+        sum_groups(pair_frequencies, group_of, num_groups, group_frequencies);
+    }
+}
+
+// number the groups which have contexts from 0, dropping the rest. returns how many there are
+static int compact_groups(const long *context_totals, uint8_t *group_of, int num_groups) {
+    int renumbered[num_groups];
+    for (int g = 0; g < num_groups; g++) {
+        renumbered[g] = -1;
+    }
+    int used = 0;
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        if (context_totals[c] > 0 && renumbered[group_of[c]] < 0) {
+            renumbered[group_of[c]] = used++;
+        }
+    }
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        // (contexts which never occur can go anywhere)
+        group_of[c] = context_totals[c] > 0 ? renumbered[group_of[c]] : 0;
+    }
+    return used > 0 ? used : 1;
+}
+
+// the bits a code takes to send and to code the pairs with
+static uint64_t context_code_cost(const long *pair_frequencies, const context_code *code) {
+    uint8_t packed[1 + (MAX_CONTEXT_GROUPS + 1) * NUM_CONTEXTS];
+    uint64_t bits = context_encoded_size_bits(pair_frequencies, code);
+    return bits == UINT64_MAX ? UINT64_MAX : bits + 8 * pack_context_code(code, packed);
+}
+
+bool build_context_code(const long *pair_frequencies, int max_code_length, context_code *code) {
+    long context_totals[NUM_CONTEXTS];
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    int num_contexts = 0;
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        context_totals[c] = 0;
+        for (int s = 0; s < num_symbols; s++) {
+            context_totals[c] += pair_frequencies[c * num_symbols + s];
+            symbol_frequencies[s] += pair_frequencies[c * num_symbols + s];
+        }
+        num_contexts += context_totals[c] > 0;
+    }
+
+    // the same code for every context
+    code->num_groups = 1;
+    memset(code->group_of, 0, NUM_CONTEXTS);
+    if (!build_code_lengths(symbol_frequencies, max_code_length, code->code_lengths[0])) {
+        return false;
+    }
+    uint64_t best_bits = context_code_cost(pair_frequencies, code);
+
+    // then more and more groups, while they pay for themselves
+    context_code *candidate = malloc(sizeof(context_code));
+    long group_frequencies[MAX_CONTEXT_GROUPS * num_symbols];
+    for (int num_groups = 2; num_groups <= MAX_CONTEXT_GROUPS && num_groups <= num_contexts; num_groups *= 2) {
+        cluster_contexts(pair_frequencies, context_totals, num_groups, candidate->group_of);
+        candidate->num_groups = compact_groups(context_totals, candidate->group_of, num_groups);
+        sum_groups(pair_frequencies, candidate->group_of, candidate->num_groups, group_frequencies);
+        bool built = true;
+        for (int g = 0; g < candidate->num_groups && built; g++) {
+            // (a group can't need longer codes than all the symbols together)
+            built = build_code_lengths(group_frequencies + g * num_symbols, max_code_length, candidate->code_lengths[g]);
+        }
+        uint64_t bits = built ? context_code_cost(pair_frequencies, candidate) : UINT64_MAX;
+        if (bits >= best_bits) {
+            break;
+        }
+        best_bits = bits;
+        memcpy(code, candidate, sizeof(context_code));
+    }
+    free(candidate);
+    return true;
+}
+
+bool get_context_code_tables(const context_code *code, code_entry *codes, const code_entry **context_codes) {
+    for (int g = 0; g < code->num_groups; g++) {
+        if (!get_code_table(code->code_lengths[g], codes + g * num_symbols)) {
+            return false;
+        }
+    }
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        context_codes[c] = codes + code->group_of[c] * num_symbols;
+    }
+    return true;
+}
+
+bool get_context_decode_tables(const context_code *code, decode_table **tables, const decode_entry **context_entries) {
+    bool success = true;
+    for (int g = 0; g < code->num_groups; g++) {
+        tables[g] = decode_table_from_code_lengths(code->code_lengths[g]);
+        success &= tables[g] != NULL;
+    }
+    if (!success) {
+        for (int g = 0; g < code->num_groups; g++) {
+            decode_table_delete(tables[g]);
+            tables[g] = NULL;
+        }
+        return false;
+    }
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        context_entries[c] = tables[code->group_of[c]]->entries;
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "huffman.h"
+
+// order-1 codes: each symbol is coded with a code chosen by the symbol before it (its context).
+// contexts whose following symbols are alike are clustered into groups sharing a code,
+// so there are few codes to send, and few tables to keep in cache when decoding.
+// each segment of a block (see block.h) starts as if after a 0
+
+#define NUM_CONTEXTS 256
+#define MAX_CONTEXT_GROUPS 16
+
+typedef struct {
+    int num_groups;
+    // the group of each context
+    uint8_t group_of[NUM_CONTEXTS];
+    // the code lengths of each group's code
+    uint8_t code_lengths[MAX_CONTEXT_GROUPS][NUM_CONTEXTS];
+} context_code;
+
+// add the number of times each symbol follows each context in a block, split into
+// `num_streams` segments as it will be encoded, to `pair_frequencies`
+// (NUM_CONTEXTS rows of num_symbols, indexed by context then symbol)
+void count_context_pairs(const symbol *data, size_t length, int num_streams, long *pair_frequencies);
+
+// choose how to group the contexts, and each group's code, to code the pairs in the fewest bits
+// (counting those of the code itself, packed by pack_context_code).
+// a single group means order-1 coding won't do better than one code for all symbols.
+// returns false if codes can't be limited to `max_code_length` (0 for no limit)
+bool build_context_code(const long *pair_frequencies, int max_code_length, context_code *code);
+
+// the number of bits coding the pairs with this code takes, or UINT64_MAX if a pair has no code
+uint64_t context_encoded_size_bits(const long *pair_frequencies, const context_code *code);
+
+// fill `codes` with each group's code table (num_groups * num_symbols entries),
+// and `context_codes` with the table for each context.
+// returns false if a group's lengths aren't a prefix code
+bool get_context_code_tables(const context_code *code, code_entry *codes, const code_entry **context_codes);
+// fill `tables` with a decode table for each group (to be deleted with decode_table_delete),
+// and `context_entries` with the entries of the table for each context.
+// returns false if a group's lengths aren't a prefix code
+bool get_context_decode_tables(const context_code *code, decode_table **tables, const decode_entry **context_entries);
+
+#endif // CONTEXT_H
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "block.h"
+#include "context.h"
+#include "huffman.h"
+
+// encode the data as one block with the order-1 code, and check it decodes back
+void test_block_round_trip(const symbol *data, size_t length, int num_streams, const context_code *code) {
+    code_entry group_codes[MAX_CONTEXT_GROUPS * num_symbols];
+    const code_entry *context_codes[NUM_CONTEXTS];
+    assert(get_context_code_tables(code, group_codes, context_codes), "get context code tables should succeed");
+    decode_table *tables[MAX_CONTEXT_GROUPS];
+    const decode_entry *context_entries[NUM_CONTEXTS];
+    assert(get_context_decode_tables(code, tables, context_entries), "get context decode tables should succeed");
+
+    uint8_t *encoded = malloc(context_block_bound(length, num_streams, code));
+    size_t encoded_size = encode_context_block(data, length, context_codes, num_streams, encoded);
+    assert(encoded_size <= context_block_bound(length, num_streams, code), "encoded block should be within the bound");
+    symbol *decoded = malloc(length + 1);
+    assert(decode_context_block(encoded, num_streams, context_entries, decoded), "decode context block should succeed");
+    assert(memcmp(decoded, data, length) == 0, "decoded block should match the original");
+
+    free(encoded);
+    free(decoded);
+    for (int g = 0; g < code->num_groups; g++) {
+        decode_table_delete(tables[g]);
+    }
+}
+
+int main() {
+    long *pairs = calloc(NUM_CONTEXTS * num_symbols, sizeof(long));
+    context_code code;
+
+    printf("test counting pairs\n");
+    // each segment starts as if after a 0
+    const symbol abab[] = "abab";
+    count_context_pairs(abab, 4, 2, pairs);
+    assert(pairs[0 * num_symbols + 'a'] == 2 && pairs['a' * num_symbols + 'b'] == 2,
+        "count pairs should count within each segment");
+    assert(pairs['b' * num_symbols + 'a'] == 0, "count pairs shouldn't count across segments");
+    count_context_pairs(abab, 0, 2, pairs);
+    count_context_pairs(abab, 3, 4, pairs);
+    assert(pairs[0 * num_symbols + 'a'] == 4 && pairs[0 * num_symbols + 'b'] == 1,
+        "count pairs should split short blocks into segments of a symbol");
+
+    printf("test independent symbols\n");
+    // when the symbol before says nothing, one group is best
+    const size_t n = 100000;
+    symbol *data = malloc(n);
+    srand(42);
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand() % 8;
+    }
+    memset(pairs, 0, sizeof(long) * NUM_CONTEXTS * num_symbols);
+    count_context_pairs(data, n, 4, pairs);
+    assert(build_context_code(pairs, 0, &code), "build context code should succeed");
+    assert(code.num_groups == 1, "independent symbols should need only one group");
+    test_block_round_trip(data, n, 4, &code);
+
+    printf("test dependent symbols\n");
+    // after a vowel comes a consonant, and after a consonant, a vowel or a space
+    const char *vowels = "aeiou";
+    const char *consonants = "bcdfghklmnprst";
+    symbol previous = ' ';
+    for (size_t i = 0; i < n; i++) {
+        if (strchr(vowels, previous) != NULL) {
+            data[i] = consonants[rand() % 14];
+        }else {
+            data[i] = rand() % 4 == 0 ? ' ' : vowels[rand() % 5];
+        }
+        previous = data[i];
+    }
+    // (every block coded below is counted, as a pair which wasn't has no code)
+    memset(pairs, 0, sizeof(long) * NUM_CONTEXTS * num_symbols);
+    count_context_pairs(data, n, 3, pairs);
+    count_context_pairs(data, 5, 3, pairs);
+    count_context_pairs(data, n, 1, pairs);
+    assert(build_context_code(pairs, 0, &code), "build context code should succeed");
+    assert(code.num_groups > 1, "dependent symbols should have several groups");
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        assert(code.group_of[c] < code.num_groups, "every context should be in a group");
+    }
+    assert(code.group_of['a'] == code.group_of['e'] && code.group_of['a'] != code.group_of['b'],
+        "contexts followed by alike symbols should share a group");
+
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        for (int s = 0; s < num_symbols; s++) {
+            symbol_frequencies[s] += pairs[c * num_symbols + s];
+        }
+    }
+    uint8_t order0_lengths[num_symbols];
+    assert(build_code_lengths(symbol_frequencies, 0, order0_lengths), "build code lengths should succeed");
+    assert(context_encoded_size_bits(pairs, &code) < encoded_size_bits(symbol_frequencies, order0_lengths),
+        "an order-1 code should take fewer bits than one code");
+    test_block_round_trip(data, n, 3, &code);
+    test_block_round_trip(data, 5, 3, &code);
+    test_block_round_trip(data, 0, 3, &code);
+    test_block_round_trip(data, n, 1, &code);
+
+    assert(build_context_code(pairs, 5, &code), "build context code should succeed with a limit");
+    for (int g = 0; g < code.num_groups; g++) {
+        for (int s = 0; s < num_symbols; s++) {
+            assert(code.code_lengths[g][s] <= 5, "codes should be limited to the max length");
+        }
+    }
+    test_block_round_trip(data, n, 3, &code);
+    assert(!build_context_code(pairs, 2, &code), "build context code should fail if codes can't be that short");
+
+    free(data);
+    free(pairs);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define HAVE_CRC32_INSTRUCTION
+#endif
+
+// the Castagnoli polynomial, bit reversed (so the lowest bit is the first)
+#define POLYNOMIAL 0x82f63b78
+
+// tables[k][b] is the CRC of byte b followed by k zero bytes,
+// so 8 bytes can be folded into the CRC at once, each with its own table
+static uint32_t tables[8][256];
+
+// the fastest way this processor has
+static uint32_t (*crc32c_fastest)(uint32_t, const uint8_t *, size_t);
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+
+static void init_tables() {
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+        }
+        tables[0][b] = crc;
+    }
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xff];
+        }
+    }
+}
+
+// (the CRC is kept inverted while it's worked on, so leading zero bytes change it)
+static uint32_t crc32c_tables(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^ tables[5][(low >> 16) & 0xff]
+            ^ tables[4][low >> 24] ^ tables[3][data[4]] ^ tables[2][data[5]] ^ tables[1][data[6]]
+            ^ tables[0][data[7]];
+    }
+    for (; length > 0; data++, length--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xff];
+    }
+    return ~crc;
+}
+
+#ifdef HAVE_CRC32_INSTRUCTION
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_instruction(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+    for (; length > 0; data++, length--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return ~crc;
+}
+
+static bool has_crc32_instruction() {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+}
+#endif
+
+static void init() {
+    init_tables();
+    crc32c_fastest = crc32c_tables;
+#ifdef HAVE_CRC32_INSTRUCTION
+    if (has_crc32_instruction()) {
+        crc32c_fastest = crc32c_instruction;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t length) {
+    pthread_once(&initialized, init);
+    return crc32c_fastest(crc, data, length);
+}
+
+uint32_t crc32c_portable(uint32_t crc, const uint8_t *data, size_t length) {
+    pthread_once(&initialized, init);
+    return crc32c_tables(crc, data, length);
+}
@@ -0,0 +1,17 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (with the Castagnoli polynomial, as iSCSI and ext4 use), for checking that data
+// comes out as it went in. with the processor's crc32 instruction (SSE 4.2) when it has one,
+// which checks several bytes a cycle, and otherwise with tables, 8 bytes at a time
+
+// the CRC of `length` bytes of `data`, continuing from the CRC of what came before them
+// (0 for nothing), so data can be checked in pieces
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t length);
+// the same, never with the instruction
+uint32_t crc32c_portable(uint32_t crc, const uint8_t *data, size_t length);
+
+#endif // CRC32C_H
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "crc32c.h"
+
+int main() {
+    printf("test known values\n");
+    const uint8_t *digits = (const uint8_t *)"123456789";
+    assert(crc32c(0, digits, 9) == 0xe3069283, "crc of the standard check string should match");
+    assert(crc32c_portable(0, digits, 9) == 0xe3069283, "portable crc of the check string should match");
+    assert(crc32c(0, NULL, 0) == 0, "crc of nothing should be 0");
+    uint8_t zeros[32];
+    memset(zeros, 0, sizeof(zeros));
+    assert(crc32c(0, zeros, sizeof(zeros)) == 0x8a9136aa, "crc of 32 zero bytes should match RFC 3720");
+    uint8_t ones[32];
+    memset(ones, 0xff, sizeof(ones));
+    assert(crc32c(0, ones, sizeof(ones)) == 0x62a8ab43, "crc of 32 0xff bytes should match RFC 3720");
+
+    printf("test random bytes\n");
+    const size_t n = 100003;
+    uint8_t *data = malloc(n);
+    srand(42);
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand();
+    }
+    // every length and alignment around a word, to check each loop's remainder
+    for (size_t start = 0; start < 9; start++) {
+        for (size_t length = 0; length < 20; length++) {
+            assert(crc32c(0, data + start, length) == crc32c_portable(0, data + start, length),
+                   "crc should be the same with and without the instruction");
+        }
+    }
+    assert(crc32c(0, data, n) == crc32c_portable(0, data, n), "crc of many bytes should be the same either way");
+
+    printf("test in pieces\n");
+    uint32_t whole = crc32c(0, data, n);
+    for (size_t split = 0; split < n; split += 9973) {
+        assert(crc32c(crc32c(0, data, split), data + split, n - split) == whole,
+               "crc continued from a first piece should be the crc of both");
+        assert(crc32c_portable(crc32c(0, data, split), data + split, n - split) == whole,
+               "either way can continue the other's crc");
+    }
+    data[n / 2] ^= 1;
+    assert(crc32c(0, data, n) != whole, "changing a bit should change the crc");
+
+    free(data);
+    return 0;
+}
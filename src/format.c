@@ -0,0 +1,765 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "format.h"
+#include "huffman.h"
+#include "writeutils.h"
+
+const uint8_t format_version = 7;
+static const char magic[3] = {'H', 'U', 'F'};
+// magic, version, flags and number of streams
+const size_t file_header_size = sizeof(magic) + 3;
+
+size_t put_file_header(const file_header *header, uint8_t *out) {
+    memcpy(out, magic, sizeof(magic));
+    out[sizeof(magic)] = format_version;
+    out[sizeof(magic) + 1] = header->flags;
+    out[sizeof(magic) + 2] = header->num_streams;
+    return file_header_size;
+}
+
+bool get_file_header(const uint8_t *bytes, file_header *header) {
+    if (memcmp(bytes, magic, sizeof(magic)) != 0 || bytes[sizeof(magic)] != format_version) {
+        return false;
+    }
+    uint8_t flags = bytes[sizeof(magic) + 1];
+    uint8_t num_streams = bytes[sizeof(magic) + 2];
+    // (a file with block tables has no code of its own, and a file's code is only one kind)
+    int file_codes = !!(flags & FLAG_BLOCK_TABLES) + !!(flags & FLAG_CONTEXT_CODE) + !!(flags & FLAG_ANS_CODE)
+                   + !!(flags & FLAG_WIDE_SYMBOLS) + !!(flags & FLAG_SHARED_TABLE);
+    if (num_streams < 1 || num_streams > MAX_STREAMS || file_codes > 1) {
+        return false;
+    }
+    // (records are coded with a plain code, or a shared table, and have no blocks to index or check)
+    const uint8_t not_with_records = FLAG_BLOCK_INDEX | FLAG_BLOCK_TABLES | FLAG_CONTEXT_CODE | FLAG_ANS_CODE
+                                   | FLAG_WIDE_SYMBOLS | FLAG_BLOCK_CHECKSUMS;
+    if ((flags & FLAG_RECORDS) && ((flags & not_with_records) || num_streams != 1)) {
+        return false;
+    }
+    header->flags = flags;
+    header->num_streams = num_streams;
+    return true;
+}
+
+bool write_file_header(const file_header *header, FILE *f) {
+    uint8_t buf[file_header_size];
+    put_file_header(header, buf);
+    return fwrite(buf, sizeof(uint8_t), file_header_size, f) == file_header_size;
+}
+
+bool read_file_header(file_header *header, FILE *f) {
+    uint8_t buf[file_header_size];
+    return fread(buf, sizeof(uint8_t), file_header_size, f) == file_header_size
+        && get_file_header(buf, header);
+}
+
+// code lengths are stored as a sequence of bytes, each one of:
+//   0xxxxxxx  a single length x (at most MAX_CODE_LENGTH)
+//   10xxxxxx  another x+1 copies of the previous length (1 to 64)
+//   11xxxxxx  x+1 zero lengths (1 to 64)
+// so unused symbols, and runs of equal length codes, are cheap.
+// (changes to code lengths are stored the same way)
+#define REPEAT_PREVIOUS 0x80
+#define REPEAT_ZERO 0xc0
+#define MAX_RUN 64
+
+// pack one value per symbol, each less than REPEAT_PREVIOUS
+static size_t pack_values(const uint8_t *values, uint8_t *out) {
+    size_t n = 0;
+
+    int i = 0;
+    while (i < num_symbols) {
+        uint8_t value = values[i];
+        int run = 0;
+        if (value == 0) {
+            while (i < num_symbols && values[i] == 0 && run < MAX_RUN) {
+                i++;
+                run++;
+            }
+            out[n++] = REPEAT_ZERO | (run - 1);
+        }else {
+            out[n++] = value;
+            i++;
+            while (i < num_symbols && values[i] == value && run < MAX_RUN) {
+                i++;
+                run++;
+            }
+            if (run > 0) {
+                out[n++] = REPEAT_PREVIOUS | (run - 1);
+            }
+        }
+    }
+    return n;
+}
+
+size_t pack_code_lengths(const uint8_t *code_lengths, uint8_t *out) {
+    return pack_values(code_lengths, out);
+}
+
+// how far through unpacking the code lengths
+typedef struct {
+    // the next symbol to get a length
+    int i;
+    uint8_t previous;
+    // the biggest allowed value
+    uint8_t max_value;
+} unpack_state;
+
+// unpack one byte of code lengths. returns false if it's malformed
+static bool unpack_byte(uint8_t c, uint8_t *code_lengths, unpack_state *state) {
+    if ((c & REPEAT_ZERO) == REPEAT_ZERO || (c & REPEAT_ZERO) == REPEAT_PREVIOUS) {
+        uint8_t length = (c & REPEAT_ZERO) == REPEAT_ZERO ? 0 : state->previous;
+        int run = (c & (MAX_RUN - 1)) + 1;
+        if (state->i + run > num_symbols) {
+            return false;
+        }
+        memset(code_lengths + state->i, length, run);
+        state->i += run;
+    }else {
+        if (c > state->max_value) {
+            return false;
+        }
+        code_lengths[state->i++] = c;
+        state->previous = c;
+    }
+    return true;
+}
+
+static bool unpack_values(const uint8_t *packed, size_t packed_size, uint8_t max_value, uint8_t *values) {
+    unpack_state state = {0, 0, max_value};
+    for (size_t k = 0; k < packed_size; k++) {
+        if (state.i == num_symbols || !unpack_byte(packed[k], values, &state)) {
+            return false;
+        }
+    }
+    return state.i == num_symbols;
+}
+
+size_t packed_code_lengths_size(const uint8_t *packed, size_t available) {
+    int i = 0;
+    for (size_t k = 0; k < available; k++) {
+        uint8_t c = packed[k];
+        bool is_run = (c & REPEAT_ZERO) == REPEAT_ZERO || (c & REPEAT_ZERO) == REPEAT_PREVIOUS;
+        i += is_run ? (c & (MAX_RUN - 1)) + 1 : 1;
+        if (i >= num_symbols) {
+            return k + 1;
+        }
+    }
+    return 0;
+}
+
+bool unpack_code_lengths(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths) {
+    return unpack_values(packed, packed_size, MAX_CODE_LENGTH, code_lengths);
+}
+
+bool write_code_lengths(const uint8_t *code_lengths, FILE *f) {
+    uint8_t buf[num_symbols];
+    size_t n = pack_code_lengths(code_lengths, buf);
+    return fwrite(buf, sizeof(uint8_t), n, f) == n;
+}
+
+static bool read_values(FILE *f, uint8_t max_value, uint8_t *values) {
+    unpack_state state = {0, 0, max_value};
+    while (state.i < num_symbols) {
+        int c = fgetc(f);
+        if (c == EOF || !unpack_byte(c, values, &state)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool read_code_lengths(uint8_t *code_lengths, FILE *f) {
+    return read_values(f, MAX_CODE_LENGTH, code_lengths);
+}
+
+size_t pack_context_code(const context_code *code, uint8_t *out) {
+    size_t n = 0;
+    out[n++] = code->num_groups;
+    n += pack_values(code->group_of, out + n);
+    for (int g = 0; g < code->num_groups; g++) {
+        n += pack_values(code->code_lengths[g], out + n);
+    }
+    return n;
+}
+
+bool unpack_context_code(const uint8_t *packed, size_t packed_size, context_code *code) {
+    if (packed_size == 0 || packed[0] < 1 || packed[0] > MAX_CONTEXT_GROUPS) {
+        return false;
+    }
+    code->num_groups = packed[0];
+    size_t offset = 1;
+    for (int g = -1; g < code->num_groups; g++) {
+        // the groups, then each group's lengths
+        size_t size = packed_code_lengths_size(packed + offset, packed_size - offset);
+        uint8_t max_value = g < 0 ? code->num_groups - 1 : MAX_CODE_LENGTH;
+        if (size == 0 || !unpack_values(packed + offset, size, max_value, g < 0 ? code->group_of : code->code_lengths[g])) {
+            return false;
+        }
+        offset += size;
+    }
+    return offset == packed_size;
+}
+
+size_t packed_context_code_size(const uint8_t *packed, size_t available) {
+    if (available == 0) {
+        return 0;
+    }
+    // (a bad number of groups is left for unpacking to find)
+    int num_groups = packed[0] >= 1 && packed[0] <= MAX_CONTEXT_GROUPS ? packed[0] : 0;
+    size_t offset = 1;
+    for (int g = -1; g < num_groups; g++) {
+        size_t size = packed_code_lengths_size(packed + offset, available - offset);
+        if (size == 0) {
+            return 0;
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+bool write_context_code(const context_code *code, FILE *f) {
+    uint8_t buf[MAX_PACKED_CONTEXT_CODE];
+    size_t n = pack_context_code(code, buf);
+    return fwrite(buf, sizeof(uint8_t), n, f) == n;
+}
+
+bool read_context_code(context_code *code, FILE *f) {
+    int num_groups = fgetc(f);
+    if (num_groups < 1 || num_groups > MAX_CONTEXT_GROUPS || !read_values(f, num_groups - 1, code->group_of)) {
+        return false;
+    }
+    code->num_groups = num_groups;
+    for (int g = 0; g < num_groups; g++) {
+        if (!read_code_lengths(code->code_lengths[g], f)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a block's code table starts with a byte saying what follows:
+// its code lengths, or the changes to the current code's lengths.
+// a change d is stored as its zigzag encoding (0, -1, 1, -2, ... as 0, 1, 2, 3, ...),
+// which is at most 2 * MAX_CODE_LENGTH, so small changes, and no change, are cheap
+#define TABLE_LENGTHS 0
+#define TABLE_CHANGES 1
+
+size_t pack_block_table(const uint8_t *code_lengths, const uint8_t *current_lengths, uint8_t *out) {
+    if (current_lengths == NULL) {
+        out[0] = TABLE_LENGTHS;
+        return 1 + pack_values(code_lengths, out + 1);
+    }
+
+    uint8_t changes[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        int change = code_lengths[i] - current_lengths[i];
+        changes[i] = change < 0 ? -2 * change - 1 : 2 * change;
+    }
+    out[0] = TABLE_CHANGES;
+    return 1 + pack_values(changes, out + 1);
+}
+
+bool unpack_block_table(const uint8_t *packed, size_t packed_size, const uint8_t *current_lengths, uint8_t *code_lengths) {
+    if (packed_size == 0) {
+        return false;
+    }
+    if (packed[0] == TABLE_LENGTHS) {
+        return unpack_values(packed + 1, packed_size - 1, MAX_CODE_LENGTH, code_lengths);
+    }
+    uint8_t changes[num_symbols];
+    if (packed[0] != TABLE_CHANGES || current_lengths == NULL
+        || !unpack_values(packed + 1, packed_size - 1, 2 * MAX_CODE_LENGTH, changes)) {
+        return false;
+    }
+    for (int i = 0; i < num_symbols; i++) {
+        int change = changes[i] & 1 ? -(changes[i] + 1) / 2 : changes[i] / 2;
+        int length = current_lengths[i] + change;
+        if (length < 0 || length > MAX_CODE_LENGTH) {
+            return false;
+        }
+        code_lengths[i] = length;
+    }
+    return true;
+}
+
+#define ANS_COUNT_HIGH 0x80
+
+size_t pack_ans_counts(const uint16_t *counts, uint8_t *out) {
+    size_t n = 0;
+    for (int i = 0; i < num_symbols;) {
+        if (counts[i] == 0) {
+            int run = 1;
+            while (i + run < num_symbols && counts[i + run] == 0 && run < 256) {
+                run++;
+            }
+            out[n++] = 0;
+            out[n++] = run - 1;
+            i += run;
+            continue;
+        }
+        if (counts[i] >= ANS_COUNT_HIGH) {
+            out[n++] = ANS_COUNT_HIGH | counts[i] >> 8;
+        }
+        out[n++] = counts[i] & 0xff;
+        i++;
+    }
+    return n;
+}
+
+// parse packed counts (into `counts`, if it isn't NULL) until every symbol has one.
+// returns the number of bytes they take, or 0 if they don't end within `available` bytes
+static size_t parse_ans_counts(const uint8_t *packed, size_t available, uint16_t *counts) {
+    size_t n = 0;
+    int i = 0;
+    while (i < num_symbols) {
+        if (n >= available) {
+            return 0;
+        }
+        uint8_t c = packed[n++];
+        int run = 1;
+        uint16_t count = c;
+        if (c == 0) {
+            if (n >= available) {
+                return 0;
+            }
+            run = packed[n++] + 1;
+        }else if (c & ANS_COUNT_HIGH) {
+            if (n >= available) {
+                return 0;
+            }
+            count = (c & ~ANS_COUNT_HIGH) << 8 | packed[n++];
+        }
+        for (int j = 0; j < run && i < num_symbols; j++) {
+            if (counts != NULL) {
+                counts[i] = count;
+            }
+            i++;
+        }
+    }
+    return n;
+}
+
+size_t packed_ans_counts_size(const uint8_t *packed, size_t available) {
+    return parse_ans_counts(packed, available, NULL);
+}
+
+bool unpack_ans_counts(const uint8_t *packed, size_t packed_size, uint16_t *counts) {
+    if (parse_ans_counts(packed, packed_size, counts) != packed_size) {
+        return false;
+    }
+    int sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        sum += counts[i];
+    }
+    return sum == ANS_TABLE_SIZE;
+}
+
+bool write_ans_counts(const uint16_t *counts, FILE *f) {
+    uint8_t buf[MAX_PACKED_ANS_COUNTS];
+    size_t n = pack_ans_counts(counts, buf);
+    return fwrite(buf, sizeof(uint8_t), n, f) == n;
+}
+
+bool read_ans_counts(uint16_t *counts, FILE *f) {
+    // their size isn't known until they end, so take a byte at a time
+    uint8_t buf[MAX_PACKED_ANS_COUNTS];
+    size_t n = 0;
+    while (n < MAX_PACKED_ANS_COUNTS) {
+        int c = fgetc(f);
+        if (c == EOF) {
+            return false;
+        }
+        buf[n++] = c;
+        if (packed_ans_counts_size(buf, n) != 0) {
+            return unpack_ans_counts(buf, n, counts);
+        }
+    }
+    return false;
+}
+
+// wide code lengths are sparse: the number of symbols with a code (a uint32), then for each of them
+// (in order) the gap since the one before (or for the first, its symbol), and its length (a byte).
+// a gap is packed as one byte below 0x80, two with the top bits 10 below 0x4000, and otherwise
+// three with the top bits 11, so the usual few thousand present symbols take about 2 bytes each
+#define GAP_TWO_BYTES 0x80
+#define GAP_THREE_BYTES 0xc0
+
+size_t pack_wide_code_lengths(const uint8_t *code_lengths, uint8_t *out) {
+    size_t n = sizeof(uint32_t);
+    uint32_t num_present = 0;
+    long previous = -1;
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        if (code_lengths[i] == 0) {
+            continue;
+        }
+        long gap = i - previous - 1;
+        if (gap >= 0x4000) {
+            out[n++] = GAP_THREE_BYTES | gap >> 16;
+            out[n++] = gap >> 8;
+        }else if (gap >= 0x80) {
+            out[n++] = GAP_TWO_BYTES | gap >> 8;
+        }
+        out[n++] = gap;
+        out[n++] = code_lengths[i];
+        previous = i;
+        num_present++;
+    }
+    put_uint(num_present, out);
+    return n;
+}
+
+// the bytes after a gap's first
+static int gap_extra_bytes(uint8_t first) {
+    return (first & GAP_THREE_BYTES) == GAP_THREE_BYTES ? 2 : (first & GAP_TWO_BYTES ? 1 : 0);
+}
+
+// parse packed wide code lengths (into `code_lengths`, if it isn't NULL).
+// returns the number of bytes they take, or 0 if they're malformed
+// or don't end within `available` bytes
+static size_t parse_wide_code_lengths(const uint8_t *packed, size_t available, uint8_t *code_lengths) {
+    if (available < sizeof(uint32_t)) {
+        return 0;
+    }
+    uint32_t num_present = get_uint(packed);
+    if (num_present > NUM_WIDE_SYMBOLS) {
+        return 0;
+    }
+    if (code_lengths != NULL) {
+        memset(code_lengths, 0, sizeof(uint8_t) * NUM_WIDE_SYMBOLS);
+    }
+    size_t n = sizeof(uint32_t);
+    long previous = -1;
+    for (uint32_t k = 0; k < num_present; k++) {
+        if (n >= available) {
+            return 0;
+        }
+        int extra = gap_extra_bytes(packed[n]);
+        // (with the length after it)
+        if (available - n < extra + 2) {
+            return 0;
+        }
+        long gap = packed[n++] & (extra > 0 ? 0x3f : 0x7f);
+        for (int j = 0; j < extra; j++) {
+            gap = gap << 8 | packed[n++];
+        }
+        long i = previous + 1 + gap;
+        uint8_t length = packed[n++];
+        if (i >= NUM_WIDE_SYMBOLS || length == 0 || length > MAX_CODE_LENGTH) {
+            return 0;
+        }
+        if (code_lengths != NULL) {
+            code_lengths[i] = length;
+        }
+        previous = i;
+    }
+    return n;
+}
+
+size_t packed_wide_code_lengths_size(const uint8_t *packed, size_t available) {
+    return parse_wide_code_lengths(packed, available, NULL);
+}
+
+size_t min_packed_wide_code_lengths_size(const uint8_t *packed, size_t available) {
+    if (available < sizeof(uint32_t)) {
+        return sizeof(uint32_t);
+    }
+    uint32_t num_present = get_uint(packed);
+    size_t n = sizeof(uint32_t);
+    // (the symbols not seen yet take at least a byte for their gap, and one for their length)
+    for (uint32_t k = 0; k < num_present; k++) {
+        if (n >= available) {
+            return n + 2 * (size_t)(num_present - k);
+        }
+        n += gap_extra_bytes(packed[n]) + 2;
+    }
+    return n;
+}
+
+bool unpack_wide_code_lengths(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths) {
+    return parse_wide_code_lengths(packed, packed_size, code_lengths) == packed_size;
+}
+
+bool write_wide_code_lengths(const uint8_t *code_lengths, FILE *f) {
+    uint8_t *buf = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+    size_t n = pack_wide_code_lengths(code_lengths, buf);
+    bool written = fwrite(buf, sizeof(uint8_t), n, f) == n;
+    free(buf);
+    return written;
+}
+
+bool read_wide_code_lengths(uint8_t *code_lengths, FILE *f) {
+    // each symbol's entry says how long it is from its first byte, so read them one by one
+    uint8_t *buf = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+    size_t n = fread(buf, sizeof(uint8_t), sizeof(uint32_t), f);
+    bool valid = n == sizeof(uint32_t) && get_uint(buf) <= NUM_WIDE_SYMBOLS;
+    for (uint32_t k = 0; valid && k < get_uint(buf); k++) {
+        int c = fgetc(f);
+        if (c == EOF) {
+            valid = false;
+            break;
+        }
+        buf[n++] = c;
+        size_t rest = gap_extra_bytes(c) + 1;
+        valid = fread(buf + n, sizeof(uint8_t), rest, f) == rest;
+        n += rest;
+    }
+    valid = valid && unpack_wide_code_lengths(buf, n, code_lengths);
+    free(buf);
+    return valid;
+}
+
+static const char table_magic[3] = {'H', 'U', 'T'};
+// magic, version and ID
+static const size_t table_header_size = sizeof(table_magic) + 1 + sizeof(uint32_t);
+
+uint32_t table_id(const uint8_t *code_lengths) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < num_symbols; i++) {
+        hash = (hash ^ code_lengths[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t pack_table_file(const uint8_t *code_lengths, uint8_t *out) {
+    memcpy(out, table_magic, sizeof(table_magic));
+    out[sizeof(table_magic)] = format_version;
+    put_uint(table_id(code_lengths), out + sizeof(table_magic) + 1);
+    return table_header_size + pack_code_lengths(code_lengths, out + table_header_size);
+}
+
+bool unpack_table_file(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths, uint32_t *idp) {
+    if (packed_size < table_header_size || memcmp(packed, table_magic, sizeof(table_magic)) != 0
+        || packed[sizeof(table_magic)] != format_version
+        || !unpack_code_lengths(packed + table_header_size, packed_size - table_header_size, code_lengths)) {
+        return false;
+    }
+    *idp = get_uint(packed + sizeof(table_magic) + 1);
+    for (int i = 0; i < num_symbols; i++) {
+        if (code_lengths[i] == 0) {
+            return false;
+        }
+    }
+    return *idp == table_id(code_lengths);
+}
+
+bool write_table_file(const uint8_t *code_lengths, FILE *f) {
+    uint8_t buf[MAX_TABLE_FILE_SIZE];
+    size_t n = pack_table_file(code_lengths, buf);
+    return fwrite(buf, sizeof(uint8_t), n, f) == n;
+}
+
+bool read_table_file(uint8_t *code_lengths, uint32_t *idp, FILE *f) {
+    // (it's the whole file, so one more byte would be too many)
+    uint8_t buf[MAX_TABLE_FILE_SIZE + 1];
+    size_t n = fread(buf, sizeof(uint8_t), sizeof(buf), f);
+    return n <= MAX_TABLE_FILE_SIZE && unpack_table_file(buf, n, code_lengths, idp);
+}
+
+bool write_end_of_blocks(FILE *f) {
+    // a block with decoded length 0
+    return write_ulong(0, f);
+}
+
+// make sure the buffer can hold `size` bytes
+static void reserve(uint8_t **bufp, size_t *capacityp, size_t size) {
+    if (size > *capacityp) {
+        *capacityp = size;
+        *bufp = realloc(*bufp, size);
+    }
+}
+
+long read_block(FILE *f, int num_streams, uint8_t flags, uint8_t **bufp, size_t *capacityp) {
+    size_t header_size = block_header_size(num_streams);
+    reserve(bufp, capacityp, header_size);
+
+    if (fread(*bufp, sizeof(uint8_t), END_OF_BLOCKS_SIZE, f) != END_OF_BLOCKS_SIZE) {
+        return -1;
+    }
+    if (get_ulong(*bufp) == 0) {
+        return 0;
+    }
+    size_t rest_of_header = header_size - END_OF_BLOCKS_SIZE;
+    if (fread(*bufp + END_OF_BLOCKS_SIZE, sizeof(uint8_t), rest_of_header, f) != rest_of_header) {
+        return -1;
+    }
+
+    size_t decoded_length, block_size;
+    if (!parse_block_header(*bufp, num_streams, flags, &decoded_length, &block_size)) {
+        return -1;
+    }
+    reserve(bufp, capacityp, block_size);
+    size_t streams_size = block_size - header_size;
+    if (fread(*bufp + header_size, sizeof(uint8_t), streams_size, f) != streams_size) {
+        return -1;
+    }
+    return block_size;
+}
+
+// the index is a (block offset, decoded length) pair per block,
+// followed by a fixed size trailer, so it can be found from the end of the file:
+//   number of blocks
+//   offset of the start of the index
+static const long index_trailer_size = 2 * sizeof(uint64_t);
+
+bool write_block_index(const block_index_entry *entries, uint64_t num_blocks, uint64_t index_offset, FILE *f) {
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (!write_ulong(entries[i].offset, f) || !write_ulong(entries[i].length, f)) {
+            return false;
+        }
+    }
+    return write_ulong(num_blocks, f) && write_ulong(index_offset, f);
+}
+
+uint64_t block_index_size(uint64_t num_blocks) {
+    return num_blocks * 2 * sizeof(uint64_t) + index_trailer_size;
+}
+
+static block_index_entry *read_index_from_end(FILE *f, uint64_t *num_blocksp) {
+    if (fseek(f, -index_trailer_size, SEEK_END) != 0) {
+        return NULL;
+    }
+    uint64_t trailer_offset = ftell(f);
+
+    uint64_t num_blocks, index_offset;
+    if (!read_ulong(&num_blocks, f) || !read_ulong(&index_offset, f)) {
+        return NULL;
+    }
+    // each entry is two ulongs
+    if (index_offset > trailer_offset || (trailer_offset - index_offset) / 16 != num_blocks) {
+        return NULL;
+    }
+    if (fseek(f, index_offset, SEEK_SET) != 0) {
+        return NULL;
+    }
+
+    // (one spare, so an empty index isn't mistaken for a failed malloc)
+    block_index_entry *entries = malloc(sizeof(block_index_entry) * (num_blocks + 1));
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        if (!read_ulong(&entries[i].offset, f) || !read_ulong(&entries[i].length, f)
+            || entries[i].offset >= index_offset) {
+            free(entries);
+            return NULL;
+        }
+    }
+    *num_blocksp = num_blocks;
+    return entries;
+}
+
+block_index_entry *read_block_index(FILE *f, uint64_t *num_blocksp) {
+    long start = ftell(f);
+    if (start < 0) {
+        // not seekable
+        return NULL;
+    }
+    block_index_entry *entries = read_index_from_end(f, num_blocksp);
+    // leave the stream where it was, so the blocks can still be read in order
+    if (fseek(f, start, SEEK_SET) != 0) {
+        free(entries);
+        return NULL;
+    }
+    return entries;
+}
+
+const uint8_t *locate_block_index(const uint8_t *data, size_t size, uint64_t *num_blocksp) {
+    if (size < (size_t)index_trailer_size) {
+        return NULL;
+    }
+    uint64_t trailer_offset = size - index_trailer_size;
+    uint64_t num_blocks = get_ulong(data + trailer_offset);
+    uint64_t index_offset = get_ulong(data + trailer_offset + sizeof(uint64_t));
+    // each entry is two ulongs
+    if (index_offset > trailer_offset || (trailer_offset - index_offset) / 16 != num_blocks
+        || (trailer_offset - index_offset) % 16 != 0) {
+        return NULL;
+    }
+    *num_blocksp = num_blocks;
+    return data + index_offset;
+}
+
+void get_block_index_entry(const uint8_t *entries, uint64_t i, block_index_entry *entry) {
+    entry->offset = get_ulong(entries + i * 2 * sizeof(uint64_t));
+    entry->length = get_ulong(entries + i * 2 * sizeof(uint64_t) + sizeof(uint64_t));
+}
+
+int record_field_size(uint64_t decoded_size, uint64_t encoded_size) {
+    return decoded_size <= UINT32_MAX && encoded_size <= UINT32_MAX ? sizeof(uint32_t) : sizeof(uint64_t);
+}
+
+uint64_t record_index_size(const records_header *header) {
+    return header->num_records * 2 * header->field_size;
+}
+
+void put_records_header(const records_header *header, uint8_t *out) {
+    put_ulong(header->num_records, out);
+    put_ulong(header->decoded_size, out + sizeof(uint64_t));
+    put_ulong(header->encoded_size, out + 2 * sizeof(uint64_t));
+    out[3 * sizeof(uint64_t)] = header->field_size;
+}
+
+bool get_records_header(const uint8_t *bytes, records_header *header) {
+    header->num_records = get_ulong(bytes);
+    header->decoded_size = get_ulong(bytes + sizeof(uint64_t));
+    header->encoded_size = get_ulong(bytes + 2 * sizeof(uint64_t));
+    header->field_size = bytes[3 * sizeof(uint64_t)];
+    return header->field_size == sizeof(uint32_t) || header->field_size == sizeof(uint64_t);
+}
+
+void put_record_entry(const record_entry *entry, int field_size, uint8_t *out) {
+    if (field_size == sizeof(uint32_t)) {
+        put_uint(entry->offset, out);
+        put_uint(entry->length, out + sizeof(uint32_t));
+    }else {
+        put_ulong(entry->offset, out);
+        put_ulong(entry->length, out + sizeof(uint64_t));
+    }
+}
+
+void get_record_entry(const uint8_t *bytes, int field_size, record_entry *entry) {
+    if (field_size == sizeof(uint32_t)) {
+        entry->offset = get_uint(bytes);
+        entry->length = get_uint(bytes + sizeof(uint32_t));
+    }else {
+        entry->offset = get_ulong(bytes);
+        entry->length = get_ulong(bytes + sizeof(uint64_t));
+    }
+}
+
+block_index_entry *find_blocks(const uint8_t *data, size_t size, uint64_t offset, int num_streams, uint8_t flags,
+                               uint64_t *num_blocksp) {
+    uint64_t capacity = 16;
+    uint64_t num_blocks = 0;
+    block_index_entry *entries = malloc(sizeof(block_index_entry) * capacity);
+
+    size_t header_size = block_header_size(num_streams);
+    while (true) {
+        if (offset > size || size - offset < END_OF_BLOCKS_SIZE) {
+            break;
+        }
+        if (get_ulong(data + offset) == 0) {
+            *num_blocksp = num_blocks;
+            return entries;
+        }
+        size_t decoded_length, block_size;
+        if (size - offset < header_size 
+            || !parse_block_header(data + offset, num_streams, flags, &decoded_length, &block_size)
+            || size - offset < block_size) {
+            break;
+        }
+
+        if (num_blocks == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, sizeof(block_index_entry) * capacity);
+        }
+        entries[num_blocks++] = (block_index_entry) { .offset = offset, .length = decoded_length };
+        offset += block_size;
+    }
+    free(entries);
+    return NULL;
+}
@@ -0,0 +1,228 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ans.h"
+#include "context.h"
+
+// layout of a compressed file:
+//   magic "HUF", a format version byte
+//   a byte of flags, and the number of streams per block
+//   unless FLAG_BLOCK_TABLES is set, the code length of each symbol (see write_code_lengths),
+//   or with FLAG_CONTEXT_CODE, an order-1 code (see write_context_code),
+//   or with FLAG_ANS_CODE, the normalised counts of a tANS code (see write_ans_counts),
+//   or with FLAG_WIDE_SYMBOLS, the code length of each wide symbol (see write_wide_code_lengths)
+//   or with FLAG_SHARED_TABLE, the ID of the table file it was coded with (a uint32)
+//   the encoded blocks (see block.h), ending with an empty block
+//   if FLAG_BLOCK_INDEX is set, an index of the blocks (see write_block_index)
+// or with FLAG_RECORDS, after the file's code (its code lengths, or a shared table's ID), records
+// rather than blocks, each of which can be decoded on its own:
+//   a records header (see put_records_header)
+//   an index of the records: for each, where its encoding starts (from the end of the index)
+//   and its decoded length (each as a uint32, or if they mightn't fit, a uint64)
+//   each record coded with the file's code (as by encode_bytes), padded to a whole byte
+
+extern const uint8_t format_version;
+
+// the file ends with an index of its blocks
+#define FLAG_BLOCK_INDEX 0x01
+// each block has its own code table, and there's none for the whole file
+#define FLAG_BLOCK_TABLES 0x02
+// the file's code is an order-1 code (see context.h), rather than one code for every symbol
+#define FLAG_CONTEXT_CODE 0x04
+// blocks are coded with tANS (see ans.h), and the file's code is its normalised counts
+#define FLAG_ANS_CODE 0x08
+// blocks are coded as wide symbols (see huffman.h), and the file's code is their code lengths
+#define FLAG_WIDE_SYMBOLS 0x10
+// the file's code is a table file's (see write_table_file), shared by the files coded with it,
+// which only carry its ID
+#define FLAG_SHARED_TABLE 0x20
+// the file holds separately decodable records, rather than blocks (and has only one stream)
+#define FLAG_RECORDS 0x40
+// each block's header has the CRC-32C of its decoded content (see block.h), to check it against
+#define FLAG_BLOCK_CHECKSUMS 0x80
+
+typedef struct {
+    uint8_t flags;
+    uint8_t num_streams;
+} file_header;
+
+// the number of bytes write_file_header writes
+extern const size_t file_header_size;
+
+// write the header to `out` (file_header_size bytes)
+size_t put_file_header(const file_header *, uint8_t *out);
+// read a header from the first file_header_size bytes.
+// returns false if they aren't a valid header of this version
+bool get_file_header(const uint8_t *bytes, file_header *);
+
+bool write_file_header(const file_header *, FILE *);
+// returns false if the stream doesn't start with a valid header of this version
+bool read_file_header(file_header *, FILE *);
+
+// run length code one length per symbol (each at most MAX_CODE_LENGTH) into `out`,
+// which needs space for num_symbols bytes. returns the number of bytes written
+size_t pack_code_lengths(const uint8_t *code_lengths, uint8_t *out);
+// returns false if the packed lengths are malformed, or aren't exactly `packed_size` bytes
+bool unpack_code_lengths(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths);
+
+// pack the code table of a block (see block.h) into `out`, which needs space for num_symbols + 1 bytes:
+// as changes from `current_lengths`, the code before the block, or if that's NULL, in full.
+// returns the number of bytes written
+size_t pack_block_table(const uint8_t *code_lengths, const uint8_t *current_lengths, uint8_t *out);
+// find a block's code lengths from its packed table, and the code before the block
+// (NULL if there isn't one). returns false if the table is malformed
+bool unpack_block_table(const uint8_t *packed, size_t packed_size, const uint8_t *current_lengths, uint8_t *code_lengths);
+
+// the size of the packed code lengths starting at `packed`,
+// or 0 if they don't end within the first `available` bytes
+size_t packed_code_lengths_size(const uint8_t *packed, size_t available);
+
+// write the packed lengths. returns false on failure
+bool write_code_lengths(const uint8_t *code_lengths, FILE *);
+// returns false on failure, or if the lengths are malformed
+bool read_code_lengths(uint8_t *code_lengths, FILE *);
+
+// the most bytes pack_context_code writes
+#define MAX_PACKED_CONTEXT_CODE (1 + (MAX_CONTEXT_GROUPS + 1) * NUM_CONTEXTS)
+
+// an order-1 code is packed as its number of groups (a byte), the group of each context
+// (packed like code lengths), and the code lengths of each group.
+// returns the number of bytes written
+size_t pack_context_code(const context_code *, uint8_t *out);
+// returns false if the packed code is malformed, or isn't exactly `packed_size` bytes
+bool unpack_context_code(const uint8_t *packed, size_t packed_size, context_code *);
+// the size of the packed code starting at `packed`,
+// or 0 if it doesn't end within the first `available` bytes
+size_t packed_context_code_size(const uint8_t *packed, size_t available);
+
+bool write_context_code(const context_code *, FILE *);
+// returns false on failure, or if the code is malformed
+bool read_context_code(context_code *, FILE *);
+
+// the most bytes pack_ans_counts writes
+#define MAX_PACKED_ANS_COUNTS (2 * (1 << 8))
+
+// tANS counts are packed as a byte for a count below 0x80, two for bigger ones
+// (the first with its top bit set), and a 0 byte followed by the number of further 0 counts.
+// returns the number of bytes written
+size_t pack_ans_counts(const uint16_t *counts, uint8_t *out);
+// returns false if the packed counts are malformed, don't sum to ANS_TABLE_SIZE,
+// or aren't exactly `packed_size` bytes
+bool unpack_ans_counts(const uint8_t *packed, size_t packed_size, uint16_t *counts);
+// the size of the packed counts starting at `packed`,
+// or 0 if they don't end within the first `available` bytes
+size_t packed_ans_counts_size(const uint8_t *packed, size_t available);
+
+bool write_ans_counts(const uint16_t *counts, FILE *);
+// returns false on failure, or if the counts are malformed
+bool read_ans_counts(uint16_t *counts, FILE *);
+
+// the most bytes pack_wide_code_lengths writes
+#define MAX_PACKED_WIDE_CODE_LENGTHS (sizeof(uint32_t) + 4 * NUM_WIDE_SYMBOLS)
+
+// pack one length per wide symbol (each at most MAX_CODE_LENGTH), listing only those with a code.
+// returns the number of bytes written
+size_t pack_wide_code_lengths(const uint8_t *code_lengths, uint8_t *out);
+// returns false if the packed lengths are malformed, or aren't exactly `packed_size` bytes
+bool unpack_wide_code_lengths(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths);
+// the size of the packed lengths starting at `packed`,
+// or 0 if they're malformed or don't end within the first `available` bytes
+size_t packed_wide_code_lengths_size(const uint8_t *packed, size_t available);
+// the fewest bytes the packed lengths starting at `packed` can take, going by their first `available`
+// bytes (which is their size, once they're all there). reading that much at a time takes
+// only a few reads, where checking packed_wide_code_lengths_size after each byte would take many
+size_t min_packed_wide_code_lengths_size(const uint8_t *packed, size_t available);
+
+bool write_wide_code_lengths(const uint8_t *code_lengths, FILE *);
+// returns false on failure, or if the lengths are malformed
+bool read_wide_code_lengths(uint8_t *code_lengths, FILE *);
+
+// layout of a table file, a code trained on samples of what's to be compressed:
+//   magic "HUT", the format version
+//   the table's ID (a uint32): a hash of its code lengths, so files coded with another table
+//   (even one trained again) don't decode with this one
+//   the code length of each symbol (see write_code_lengths), every one of which has a code
+
+// the most bytes pack_table_file writes
+#define MAX_TABLE_FILE_SIZE (8 + (1 << 8))
+
+// the ID of the table with these code lengths
+uint32_t table_id(const uint8_t *code_lengths);
+// pack a table file into `out`, returning the number of bytes written
+size_t pack_table_file(const uint8_t *code_lengths, uint8_t *out);
+// find a table file's code lengths and ID. returns false if it isn't a table file of this version,
+// its ID doesn't match its lengths, a symbol has no code, or it isn't exactly `packed_size` bytes
+bool unpack_table_file(const uint8_t *packed, size_t packed_size, uint8_t *code_lengths, uint32_t *idp);
+
+bool write_table_file(const uint8_t *code_lengths, FILE *);
+// returns false on failure, or if it isn't a valid table file
+bool read_table_file(uint8_t *code_lengths, uint32_t *idp, FILE *);
+
+bool write_end_of_blocks(FILE *);
+
+// read the next block (of a file with these flags) into `*bufp`, growing it (and `*capacityp`) if it's too small.
+// returns the size of the block, 0 at the end of the blocks, or -1 on failure
+long read_block(FILE *, int num_streams, uint8_t flags, uint8_t **bufp, size_t *capacityp);
+
+// where a block starts in the compressed file,
+// and the length of its decoded content
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} block_index_entry;
+
+// write the index of all blocks, which starts at `index_offset` in the file.
+// returns false on failure
+bool write_block_index(const block_index_entry *entries, uint64_t num_blocks, uint64_t index_offset, FILE *);
+// the number of bytes write_block_index writes
+uint64_t block_index_size(uint64_t num_blocks);
+// read the index from the end of a (seekable) file.
+// returns NULL on failure
+block_index_entry *read_block_index(FILE *, uint64_t *num_blocksp);
+// find the index at the end of `size` bytes of a compressed file in memory, without copying it.
+// returns where its entries start, or NULL if it's malformed
+const uint8_t *locate_block_index(const uint8_t *data, size_t size, uint64_t *num_blocksp);
+// the i'th entry of an index found by locate_block_index
+void get_block_index_entry(const uint8_t *entries, uint64_t i, block_index_entry *);
+
+// the number of records, their decoded length and the size of their encodings in all (uint64 each),
+// and the size of each number in their index (uint8: 4 or 8)
+#define RECORDS_HEADER_SIZE (3 * sizeof(uint64_t) + 1)
+
+typedef struct {
+    uint64_t num_records;
+    uint64_t decoded_size;
+    uint64_t encoded_size;
+    int field_size;
+} records_header;
+
+// the smallest field size for records of up to these sizes in all
+int record_field_size(uint64_t decoded_size, uint64_t encoded_size);
+// the size of the index of these records
+uint64_t record_index_size(const records_header *);
+
+void put_records_header(const records_header *, uint8_t *out);
+// returns false if the field size isn't 4 or 8
+bool get_records_header(const uint8_t *bytes, records_header *);
+
+// where a record's encoding starts (from the end of the index), and its decoded length
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} record_entry;
+
+// the entries of an index with fields of `field_size` bytes
+void put_record_entry(const record_entry *, int field_size, uint8_t *out);
+void get_record_entry(const uint8_t *bytes, int field_size, record_entry *);
+
+// list the blocks in `size` bytes of a compressed file, from the block at `offset` to
+// the end of blocks marker, by following their headers.
+// returns NULL if they're malformed or cut short
+block_index_entry *find_blocks(const uint8_t *data, size_t size, uint64_t offset, int num_streams, uint8_t flags,
+                               uint64_t *num_blocksp);
+
+#endif // FORMAT_H
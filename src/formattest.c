@@ -0,0 +1,576 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "block.h"
+#include "format.h"
+#include "huffman.h"
+#include "writeutils.h"
+
+void test_code_lengths_round_trip(const uint8_t *code_lengths) {
+    FILE *f = tmpfile();
+
+    bool success = write_code_lengths(code_lengths, f);
+    assert(success, "write code lengths should succeed");
+    long size = ftell(f);
+    assert(size <= num_symbols, "packed code lengths should be at most a byte per symbol");
+
+    rewind(f);
+    uint8_t read_lengths[num_symbols];
+    success = read_code_lengths(read_lengths, f);
+    assert(success, "read code lengths should succeed");
+    assert(memcmp(code_lengths, read_lengths, num_symbols) == 0, "read should recover the same lengths");
+    assert(ftell(f) == size, "read should consume exactly what was written");
+
+    uint8_t packed[num_symbols];
+    size_t packed_size = pack_code_lengths(code_lengths, packed);
+    assert(packed_size == size, "pack should give the same bytes as write");
+    memset(read_lengths, 0xff, num_symbols);
+    success = unpack_code_lengths(packed, packed_size, read_lengths);
+    assert(success, "unpack code lengths should succeed");
+    assert(memcmp(code_lengths, read_lengths, num_symbols) == 0, "unpack should recover the same lengths");
+    assert(packed_size == 1 || !unpack_code_lengths(packed, packed_size - 1, read_lengths), 
+        "unpack should reject too few bytes");
+    assert(packed_code_lengths_size(packed, packed_size) == packed_size, "packed size should find the end");
+    assert(packed_code_lengths_size(packed, packed_size - 1) == 0, "packed size should need every byte");
+
+    fclose(f);
+}
+
+void test_context_code_round_trip(const context_code *code) {
+    FILE *f = tmpfile();
+    assert(write_context_code(code, f), "write context code should succeed");
+    long size = ftell(f);
+    rewind(f);
+    context_code read_code;
+    assert(read_context_code(&read_code, f), "read context code should succeed");
+    assert(ftell(f) == size, "read should consume exactly what was written");
+    assert(read_code.num_groups == code->num_groups && memcmp(read_code.group_of, code->group_of, NUM_CONTEXTS) == 0,
+        "read should recover the groups");
+    for (int g = 0; g < code->num_groups; g++) {
+        assert(memcmp(read_code.code_lengths[g], code->code_lengths[g], num_symbols) == 0,
+            "read should recover each group's lengths");
+    }
+    fclose(f);
+
+    uint8_t packed[MAX_PACKED_CONTEXT_CODE];
+    size_t packed_size = pack_context_code(code, packed);
+    assert(packed_size == size, "pack should give the same bytes as write");
+    assert(packed_context_code_size(packed, packed_size) == packed_size, "packed size should find the end");
+    assert(packed_context_code_size(packed, packed_size - 1) == 0, "packed size should need every byte");
+    memset(&read_code, 0, sizeof(read_code));
+    assert(unpack_context_code(packed, packed_size, &read_code), "unpack context code should succeed");
+    assert(read_code.num_groups == code->num_groups && memcmp(read_code.group_of, code->group_of, NUM_CONTEXTS) == 0
+        && memcmp(read_code.code_lengths, code->code_lengths, code->num_groups * sizeof(code->code_lengths[0])) == 0,
+        "unpack should recover the same code");
+    assert(!unpack_context_code(packed, packed_size - 1, &read_code), "unpack should reject too few bytes");
+}
+
+void test_ans_counts_round_trip(const uint16_t *counts) {
+    FILE *f = tmpfile();
+    assert(write_ans_counts(counts, f), "write ans counts should succeed");
+    long size = ftell(f);
+    rewind(f);
+    uint16_t read_counts[num_symbols];
+    assert(read_ans_counts(read_counts, f), "read ans counts should succeed");
+    assert(ftell(f) == size, "read should consume exactly what was written");
+    assert(memcmp(read_counts, counts, sizeof(read_counts)) == 0, "read should recover the counts");
+    fclose(f);
+
+    uint8_t packed[MAX_PACKED_ANS_COUNTS];
+    size_t packed_size = pack_ans_counts(counts, packed);
+    assert(packed_size == size, "pack should give the same bytes as write");
+    assert(packed_ans_counts_size(packed, packed_size) == packed_size, "packed size should find the end");
+    assert(packed_ans_counts_size(packed, packed_size - 1) == 0, "packed size should need every byte");
+    memset(read_counts, 0, sizeof(read_counts));
+    assert(unpack_ans_counts(packed, packed_size, read_counts), "unpack ans counts should succeed");
+    assert(memcmp(read_counts, counts, sizeof(read_counts)) == 0, "unpack should recover the same counts");
+    assert(!unpack_ans_counts(packed, packed_size - 1, read_counts), "unpack should reject too few bytes");
+}
+
+void test_wide_code_lengths_round_trip(const uint8_t *code_lengths) {
+    FILE *f = tmpfile();
+    assert(write_wide_code_lengths(code_lengths, f), "write wide code lengths should succeed");
+    long size = ftell(f);
+    rewind(f);
+    uint8_t *read_lengths = malloc(NUM_WIDE_SYMBOLS);
+    assert(read_wide_code_lengths(read_lengths, f), "read wide code lengths should succeed");
+    assert(ftell(f) == size, "read should consume exactly what was written");
+    assert(memcmp(read_lengths, code_lengths, NUM_WIDE_SYMBOLS) == 0, "read should recover the lengths");
+    fclose(f);
+
+    uint8_t *packed = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+    size_t packed_size = pack_wide_code_lengths(code_lengths, packed);
+    assert(packed_size == size, "pack should give the same bytes as write");
+    assert(packed_wide_code_lengths_size(packed, packed_size) == packed_size, "packed size should find the end");
+    assert(packed_wide_code_lengths_size(packed, packed_size - 1) == 0, "packed size should need every byte");
+    // (reading as much as they must take at a time gets to the end)
+    size_t available = 0;
+    int reads = 0;
+    while (available < packed_size) {
+        size_t needed = min_packed_wide_code_lengths_size(packed, available);
+        assert(needed > available && needed <= packed_size, "min size should need more, but no more than the size");
+        available = needed;
+        reads++;
+    }
+    assert(min_packed_wide_code_lengths_size(packed, packed_size) == packed_size, "min size should be the size at the end");
+    assert(reads < 20, "reading the min size at a time should take few reads");
+    memset(read_lengths, 0, NUM_WIDE_SYMBOLS);
+    assert(unpack_wide_code_lengths(packed, packed_size, read_lengths), "unpack wide code lengths should succeed");
+    assert(memcmp(read_lengths, code_lengths, NUM_WIDE_SYMBOLS) == 0, "unpack should recover the same lengths");
+    assert(!unpack_wide_code_lengths(packed, packed_size - 1, read_lengths), "unpack should reject too few bytes");
+    free(read_lengths);
+    free(packed);
+}
+
+int main() {
+
+    FILE *f = tmpfile();
+    file_header header = { .flags = FLAG_BLOCK_INDEX, .num_streams = 4 };
+    assert(write_file_header(&header, f), "write header should succeed");
+    rewind(f);
+    file_header read_header;
+    assert(read_file_header(&read_header, f), "read header should accept a written header");
+    assert(read_header.flags == header.flags && read_header.num_streams == header.num_streams,
+        "read header should recover the fields");
+    rewind(f);
+    fputc('X', f);
+    rewind(f);
+    assert(!read_file_header(&read_header, f), "read header should reject a bad magic number");
+    fclose(f);
+    uint8_t header_bytes[file_header_size];
+    assert(put_file_header(&header, header_bytes) == file_header_size, "put header should write the whole header");
+    assert(get_file_header(header_bytes, &read_header) && read_header.num_streams == header.num_streams,
+        "get header should accept a put header");
+    header_bytes[file_header_size - 1] = MAX_STREAMS + 1;
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject too many streams");
+    header = (file_header) { .flags = FLAG_BLOCK_TABLES | FLAG_CONTEXT_CODE, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject block tables with an order-1 code");
+    header = (file_header) { .flags = FLAG_CONTEXT_CODE | FLAG_ANS_CODE, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject tANS with an order-1 code");
+    header = (file_header) { .flags = FLAG_ANS_CODE, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(get_file_header(header_bytes, &read_header) && read_header.flags == FLAG_ANS_CODE,
+        "get header should accept tANS on its own");
+    header = (file_header) { .flags = FLAG_WIDE_SYMBOLS | FLAG_BLOCK_TABLES, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject wide symbols with block tables");
+    header = (file_header) { .flags = FLAG_SHARED_TABLE | FLAG_CONTEXT_CODE, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject a shared table with an order-1 code");
+    header = (file_header) { .flags = FLAG_RECORDS | FLAG_SHARED_TABLE, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(get_file_header(header_bytes, &read_header) && read_header.flags == header.flags,
+        "get header should accept records with a shared table");
+    header = (file_header) { .flags = FLAG_RECORDS | FLAG_BLOCK_INDEX, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject records with a block index");
+    header = (file_header) { .flags = FLAG_RECORDS, .num_streams = 2 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject records in several streams");
+    header = (file_header) { .flags = FLAG_RECORDS | FLAG_BLOCK_CHECKSUMS, .num_streams = 1 };
+    put_file_header(&header, header_bytes);
+    assert(!get_file_header(header_bytes, &read_header), "get header should reject records with block checksums");
+
+    uint8_t code_lengths[num_symbols];
+
+    // no codes at all
+    memset(code_lengths, 0, sizeof(code_lengths));
+    test_code_lengths_round_trip(code_lengths);
+
+    // a uniform code over every symbol
+    memset(code_lengths, 8, sizeof(code_lengths));
+    test_code_lengths_round_trip(code_lengths);
+
+    // sparse, like printable text
+    memset(code_lengths, 0, sizeof(code_lengths));
+    for (int i = ' '; i < 127; i++) {
+        code_lengths[i] = 4 + i % 7;
+    }
+    test_code_lengths_round_trip(code_lengths);
+
+    srand(42);
+    for (int k = 0; k < 100; k++) {
+        for (int i = 0; i < num_symbols; i++) {
+            code_lengths[i] = rand() % 3 == 0 ? 0 : rand() % (MAX_CODE_LENGTH + 1);
+        }
+        test_code_lengths_round_trip(code_lengths);
+    }
+
+    f = tmpfile();
+    fputc(MAX_CODE_LENGTH + 1, f);
+    rewind(f);
+    assert(!read_code_lengths(code_lengths, f), "read code lengths should reject overlong codes");
+    fclose(f);
+
+    printf("test block tables\n");
+    uint8_t current_lengths[num_symbols], packed_table[num_symbols + 1], unpacked[num_symbols];
+    for (int k = 0; k < 100; k++) {
+        for (int i = 0; i < num_symbols; i++) {
+            current_lengths[i] = rand() % (MAX_CODE_LENGTH + 1);
+            // mostly small changes, some big ones
+            int length = current_lengths[i] + (rand() % 5 == 0 ? rand() % 65 - 32 : rand() % 3 - 1);
+            code_lengths[i] = length < 0 ? 0 : (length > MAX_CODE_LENGTH ? MAX_CODE_LENGTH : length);
+        }
+        size_t packed_size = pack_block_table(code_lengths, NULL, packed_table);
+        assert(packed_size <= num_symbols + 1, "a full table should be at most a byte per symbol, and one more");
+        assert(unpack_block_table(packed_table, packed_size, NULL, unpacked) && memcmp(unpacked, code_lengths, num_symbols) == 0,
+            "unpack block table should recover a full table");
+
+        packed_size = pack_block_table(code_lengths, current_lengths, packed_table);
+        assert(packed_size <= num_symbols + 1, "changes should be at most a byte per symbol, and one more");
+        assert(unpack_block_table(packed_table, packed_size, current_lengths, unpacked) && memcmp(unpacked, code_lengths, num_symbols) == 0,
+            "unpack block table should apply changes");
+        assert(!unpack_block_table(packed_table, packed_size, NULL, unpacked), "unpack block table should reject changes to no code");
+    }
+    size_t unchanged_size = pack_block_table(current_lengths, current_lengths, packed_table);
+    assert(unchanged_size == 1 + (num_symbols + 63) / 64, "no changes should be cheap");
+    memset(code_lengths, MAX_CODE_LENGTH, num_symbols);
+    size_t packed_size = pack_block_table(code_lengths, NULL, packed_table);
+    memset(current_lengths, 1, num_symbols);
+    assert(!unpack_block_table(packed_table, 0, NULL, unpacked), "unpack block table should reject an empty table");
+    packed_table[0] = 2;
+    assert(!unpack_block_table(packed_table, packed_size, current_lengths, unpacked), "unpack block table should reject an unknown kind");
+    packed_size = pack_block_table(code_lengths, current_lengths, packed_table);
+    memset(current_lengths, 2, num_symbols);
+    assert(!unpack_block_table(packed_table, packed_size, current_lengths, unpacked), 
+        "unpack block table should reject changes to overlong codes");
+
+    printf("test blocks\n");
+    f = tmpfile();
+    const char *text = "the quick brown fox jumps over the lazy dog.";
+    long frequencies[num_symbols];
+    memset(frequencies, 0, sizeof(frequencies));
+    for (int i = 0; text[i] != '\0'; i++) {
+        frequencies[(symbol)text[i]]++;
+    }
+    build_huffman_code_lengths(frequencies, code_lengths);
+    code_entry codes[num_symbols];
+    get_code_table(code_lengths, codes);
+    decode_table *table = decode_table_from_code_lengths(code_lengths);
+
+    // every prefix of the text, so some segments are empty
+    for (int num_streams = 1; num_streams <= MAX_STREAMS; num_streams++) {
+        for (int length = 1; length <= strlen(text); length++) {
+            uint8_t *block = malloc(block_bound(length, num_streams, codes));
+            size_t size = encode_block((const symbol *)text, length, codes, num_streams, NULL, 0, block);
+            assert(fwrite(block, sizeof(uint8_t), size, f) == size, "write block should succeed");
+            free(block);
+        }
+    }
+    assert(write_end_of_blocks(f), "write end of blocks should succeed");
+
+    rewind(f);
+    uint8_t *block = NULL;
+    size_t capacity = 0;
+    symbol decoded[100];
+    for (int num_streams = 1; num_streams <= MAX_STREAMS; num_streams++) {
+        for (int length = 1; length <= strlen(text); length++) {
+            long size = read_block(f, num_streams, 0, &block, &capacity);
+            assert(size > 0, "read block should succeed");
+
+            size_t decoded_length, block_size;
+            assert(parse_block_header(block, num_streams, 0, &decoded_length, &block_size), "block header should be valid");
+            assert(decoded_length == length && block_size == size, "block header should give the block's sizes");
+            assert(decode_block(block, num_streams, table, decoded), "decode block should succeed");
+            assert(memcmp(decoded, text, length) == 0, "decode block should recover the content");
+        }
+    }
+    assert(read_block(f, 1, 0, &block, &capacity) == 0, "read block should find the end of blocks");
+
+    free(block);
+
+    // a stream a byte too short
+    block = malloc(block_bound(strlen(text), 1, codes));
+    encode_block((const symbol *)text, strlen(text), codes, 1, NULL, 0, block);
+    block[block_header_size(1) - 1]--;
+    assert(!decode_block(block, 1, table, decoded), "decode block should reject a truncated stream");
+    free(block);
+
+    // a block with its own code table
+    size_t table_size = pack_block_table(code_lengths, NULL, packed_table);
+    block = malloc(block_bound(strlen(text), 4, codes));
+    size_t size = encode_block((const symbol *)text, strlen(text), codes, 4, packed_table, table_size, block);
+    size_t decoded_length, block_size;
+    assert(parse_block_header(block, 4, 0, &decoded_length, &block_size) && block_size == size, 
+        "block header should count the code table");
+    size_t read_table_size;
+    const uint8_t *read_table = get_block_table(block, 4, &read_table_size);
+    uint8_t read_lengths[num_symbols];
+    assert(unpack_block_table(read_table, read_table_size, NULL, read_lengths)
+        && memcmp(read_lengths, code_lengths, num_symbols) == 0, "block should carry its code table");
+    assert(decode_block(block, 4, table, decoded) && memcmp(decoded, text, strlen(text)) == 0, 
+        "decode block should skip the code table");
+    free(block);
+
+    // a block with a checksum
+    block = malloc(block_bound(strlen(text), 4, codes));
+    size = encode_block((const symbol *)text, strlen(text), codes, 4, packed_table, table_size, block);
+    assert(!check_block_checksum(block, (const uint8_t *)text), "a block should have no checksum until it's set");
+    set_block_checksum(block, (const uint8_t *)text, strlen(text));
+    assert(parse_block_header(block, 4, 0, &decoded_length, &block_size) && block_size == size
+        && get_block_table(block, 4, &read_table_size) != NULL && read_table_size == table_size,
+        "a checksum shouldn't change the block's sizes");
+    assert(decode_block(block, 4, table, decoded) && check_block_checksum(block, decoded),
+        "a decoded block should match its checksum");
+    decoded[strlen(text) - 1] ^= 1;
+    assert(!check_block_checksum(block, decoded), "a changed byte shouldn't match the checksum");
+    free(block);
+
+    // find blocks of lengths 10, 20, ... by their headers
+    uint8_t *blocks = malloc(5 * block_bound(strlen(text), 4, codes) + END_OF_BLOCKS_SIZE);
+    size_t blocks_size = 0;
+    uint64_t offsets[5];
+    for (int i = 0; i < 5; i++) {
+        offsets[i] = blocks_size;
+        blocks_size += encode_block((const symbol *)text, 10 * (i + 1) - 6, codes, 4, NULL, 0, blocks + blocks_size);
+    }
+    put_ulong(0, blocks + blocks_size);
+    blocks_size += END_OF_BLOCKS_SIZE;
+    uint64_t num_found;
+    block_index_entry *found = find_blocks(blocks, blocks_size, 0, 4, 0, &num_found);
+    assert(found != NULL && num_found == 5, "find blocks should find every block");
+    for (int i = 0; i < 5; i++) {
+        assert(found[i].offset == offsets[i] && found[i].length == 10 * (i + 1) - 6, 
+            "find blocks should give each block's offset and length");
+    }
+    free(found);
+    // lengths past 32 bits, which a header can hold (with tANS, which can spend less than a bit
+    // on a symbol), and ones no stream could
+    uint8_t header_bytes_64[block_header_size(4)];
+    memcpy(header_bytes_64, blocks, block_header_size(4));
+    put_ulong((uint64_t)5 << 32, header_bytes_64);
+    assert(parse_block_header(header_bytes_64, 4, FLAG_ANS_CODE, &decoded_length, &block_size)
+        && decoded_length == (uint64_t)5 << 32, "parse block header should accept a length past 32 bits");
+    put_ulong(UINT64_MAX / 2, header_bytes_64);
+    assert(!parse_block_header(header_bytes_64, 4, FLAG_ANS_CODE, &decoded_length, &block_size),
+        "parse block header should reject a length no stream could hold");
+    // a corrupt length, which the streams of a prefix code don't have a bit per symbol for
+    assert(parse_block_header(blocks, 4, 0, &decoded_length, &block_size), "block header should be valid");
+    size_t streams_bits = 8 * (block_size - block_header_size(4));
+    put_ulong(streams_bits, header_bytes_64);
+    assert(parse_block_header(header_bytes_64, 4, 0, &decoded_length, &block_size),
+        "parse block header should accept a bit per symbol");
+    put_ulong(streams_bits + 1, header_bytes_64);
+    assert(!parse_block_header(header_bytes_64, 4, 0, &decoded_length, &block_size),
+        "parse block header should reject a length with less than a bit per symbol");
+    assert(parse_block_header(header_bytes_64, 4, FLAG_WIDE_SYMBOLS, &decoded_length, &block_size),
+        "parse block header should accept a bit per two symbols when they're wide");
+    put_ulong((uint64_t)5 << 32, header_bytes_64);
+    assert(!parse_block_header(header_bytes_64, 4, 0, &decoded_length, &block_size),
+        "parse block header should reject a length past what its streams could code");
+    memcpy(blocks + offsets[2], header_bytes_64, sizeof(uint64_t));
+    assert(find_blocks(blocks, blocks_size, 0, 4, 0, &num_found) == NULL,
+        "find blocks should reject a block whose length is corrupt");
+    put_ulong(10 * 3 - 6, blocks + offsets[2]);
+    put_ulong(10, header_bytes_64);
+    put_ulong(UINT64_MAX - 1, header_bytes_64 + 2 * sizeof(uint64_t));
+    assert(!parse_block_header(header_bytes_64, 4, 0, &decoded_length, &block_size),
+        "parse block header should reject streams which don't fit");
+    assert(find_blocks(blocks, blocks_size - 1, 0, 4, 0, &num_found) == NULL, 
+        "find blocks should reject blocks without an end marker");
+    assert(find_blocks(blocks, offsets[4] + 10, 0, 4, 0, &num_found) == NULL, 
+        "find blocks should reject a cut short block");
+    free(blocks);
+    decode_table_delete(table);
+    fclose(f);
+
+    printf("test block index\n");
+    f = tmpfile();
+    fputs("header", f);
+    long blocks_offset = ftell(f);
+    fputs("some blocks", f);
+    const uint64_t num_blocks = 100;
+    block_index_entry index[num_blocks];
+    for (int i = 0; i < num_blocks; i++) {
+        index[i] = (block_index_entry) { .offset = i % 11, .length = 1000 * i };
+    }
+    long index_offset = ftell(f);
+    assert(write_block_index(index, num_blocks, index_offset, f), "write index should succeed");
+    assert(ftell(f) - index_offset == block_index_size(num_blocks), "block index size should be the bytes written");
+    fseek(f, blocks_offset, SEEK_SET);
+    uint64_t read_num_blocks;
+    block_index_entry *read_index = read_block_index(f, &read_num_blocks);
+    assert(read_index != NULL, "read index should succeed");
+    assert(ftell(f) == blocks_offset, "read index should leave the stream where it was");
+    assert(read_num_blocks == num_blocks, "read index should recover the number of blocks");
+    assert(memcmp(index, read_index, sizeof(index)) == 0, "read index should recover the entries");
+    free(read_index);
+    size_t file_size = index_offset + block_index_size(num_blocks);
+    uint8_t *file_bytes = malloc(file_size);
+    rewind(f);
+    assert(fread(file_bytes, 1, file_size, f) == file_size, "the whole file should be read back");
+    const uint8_t *located = locate_block_index(file_bytes, file_size, &read_num_blocks);
+    assert(located == file_bytes + index_offset && read_num_blocks == num_blocks,
+        "locate index should find the index in memory");
+    block_index_entry located_entry;
+    get_block_index_entry(located, 42, &located_entry);
+    assert(located_entry.offset == index[42].offset && located_entry.length == index[42].length,
+        "an entry of a located index should be the entry written");
+    assert(locate_block_index(file_bytes, file_size - 1, &read_num_blocks) == NULL,
+        "locate index should reject a cut short index");
+    free(file_bytes);
+    fclose(f);
+
+    printf("test context codes\n");
+    context_code context;
+    memset(&context, 0, sizeof(context));
+    context.num_groups = 1;
+    memset(context.code_lengths[0], 8, num_symbols);
+    test_context_code_round_trip(&context);
+    context.num_groups = 3;
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        context.group_of[c] = c < 'a' ? 0 : (c <= 'z' ? 1 : 2);
+    }
+    memset(context.code_lengths[1], 0, num_symbols);
+    for (int i = 'a'; i <= 'z'; i++) {
+        context.code_lengths[1][i] = 4 + i % 3;
+    }
+    memset(context.code_lengths[2], 0, num_symbols);
+    context.code_lengths[2][' '] = 1;
+    test_context_code_round_trip(&context);
+
+    uint8_t packed_context[MAX_PACKED_CONTEXT_CODE];
+    size_t packed_context_size = pack_context_code(&context, packed_context);
+    context_code read_context;
+    packed_context[0] = MAX_CONTEXT_GROUPS + 1;
+    assert(!unpack_context_code(packed_context, packed_context_size, &read_context), "unpack should reject too many groups");
+    packed_context[0] = 2;
+    assert(!unpack_context_code(packed_context, packed_context_size, &read_context), "unpack should reject contexts in missing groups");
+    packed_context[0] = 0;
+    assert(!unpack_context_code(packed_context, packed_context_size, &read_context), "unpack should reject no groups");
+
+    printf("test ans counts\n");
+    uint16_t counts[num_symbols];
+    memset(counts, 0, sizeof(counts));
+    counts[0] = ANS_TABLE_SIZE;
+    test_ans_counts_round_trip(counts);
+    // every symbol, with counts of one byte and of two, and runs of zeros
+    int sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        counts[i] = 1 + i % 3;
+        sum += counts[i];
+    }
+    counts[' '] += ANS_TABLE_SIZE - sum;
+    test_ans_counts_round_trip(counts);
+    for (int i = 0; i < num_symbols; i++) {
+        counts[i] = i >= 'a' && i < 'a' + 16 ? ANS_TABLE_SIZE / 16 : 0;
+    }
+    test_ans_counts_round_trip(counts);
+
+    uint8_t packed_counts[MAX_PACKED_ANS_COUNTS];
+    size_t packed_counts_size = pack_ans_counts(counts, packed_counts);
+    uint16_t read_counts[num_symbols];
+    counts['a']--;
+    counts['b']++;
+    assert(unpack_ans_counts(packed_counts, packed_ans_counts_size(packed_counts, sizeof(packed_counts)), read_counts),
+        "unpack should accept other counts with the right sum");
+    counts['b']++;
+    packed_counts_size = pack_ans_counts(counts, packed_counts);
+    assert(!unpack_ans_counts(packed_counts, packed_counts_size, read_counts), "unpack should reject counts with the wrong sum");
+
+    printf("test wide code lengths\n");
+    uint8_t *wide_lengths = calloc(NUM_WIDE_SYMBOLS, 1);
+    test_wide_code_lengths_round_trip(wide_lengths);
+    // gaps of one, two and three bytes, at the start and the end
+    wide_lengths[0] = 1;
+    wide_lengths[0x7f + 1] = 3;
+    wide_lengths[0x7f + 1 + 0x80 + 1] = 3;
+    wide_lengths[0x7f + 1 + 0x80 + 1 + 0x3fff + 1] = 2;
+    wide_lengths[NUM_WIDE_SYMBOLS - 1] = 3;
+    test_wide_code_lengths_round_trip(wide_lengths);
+    // every symbol
+    memset(wide_lengths, 16, NUM_WIDE_SYMBOLS);
+    test_wide_code_lengths_round_trip(wide_lengths);
+    // every third symbol
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        wide_lengths[i] = i % 3 == 0 ? 12 : 0;
+    }
+    test_wide_code_lengths_round_trip(wide_lengths);
+
+    uint8_t *packed_wide = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+    memset(wide_lengths, 0, NUM_WIDE_SYMBOLS);
+    wide_lengths[5] = MAX_CODE_LENGTH + 1;
+    size_t packed_wide_size = pack_wide_code_lengths(wide_lengths, packed_wide);
+    assert(!unpack_wide_code_lengths(packed_wide, packed_wide_size, wide_lengths), "unpack should reject too long a length");
+    wide_lengths[5] = 0;
+    wide_lengths[NUM_WIDE_SYMBOLS - 1] = 1;
+    packed_wide_size = pack_wide_code_lengths(wide_lengths, packed_wide);
+    put_uint(2, packed_wide);
+    packed_wide[packed_wide_size++] = 0;
+    packed_wide[packed_wide_size++] = 1;
+    assert(!unpack_wide_code_lengths(packed_wide, packed_wide_size, wide_lengths), "unpack should reject a symbol past the end");
+    put_uint(NUM_WIDE_SYMBOLS + 1, packed_wide);
+    assert(packed_wide_code_lengths_size(packed_wide, packed_wide_size) == 0, "packed size should reject too many symbols");
+    free(packed_wide);
+    free(wide_lengths);
+
+    printf("test table files\n");
+    for (int i = 0; i < num_symbols; i++) {
+        code_lengths[i] = i < 128 ? 8 : 9 + (i - 128) / 64;
+    }
+    code_lengths[0] = 7;
+    code_lengths[1] = 7;
+    code_lengths[128] = 8;
+    code_lengths[129] = 8;
+    f = tmpfile();
+    assert(write_table_file(code_lengths, f), "write table file should succeed");
+    rewind(f);
+    uint8_t table_lengths[num_symbols];
+    uint32_t id;
+    assert(read_table_file(table_lengths, &id, f), "read table file should succeed");
+    assert(memcmp(table_lengths, code_lengths, num_symbols) == 0 && id == table_id(code_lengths),
+        "a table file should keep its lengths and ID");
+    fputc(0, f);
+    rewind(f);
+    assert(!read_table_file(table_lengths, &id, f), "read table file should reject bytes past its end");
+    fclose(f);
+    uint8_t table_file[MAX_TABLE_FILE_SIZE];
+    size_t table_file_size = pack_table_file(code_lengths, table_file);
+    table_file[5] ^= 1;
+    assert(!unpack_table_file(table_file, table_file_size, table_lengths, &id), "unpack table file should reject a wrong ID");
+    table_file[5] ^= 1;
+    table_file[0] = 'X';
+    assert(!unpack_table_file(table_file, table_file_size, table_lengths, &id), "unpack table file should reject a bad magic number");
+    code_lengths[1] = 0;
+    code_lengths[2] = 6;
+    table_file_size = pack_table_file(code_lengths, table_file);
+    assert(!unpack_table_file(table_file, table_file_size, table_lengths, &id),
+        "unpack table file should reject a symbol without a code");
+
+    printf("test records headers\n");
+    assert(record_field_size(UINT32_MAX, 100) == sizeof(uint32_t), "records up to 4 GiB should have 32 bit fields");
+    assert(record_field_size(100, (uint64_t)UINT32_MAX + 1) == sizeof(uint64_t),
+        "records over 4 GiB should have 64 bit fields");
+    records_header records = { .num_records = 3, .decoded_size = 1ull << 33, .encoded_size = 5, .field_size = 8 };
+    uint8_t records_bytes[RECORDS_HEADER_SIZE];
+    put_records_header(&records, records_bytes);
+    records_header read_records;
+    assert(get_records_header(records_bytes, &read_records) && read_records.num_records == 3
+        && read_records.decoded_size == records.decoded_size && read_records.encoded_size == 5
+        && read_records.field_size == 8, "a records header should round trip");
+    assert(record_index_size(&read_records) == 3 * 16, "an index should have two fields per record");
+    records_bytes[RECORDS_HEADER_SIZE - 1] = 2;
+    assert(!get_records_header(records_bytes, &read_records), "get records header should reject a bad field size");
+    for (int field_size = 4; field_size <= 8; field_size += 4) {
+        record_entry entry = { .offset = 123456, .length = 7 }, read_entry;
+        uint8_t entry_bytes[16];
+        put_record_entry(&entry, field_size, entry_bytes);
+        get_record_entry(entry_bytes, field_size, &read_entry);
+        assert(read_entry.offset == entry.offset && read_entry.length == entry.length,
+            "a record entry should round trip");
+    }
+
+    f = tmpfile();
+    fputs("not an index", f);
+    assert(read_block_index(f, &read_num_blocks) == NULL, "read index should reject garbage");
+    fclose(f);
+
+    return 0;
+}
@@ -96,14 +96,21 @@ heap *heap_from_array(void **elements, int length, element_cmp cmp) {
     for (int i = 0; i < length; i++) {
         h->elements[i] = elements[i]; // shallow copy
     }
+    heap_init_in_place(h, h->elements, length, length, cmp);
+
+    return h;
+}
+
+void heap_init_in_place(heap *h, void **elements, int length, int capacity, element_cmp cmp) {
+    h->elements = elements;
     h->count = length;
+    h->capacity = capacity;
+    h->want_first_above = cmp;
 
     // heapify
     for (int i = h->count - 1; i >= 0; i--) {
         swap_down(h, i);
     }
-
-    return h;
 }
 
 void *heap_pop_top(heap *h) {
@@ -26,6 +26,9 @@ void heap_delete_only(heap *);
 void heap_delete_and_elements(heap *, void (*delete_element)(void *));
 
 heap *heap_from_array(void **, int length, element_cmp cmp);
+// form a heap of the first `length` elements of an array, using it as the heap's storage,
+// so it needs no allocation (or deleting). it mustn't grow past `capacity` elements
+void heap_init_in_place(heap *, void **elements, int length, int capacity, element_cmp cmp);
 
 void *heap_pop_top(heap *);
 
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "heap.h"
 #include "assert.h"
@@ -50,6 +51,12 @@ int main() {
     assert(h->count == n, 
     "result from heap_from_array should have correct number of elements");
 
+    // a heap in storage of our own
+    void **storage = malloc(sizeof(void *) * n);
+    memcpy(storage, a, sizeof(void *) * n);
+    heap h3;
+    heap_init_in_place(&h3, storage, n, n, ge);
+
     qsort(a, n, sizeof(element *), rcmp);
 
     for (int i = 1; i < n; i++) {
@@ -68,6 +75,10 @@ int main() {
         void *top2 = heap_pop_top(h2);
         assert(key_equals(top2, (void *)a[i]),
             "pop top (after heapify) should return next largest");
+
+        void *top3 = heap_pop_top(&h3);
+        assert(key_equals(top3, (void *)a[i]),
+            "pop top (in place) should return next largest");
     }
 
     assert(h->count == 0, "insert then pop same amount should leave heap empty");
@@ -78,6 +89,7 @@ int main() {
     // now empty
     heap_delete_only(h);
     heap_delete_only(h2);
+    free(storage);
     for (int i = 0; i < n; i++) {
         free(a[i]);
     }
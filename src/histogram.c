@@ -0,0 +1,62 @@
+
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "huffman.h"
+
+// counting into one table stalls when the same byte repeats, since each
+// increment has to wait for the last one to be stored before loading it again.
+// spreading consecutive bytes over several tables lets those increments overlap
+#define NUM_TABLES 4
+
+// each table sees a quarter of a chunk, so its 32 bit counters can't overflow
+static const size_t max_chunk_length = (size_t)1 << 32;
+
+static void histogram_chunk(const symbol *data, size_t length, long *symbol_frequencies) {
+    uint32_t counts[NUM_TABLES][256];
+    memset(counts, 0, sizeof(counts));
+
+    size_t i = 0;
+    // 8 bytes at a time, 2 into each table
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+
+        counts[0][(word      ) & 0xff]++;
+        counts[1][(word >>  8) & 0xff]++;
+        counts[2][(word >> 16) & 0xff]++;
+        counts[3][(word >> 24) & 0xff]++;
+        counts[0][(word >> 32) & 0xff]++;
+        counts[1][(word >> 40) & 0xff]++;
+        counts[2][(word >> 48) & 0xff]++;
+        counts[3][(word >> 56)       ]++;
+    }
+    for (; i < length; i++) {
+        counts[0][data[i]]++;
+    }
+
+    for (int s = 0; s < 256; s++) {
+        symbol_frequencies[s] += (long)counts[0][s] + counts[1][s] + counts[2][s] + counts[3][s];
+    }
+}
+
+void histogram(const symbol *data, size_t length, long *symbol_frequencies) {
+    while (length > max_chunk_length) {
+        histogram_chunk(data, max_chunk_length, symbol_frequencies);
+        data += max_chunk_length;
+        length -= max_chunk_length;
+    }
+    histogram_chunk(data, length, symbol_frequencies);
+}
+
+void wide_histogram(const uint8_t *data, size_t length, long *symbol_frequencies) {
+    // (several tables of 2^16 counters wouldn't stay in cache, so increment them directly)
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        symbol_frequencies[data[i] | data[i + 1] << 8]++;
+    }
+    if (i < length) {
+        symbol_frequencies[data[i]]++;
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "huffman.h"
+
+// add the number of times each symbol appears in `data` to `symbol_frequencies`
+void histogram(const symbol *data, size_t length, long *symbol_frequencies);
+// the same for the wide symbols of `length` bytes (see huffman.h), into NUM_WIDE_SYMBOLS frequencies
+void wide_histogram(const uint8_t *data, size_t length, long *symbol_frequencies);
+
+#endif // HISTOGRAM_H
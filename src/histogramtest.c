@@ -0,0 +1,69 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "histogram.h"
+
+void test_matches_naive_count(const symbol *data, size_t length) {
+    long expected[num_symbols];
+    memset(expected, 0, sizeof(expected));
+    for (size_t i = 0; i < length; i++) {
+        expected[data[i]]++;
+    }
+
+    // histogram adds to existing counts
+    long counts[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        counts[i] = i;
+    }
+    histogram(data, length, counts);
+    for (int i = 0; i < num_symbols; i++) {
+        assert(counts[i] == expected[i] + i, "histogram should add the number of each symbol");
+    }
+}
+
+void test_wide_matches_naive_count(const uint8_t *data, size_t length) {
+    long *expected = calloc(NUM_WIDE_SYMBOLS, sizeof(long));
+    for (size_t i = 0; i < length; i += 2) {
+        expected[data[i] | (i + 1 < length ? data[i + 1] << 8 : 0)]++;
+    }
+    long *counts = calloc(NUM_WIDE_SYMBOLS, sizeof(long));
+    wide_histogram(data, length, counts);
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        assert(counts[i] == expected[i], "wide histogram should count pairs, and a lone last byte");
+    }
+    free(expected);
+    free(counts);
+}
+
+int main() {
+    const size_t n = 100003;
+    symbol *data = malloc(sizeof(symbol) * n);
+
+    printf("test random bytes\n");
+    srand(42);
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand();
+    }
+    // every length mod 8, to check the unrolled loop's remainder
+    for (size_t length = 0; length < 20; length++) {
+        test_matches_naive_count(data, length);
+    }
+    test_matches_naive_count(data, n);
+    test_matches_naive_count(data + 3, n - 3);
+
+    printf("test wide symbols\n");
+    for (size_t length = 0; length < 5; length++) {
+        test_wide_matches_naive_count(data, length);
+    }
+    test_wide_matches_naive_count(data, n);
+
+    printf("test a single repeated byte\n");
+    memset(data, 'x', n);
+    test_matches_naive_count(data, n);
+
+    free(data);
+    return 0;
+}
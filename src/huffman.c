@@ -11,309 +11,1121 @@
 const size_t symbol_bitsize = 8;
 const size_t num_symbols = 1 << 8;
 
-bool is_leaf(const tree_node *t) {
-    return t->left == NULL && t->right == NULL;
-}
+// 2^11 entries of 4 bytes: small enough to stay in L1 cache
+const int primary_table_bits = 11;
+const int subtable_bits = 8;
 
-// free all nodes in a tree
-void tree_delete(tree_node *t) {
-    if (t->left != NULL) tree_delete(t->left);
-    if (t->right != NULL) tree_delete(t->right);
-    free(t);
+static bool is_leaf(const tree_node *t) {
+    return t->left == NO_NODE && t->right == NO_NODE;
 }
 
-// returns true if every node has 0 or 2 children, 
-// and all parent pointers (excluding the root's) are correct
-bool is_valid_tree(const tree_node *t) {
-    if (t->left != NULL && t->right != NULL) {
-        return t->left->parent == t
-            && t->right->parent == t
-            && is_valid_tree(t->left)
-            && is_valid_tree(t->right);
-    }
-    return t->left == NULL && t->right == NULL;
+// add a node to the tree (as the parent of its children, if any), returning its index
+static node_index add_node(huffman_tree *tree, node_index left, node_index right, symbol symbol) {
+    node_index i = tree->num_nodes++;
+    tree->nodes[i] = (tree_node) {
+        .parent = NO_NODE,
+        .left = left,
+        .right = right,
+        .symbol = symbol
+    };
+    if (left != NO_NODE) tree->nodes[left].parent = i;
+    if (right != NO_NODE) tree->nodes[right].parent = i;
+    return i;
 }
 
-bool has_lower_frequency(const void *a, const void *b) {
-    tree_node *nodeA = (tree_node *)a;
-    tree_node *nodeB = (tree_node *)b;
-
-    return nodeA->total_frequency < nodeB->total_frequency;
+// the heap holds pointers to nodes' total frequencies
+static bool has_lower_frequency(const void *a, const void *b) {
+    return *(const long *)a < *(const long *)b;
 }
 
 // if tree has a single node, add another leaf, to make a valid prefix code
-tree_node *ensure_not_singleton_tree(tree_node *tree) {
-    if (!is_leaf(tree)) {
-        return tree;
+static void ensure_not_singleton_tree(huffman_tree *tree) {
+    if (tree->root == NO_NODE || !is_leaf(&tree->nodes[tree->root])) {
+        return;
     }
 
-    tree_node *dummy_leaf = malloc(sizeof(tree_node));
-    dummy_leaf->left = NULL;
-    dummy_leaf->right = NULL;
-
-    // make sure it doesn't have the same symbol as `tree`
+    // make sure it doesn't have the same symbol as the root
     const symbol def = 1, alt = 2;
-    dummy_leaf->symbol = tree->symbol == def ? alt : def;
+    symbol dummy_symbol = tree->nodes[tree->root].symbol == def ? alt : def;
+    node_index dummy_leaf = add_node(tree, NO_NODE, NO_NODE, dummy_symbol);
 
-    tree_node *parent = malloc(sizeof(tree_node));
-    *parent = (tree_node) {
-        .parent = NULL,
-        .left = tree,
-        .right = dummy_leaf
-    };
-
-    tree->parent = parent;
-    dummy_leaf->parent = parent;
-
-    return parent;
+    tree->root = add_node(tree, tree->root, dummy_leaf, 0);
 }
 
 // builds a tree for a prefix code over the symbols with nonzero frequency
-tree_node *build_tree_bottom_up(const long *symbol_frequencies, bool (*merge_heuristic)(const void *, const void *)) {
+static void build_tree_bottom_up(const long *symbol_frequencies, bool (*merge_heuristic)(const void *, const void *),
+                                 huffman_tree *tree) {
+    tree->num_nodes = 0;
+    tree->root = NO_NODE;
+
+    // each node's total frequency.
+    // the heap holds pointers into this, whose offsets are the nodes
+    long total_frequencies[MAX_TREE_NODES];
+    void *trees[num_symbols];
 
     int num_present_symbols = 0;
     for (int i = 0; i < num_symbols; i++) {
         if (symbol_frequencies[i] > 0) {
-            num_present_symbols++;
+            node_index leaf = add_node(tree, NO_NODE, NO_NODE, (symbol)i);
+            total_frequencies[leaf] = symbol_frequencies[i];
+            trees[num_present_symbols++] = &total_frequencies[leaf];
         }
     }
-    if (num_present_symbols == 0) return NULL;
+    if (num_present_symbols == 0) return;
 
-    tree_node **trees = malloc(sizeof(tree_node) * num_present_symbols);
+    // (merging never grows the heap, so it fits where the leaves are)
+    heap h;
+    heap_init_in_place(&h, trees, num_present_symbols, num_present_symbols, merge_heuristic);
 
-    for (int i = 0, j = 0; i < num_symbols; i++) {
-        if (symbol_frequencies[i] > 0) {
-            trees[j] = malloc(sizeof(tree_node));
-            *trees[j] = (tree_node) {
-                .parent = NULL,
-                .left = NULL,
-                .right = NULL,
-                .total_frequency = symbol_frequencies[i],
-                .symbol = (symbol) i
-            };
-            j++;
-        }
-    }
-
-    heap *h = heap_from_array((void **)trees, num_present_symbols, merge_heuristic);
-
-    while (h->count > 1) {
-        tree_node *t1 = heap_pop_top(h);
-        tree_node *t2 = heap_pop_top(h);
-
-        tree_node *combined = malloc(sizeof(tree_node));
-        *combined = (tree_node) {
-            .parent = NULL,
-            .left = t1,     // TODO: which order ?
-            .right = t2,
-            .total_frequency = t1->total_frequency + t2->total_frequency,
-            .symbol = (symbol) 0  // nothing (not a leaf)
-        };
+    while (h.count > 1) {
+        long *t1 = heap_pop_top(&h);
+        long *t2 = heap_pop_top(&h);
 
-        t1->parent = combined;
-        t2->parent = combined;
-        
-        heap_insert(h, combined);
-    }
+        // TODO: which order ?
+        node_index combined = add_node(tree, t1 - total_frequencies, t2 - total_frequencies, 0);
+        total_frequencies[combined] = *t1 + *t2;
 
-    tree_node *code_tree = heap_pop_top(h);
+        heap_insert(&h, &total_frequencies[combined]);
+    }
 
-    heap_delete_only(h);
-    free(trees);
+    tree->root = (long *)heap_pop_top(&h) - total_frequencies;
 
-    return ensure_not_singleton_tree(code_tree);
+    ensure_not_singleton_tree(tree);
 }
 
 // build a prefix code where more common symbols have shorter codes
-tree_node *build_huffman_tree(const long *symbol_frequencies) {
-    return build_tree_bottom_up(symbol_frequencies, has_lower_frequency);
+void build_huffman_tree(const long *symbol_frequencies, huffman_tree *tree) {
+    build_tree_bottom_up(symbol_frequencies, has_lower_frequency, tree);
 }
 
 // build a prefix code where (present) symbols have (almost) uniform code length
-tree_node *build_uniform_tree(const long *symbol_frequencies) {
-    
+void build_uniform_tree(const long *symbol_frequencies, huffman_tree *tree) {
+    tree->num_nodes = 0;
+    tree->root = NO_NODE;
+
     // include symbols which appear at least once
+    symbol present_symbols[num_symbols];
     int num_present_symbols = 0;
     for (int i = 0; i < num_symbols; i++) {
         if (symbol_frequencies[i] > 0) {
-            num_present_symbols++;
-        }
-    }
-    symbol *present_symbols = malloc(sizeof(symbol) * num_present_symbols);
-    for (int i = 0, j = 0; i < num_symbols && j < num_present_symbols; i++) {
-        if (symbol_frequencies[i] > 0) {
-            present_symbols[j++] = (symbol)i;
+            present_symbols[num_present_symbols++] = (symbol)i;
         }
     }
+    if (num_present_symbols == 0) return;
 
-    // build tree with one leaf per present symbol
+    // build tree with one leaf per present symbol, laid out like a heap:
+    // node i has children 2i + 1 and 2i + 2, and the last nodes are the leaves
     int num_nodes = 2 * num_present_symbols - 1;
-    tree_node **nodes = malloc(sizeof(tree_node *) * num_nodes);
+    int first_leaf_index = num_nodes - num_present_symbols;
     for (int i = 0; i < num_nodes; i++) {
-        nodes[i] = malloc(sizeof(tree_node));
+        bool is_leaf = i >= first_leaf_index;
+        tree->nodes[i] = (tree_node) {
+            .parent = i == 0 ? NO_NODE : (i - 1) / 2,
+            .left = is_leaf ? NO_NODE : 2 * i + 1,
+            .right = is_leaf ? NO_NODE : 2 * i + 2,
+            .symbol = is_leaf ? present_symbols[i - first_leaf_index] : 0
+        };
     }
+    tree->num_nodes = num_nodes;
+    tree->root = 0;
 
-    int first_leaf_index = num_nodes - num_present_symbols;    
-    for (int i = 0; i < num_nodes; i++) {
-        bool is_leaf = i >= first_leaf_index;
+    ensure_not_singleton_tree(tree);
+}
 
-        nodes[i]->parent = i == 0 ? NULL : nodes[(i - 1) / 2];
-        if (is_leaf) {
-            nodes[i]->left = NULL;
-            nodes[i]->right = NULL;
-            nodes[i]->symbol = present_symbols[i - first_leaf_index];
-        }else {
-            nodes[i]->left  = nodes[2 * i + 1];
-            nodes[i]->right = nodes[2 * i + 2];
+bool get_codes_from_tree(const huffman_tree *tree, code_entry *table) {
+    memset(table, 0, sizeof(code_entry) * num_symbols);
+
+    for (int i = 0; i < tree->num_nodes; i++) {
+        const tree_node *leaf = &tree->nodes[i];
+        if (!is_leaf(leaf) || i == tree->root) continue;
+
+        // the path up from the leaf gives the code's bits, last first
+        uint32_t bits = 0;
+        int length = 0;
+        for (node_index child = i; child != tree->root; child = tree->nodes[child].parent) {
+            if (length == MAX_CODE_LENGTH) {
+                return false;
+            }
+            bits |= (uint32_t)(tree->nodes[tree->nodes[child].parent].right == child) << length;
+            length++;
+        }
+        table[leaf->symbol] = (code_entry) { .bits = bits, .length = length };
+    }
+    return true;
+}
+
+bool get_tree_from_codes(const code_entry *table, huffman_tree *tree) {
+    tree->num_nodes = 0;
+    tree->root = add_node(tree, NO_NODE, NO_NODE, 0);
+
+    for (int i = 0; i < num_symbols; i++) {
+        if (table[i].length == 0) continue; // don't insert symbols with no code
+
+        node_index current = tree->root;
+        for (int k = table[i].length - 1; k >= 0; k--) {
+            tree_node *node = &tree->nodes[current];
+            node_index *childp = (table[i].bits >> k) & 1 ? &node->right : &node->left;
+
+            if (*childp == NO_NODE) {
+                if (tree->num_nodes == MAX_TREE_NODES) {
+                    return false;
+                }
+                node_index child = add_node(tree, NO_NODE, NO_NODE, 0);
+                tree->nodes[child].parent = current;
+                *childp = child;
+            }
+            current = *childp;
         }
+
+        // end of code path: symbol lives here
+        tree->nodes[current].symbol = (symbol)i;
     }
+    return true;
+}
 
-    free(present_symbols);
+// assign each symbol with a nonzero length the next code of that length,
+// in order of (length, symbol), as in DEFLATE (RFC 1951, 3.2.2).
+// (`n` symbols of them). returns false if the lengths are too long, or oversubscribe the code space
+static bool assign_canonical_codes(const uint8_t *code_lengths, size_t n, uint32_t *codes) {
+    long length_counts[MAX_CODE_LENGTH + 1] = {0};
+    uint64_t kraft_sum = 0; // in units of 2^-MAX_CODE_LENGTH
+    for (size_t i = 0; i < n; i++) {
+        if (code_lengths[i] > MAX_CODE_LENGTH) {
+            return false;
+        }
+        if (code_lengths[i] > 0) {
+            length_counts[code_lengths[i]]++;
+            kraft_sum += (uint64_t)1 << (MAX_CODE_LENGTH - code_lengths[i]);
+        }
+    }
+    if (kraft_sum > (uint64_t)1 << MAX_CODE_LENGTH) {
+        return false;
+    }
 
-    tree_node *tree = nodes[0];
-    free(nodes);
-    return ensure_not_singleton_tree(tree);
+    uint64_t next_code[MAX_CODE_LENGTH + 1];
+    uint64_t code = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+        code = (code + length_counts[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = code_lengths[i] == 0 ? 0 : next_code[code_lengths[i]]++;
+    }
+    return true;
 }
 
-void delete_codes(bitstring **codes) {
+bool get_code_table(const uint8_t *code_lengths, code_entry *table) {
+    uint32_t codes[num_symbols];
+    if (!assign_canonical_codes(code_lengths, num_symbols, codes)) {
+        return false;
+    }
     for (int i = 0; i < num_symbols; i++) {
-        bitstring_delete(codes[i]);
+        table[i] = (code_entry) {
+            .bits = codes[i],
+            .length = code_lengths[i]
+        };
     }
-    free(codes);
+    return true;
+}
+
+// the number of edges from a node up to the root
+static int node_depth(const huffman_tree *tree, node_index i) {
+    int depth = 0;
+    for (; i != tree->root; i = tree->nodes[i].parent) {
+        depth++;
+    }
+    return depth;
 }
 
-bitstring **get_codes_from_tree(const tree_node *tree) {
+void get_code_lengths_from_tree(const huffman_tree *tree, uint8_t *code_lengths) {
+    memset(code_lengths, 0, sizeof(uint8_t) * num_symbols);
+    for (int i = 0; i < tree->num_nodes; i++) {
+        if (is_leaf(&tree->nodes[i]) && i != tree->root) {
+            code_lengths[tree->nodes[i].symbol] = node_depth(tree, i);
+        }
+    }
+}
 
-    // NULL for symbols without a code
-    bitstring **symbol_codes = calloc(num_symbols, sizeof(bitstring *));
+typedef struct {
+    long frequency;
+    symbol symbol;
+} weighted_symbol;
 
-    const tree_node *current = tree;
-    
-    // tracks path from root to current
-    // false=left, true=right
-    bitstring *current_code = bitstring_new_empty();
+// the symbols with nonzero frequency, in order, returning how many there are
+static int present_leaves(const long *symbol_frequencies, weighted_symbol *leaves, long *max_frequency) {
+    int n = 0;
+    *max_frequency = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        if (symbol_frequencies[i] > 0) {
+            leaves[n++] = (weighted_symbol) { .frequency = symbol_frequencies[i], .symbol = (symbol)i };
+            if (symbol_frequencies[i] > *max_frequency) *max_frequency = symbol_frequencies[i];
+        }
+    }
+    return n;
+}
 
-    // TODO: keeping code & current in sync is error prone, find a better solution
-    while (true) {
-        // DOWN (to first in this subtree)
-        while (current->left != NULL) {
-            bitstring_append(current_code, false);
-            current = current->left;
+// sort leaves by frequency, keeping those of equal frequency in the order they're in.
+// a radix sort, a byte of the frequencies at a time, for only as many bytes as the largest has:
+// with few enough leaves to sort on the stack, this beats comparing them
+static void sort_by_frequency(weighted_symbol *leaves, int n, long max_frequency) {
+    weighted_symbol sorted[num_symbols];
+    weighted_symbol *from = leaves, *to = sorted;
+    for (int shift = 0; shift < 64 && (max_frequency >> shift) > 0; shift += 8) {
+        int starts[1 << 8];
+        memset(starts, 0, sizeof(starts));
+        for (int i = 0; i < n; i++) {
+            starts[(from[i].frequency >> shift) & 0xff]++;
         }
-        // now at a symbol
-        symbol_codes[current->symbol] = bitstring_copy(current_code);
+        for (int b = 0, start = 0; b < 1 << 8; b++) {
+            int count = starts[b];
+            starts[b] = start;
+            start += count;
+        }
+        for (int i = 0; i < n; i++) {
+            to[starts[(from[i].frequency >> shift) & 0xff]++] = from[i];
+        }
+        weighted_symbol *t = from;
+        from = to;
+        to = t;
+    }
+    if (from != leaves) {
+        memcpy(leaves, from, sizeof(weighted_symbol) * n);
+    }
+}
+
+// the optimal lengths (into `lengths`) of codes for `n` weights in increasing order, with none longer
+// than `max_code_length` (which they must fit in), found by the package-merge algorithm
+// (Larmore & Hirschberg, 1990). the caller provides space for its lists: `is_leaf_item` with
+// max_code_length * 2n entries, and `list_weights` with 2 * 2n
+static void package_merge(const long *weights, int n, int max_code_length, 
+                          bool *is_leaf_item, long *list_weights, long *lengths) {
+    // the list for each level (deepest first) is the leaves merged with
+    // packages (adjacent pairs) of the level below, in order of weight.
+    // packages are made in order so only remember which items are leaves
+    const int max_items = 2 * n;
+    int num_items[max_code_length];
+    long *levels_weights[2] = { list_weights, list_weights + max_items };
+
+    for (int i = 0; i < n; i++) {
+        levels_weights[(max_code_length - 1) % 2][i] = weights[i];
+        is_leaf_item[(max_code_length - 1) * max_items + i] = true;
+    }
+    num_items[max_code_length - 1] = n;
 
-        // UP (get out of this subtree)
-        while (true) {
-            current = current->parent;
-            bool dir = bitstring_pop(current_code);
-            if (!dir) { // popped a zero -> exited a left subtree
-                break;
+    for (int level = max_code_length - 2; level >= 0; level--) {
+        const long *below = levels_weights[(level + 1) % 2];
+        long *merged = levels_weights[level % 2];
+        bool *is_leaf = is_leaf_item + level * max_items;
+        int num_packages = num_items[level + 1] / 2;
+
+        int l = 0, p = 0, k = 0;
+        while (l < n || p < num_packages) {
+            long package_weight = p < num_packages ? below[2 * p] + below[2 * p + 1] : 0;
+            if (p == num_packages || (l < n && weights[l] <= package_weight)) {
+                merged[k] = weights[l++];
+                is_leaf[k++] = true;
+            }else {
+                merged[k] = package_weight;
+                is_leaf[k++] = false;
+                p++;
             }
-            if (current->parent == NULL) { // read root from right subtree -> done
-                bitstring_delete(current_code);
-                return symbol_codes;
+        }
+        num_items[level] = k;
+    }
+
+    // the first 2n - 2 items of the top list make an optimal code.
+    // each leaf's code length is the number of levels it's chosen in,
+    // where the packages chosen at one level choose the items they're made of below
+    memset(lengths, 0, sizeof(long) * n);
+    int num_chosen = 2 * n - 2;
+    for (int level = 0; level < max_code_length && num_chosen > 0; level++) {
+        int num_packages = 0;
+        for (int k = 0, l = 0; k < num_chosen; k++) {
+            if (is_leaf_item[level * max_items + k]) {
+                lengths[l++]++;
+            }else {
+                num_packages++;
             }
         }
+        num_chosen = 2 * num_packages;
+    }
+}
+
+// the optimal code lengths with none longer than `max_code_length`, by package-merge.
+// returns false if there are too many present symbols to fit in that length
+bool build_length_limited_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths) {
+    memset(code_lengths, 0, sizeof(uint8_t) * num_symbols);
+    if (max_code_length > MAX_CODE_LENGTH) {
+        max_code_length = MAX_CODE_LENGTH;
+    }
+
+    weighted_symbol leaves[num_symbols];
+    long max_frequency;
+    int n = present_leaves(symbol_frequencies, leaves, &max_frequency);
+    if (n == 0) return true;
+    if (n == 1) {
+        code_lengths[leaves[0].symbol] = 1;
+        return true;
+    }
+    if (max_code_length < 1 || (max_code_length < 31 && n > 1 << max_code_length)) {
+        return false;
+    }
+    sort_by_frequency(leaves, n, max_frequency);
+
+    long weights[n];
+    for (int i = 0; i < n; i++) {
+        weights[i] = leaves[i].frequency;
+    }
+    bool is_leaf_item[max_code_length * 2 * n];
+    long list_weights[2 * 2 * n];
+    long lengths[n];
+    package_merge(weights, n, max_code_length, is_leaf_item, list_weights, lengths);
+    for (int i = 0; i < n; i++) {
+        code_lengths[leaves[i].symbol] = lengths[i];
+    }
+
+    return true;
+}
+
+// replace `n` (at least 2) weights, in increasing order, with the lengths of an optimal code for them,
+// in place (Moffat & Katajainen, 1995): first merging them into a tree whose internal nodes
+// each point to their parent, then finding the nodes' depths, then the leaves'
+static void minimum_redundancy_lengths(long *a, long n) {
+    long root = 0, leaf = 0;
+    for (long next = 0; next < n - 1; next++) {
+        // each internal node is the two lightest of the leaves and internal nodes left
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] = a[root];
+            a[root++] = next;
+        }else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        }else {
+            a[next] += a[leaf++];
+        }
+    }
 
-        // finished exploring left subtree of current,
-        // now explore right subtree
-        current = current->right;
-        bitstring_append(current_code, true);
+    a[n - 2] = 0;
+    for (long next = n - 3; next >= 0; next--) {
+        a[next] = a[a[next]] + 1;
+    }
 
+    // at each depth, the nodes which aren't internal are leaves, the heaviest first
+    long available = 1, used = 0, depth = 0;
+    long next = n - 1;
+    root = n - 2;
+    while (available > 0) {
+        while (root >= 0 && a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (available > used) {
+            a[next--] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
     }
 }
 
-tree_node *get_tree_from_codes(const bitstring **symbol_codes) {
+// the lengths of a huffman code, from which we derive a canonical code.
+// they're found without building its tree (or a heap to build it with):
+// the present symbols are sorted by frequency, then merged in place, all on the stack
+void build_huffman_code_lengths(const long *symbol_frequencies, uint8_t *code_lengths) {
+    memset(code_lengths, 0, sizeof(uint8_t) * num_symbols);
 
-    tree_node *root = malloc(sizeof(tree_node));
-    *root = (tree_node) {
-        .parent = NULL,
-        .left = NULL,
-        .right = NULL,
-        .symbol = 0,
-    };
+    weighted_symbol leaves[num_symbols];
+    long max_frequency;
+    int n = present_leaves(symbol_frequencies, leaves, &max_frequency);
+    if (n == 0) return;
+    if (n == 1) {
+        code_lengths[leaves[0].symbol] = 1;
+        return;
+    }
+    sort_by_frequency(leaves, n, max_frequency);
+
+    long lengths[num_symbols];
+    for (int i = 0; i < n; i++) {
+        lengths[i] = leaves[i].frequency;
+    }
+    minimum_redundancy_lengths(lengths, n);
+    if (lengths[0] > MAX_CODE_LENGTH) {
+        // too deep to store, only happens for very skewed frequencies
+        build_length_limited_code_lengths(symbol_frequencies, MAX_CODE_LENGTH, code_lengths);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        code_lengths[leaves[i].symbol] = lengths[i];
+    }
+}
 
+bool build_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths) {
+    if (max_code_length == 0) {
+        build_huffman_code_lengths(symbol_frequencies, code_lengths);
+        return true;
+    }
+    return build_length_limited_code_lengths(symbol_frequencies, max_code_length, code_lengths);
+}
+
+uint64_t encoded_size_bits(const long *symbol_frequencies, const uint8_t *code_lengths) {
+    uint64_t bits = 0;
     for (int i = 0; i < num_symbols; i++) {
-        const bitstring *code = symbol_codes[i];
-        if (code == NULL) continue; // don't insert symbols with no code
-
-        tree_node *current = root;
-
-        for (int k = 0; k < bitstring_bitlength(code); k++) {
-            
-            tree_node **childp;
-            if (bitstring_get(code, k)) { // 1 = right
-                childp = &(current->right);  // TODO: is this correct
-            }else { // 0 = left
-                childp = &(current->left);
-            }
+        if (symbol_frequencies[i] > 0 && code_lengths[i] == 0) {
+            return UINT64_MAX;
+        }
+        bits += (uint64_t)symbol_frequencies[i] * code_lengths[i];
+    }
+    return bits;
+}
+
+static inline void store_big_endian_32(unsigned char *p, uint32_t x) {
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+size_t encode_bound(size_t message_length, const code_entry *table) {
+    int longest = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        if (table[i].length > longest) longest = table[i].length;
+    }
+    // enough for every symbol to have the longest code, 
+    // plus a whole word of slack for the final partial word
+    return (message_length * longest + 7) / 8 + 4;
+}
+
+// encode a message into `out`, returning its length in bits.
+// with `context_codes`, each symbol is coded with the code for the symbol before it (0 for the first),
+// and otherwise with `table`
+static inline size_t encode_bits(const symbol *message, size_t message_length, const code_entry *table, 
+                                 const code_entry *const *context_codes, unsigned char *out) {
+    unsigned char *start = out;
+    symbol previous = 0;
+
+    // pending bits are the low `count` bits of the accumulator.
+    // codes are at most 32 bits, so after adding one to fewer than 32 
+    // pending bits, the accumulator can't overflow
+    uint64_t accumulator = 0;
+    int count = 0;
+
+    for (size_t i = 0; i < message_length; i++) {
+        code_entry code = context_codes != NULL ? context_codes[previous][message[i]] : table[message[i]];
+        previous = message[i];
+
+        accumulator = (accumulator << code.length) | code.bits;
+        count += code.length;
+
+        if (count >= 32) {
+            count -= 32;
+            store_big_endian_32(out, accumulator >> count);
+            out += 4;
+        }
+    }
+    // the final partial word, aligned to the top (so padded with zeros)
+    store_big_endian_32(out, (uint32_t)(accumulator << (32 - count)));
+
+    return (out - start) * 8 + count;
+}
+
+size_t encode_bytes(const symbol *message, size_t message_length, const code_entry *table, unsigned char *out) {
+    return (encode_bits(message, message_length, table, NULL, out) + 7) / 8;
+}
+
+size_t encode_bytes_in_context(const symbol *message, size_t message_length, 
+                               const code_entry *const *context_codes, unsigned char *out) {
+    return (encode_bits(message, message_length, NULL, context_codes, out) + 7) / 8;
+}
+
+bitstring *encode(const symbol *message, size_t message_length, const code_entry *table) {
+    bitstring *encoded = bitstring_new_with_capacity(encode_bound(message_length, table));
+    encoded->length = encode_bits(message, message_length, table, NULL, (unsigned char *)encoded->bytes);
+    return encoded;
+}
+
+// point entries of the table at `offset` (indexed by `bits` bits) 
+// whose index starts with the low `length` bits of `code` to `entry`
+static void fill_entries(decode_table *table, size_t offset, int bits, 
+                         uint32_t code, int length, decode_entry entry) {
+    size_t first = (size_t)code << (bits - length);
+    size_t count = (size_t)1 << (bits - length);
+    for (size_t i = first; i < first + count; i++) {
+        table->entries[offset + i] = entry;
+    }
+}
+
+// each symbol's code can need a subtable at each level below the primary table
+static int max_subtables() {
+    int levels = (MAX_CODE_LENGTH - primary_table_bits + subtable_bits - 1) / subtable_bits;
+    return levels * num_symbols;
+}
 
-            if (*childp == NULL) {
-                *childp = malloc(sizeof(tree_node));
-                **childp = (tree_node) {
-                    .parent = current,
-                    .left = NULL,
-                    .right = NULL,
-                    .symbol = 0
+size_t decode_table_max_entries() {
+    return ((size_t)1 << primary_table_bits) + max_subtables() * ((size_t)1 << subtable_bits);
+}
+
+// fill the table's entries for `n` symbols' canonical `codes` of these lengths.
+// if `growable`, the entries are allocated (with space for only the primary table to start with),
+// and grow as subtables are added. returns false if there would be too many subtables to number,
+// or there's no memory for them
+static bool fill_decode_table(decode_table *table, const uint8_t *code_lengths, const uint32_t *codes, size_t n,
+                              bool growable) {
+    const size_t primary_size = (size_t)1 << primary_table_bits;
+    const size_t subtable_size = (size_t)1 << subtable_bits;
+
+    table->num_subtables = 0;
+    int subtables_capacity = 0;
+    memset(table->entries, 0, sizeof(decode_entry) * primary_size);
+
+    for (size_t i = 0; i < n; i++) {
+        int remaining = code_lengths[i];
+        if (remaining == 0) continue;
+        uint32_t code = codes[i];
+
+        // follow (or create) subtables until the rest of the code fits
+        size_t offset = 0;
+        int bits = primary_table_bits;
+        while (remaining > bits) {
+            size_t index = offset + ((code >> (remaining - bits)) & ((1u << bits) - 1));
+            if (!table->entries[index].is_subtable) {
+                // (entries refer to subtables by number, so moving them is harmless)
+                if (table->num_subtables > UINT16_MAX) {
+                    return false;
+                }
+                if (growable && table->num_subtables == subtables_capacity) {
+                    subtables_capacity = subtables_capacity == 0 ? 16 : 2 * subtables_capacity;
+                    decode_entry *entries = realloc(table->entries,
+                        sizeof(decode_entry) * (primary_size + subtables_capacity * subtable_size));
+                    if (entries == NULL) {
+                        return false;
+                    }
+                    table->entries = entries;
+                }
+                int subtable = table->num_subtables++;
+                memset(table->entries + primary_size + subtable * subtable_size, 
+                       0, sizeof(decode_entry) * subtable_size);
+
+                table->entries[index] = (decode_entry) {
+                    .value = subtable,
+                    .length = bits,
+                    .is_subtable = true
                 };
             }
-
-            current = *childp;
+            offset = primary_size + table->entries[index].value * subtable_size;
+            remaining -= bits;
+            bits = subtable_bits;
         }
 
-        // end of code path: symbol lives here
-        current->symbol = (symbol) i; // is this cast ok?
+        uint32_t rest = code & (uint32_t)(((uint64_t)1 << remaining) - 1);
+        fill_entries(table, offset, bits, rest, remaining, (decode_entry) {
+            .value = i,
+            .length = remaining,
+            .is_subtable = false
+        });
     }
 
-    return root;
+    return true;
 }
 
+bool decode_table_init(decode_table *table, decode_entry *entries, const uint8_t *code_lengths) {
+    uint32_t codes[num_symbols];
+    if (!assign_canonical_codes(code_lengths, num_symbols, codes)) {
+        return false;
+    }
+    table->entries = entries;
+    return fill_decode_table(table, code_lengths, codes, num_symbols, false);
+}
+
+decode_table *decode_table_from_code_lengths(const uint8_t *code_lengths) {
+    decode_table *table = malloc(sizeof(decode_table));
+    decode_entry *entries = malloc(sizeof(decode_entry) * decode_table_max_entries());
+    if (table == NULL || entries == NULL || !decode_table_init(table, entries, code_lengths)) {
+        free(entries);
+        free(table);
+        return NULL;
+    }
+    // only keep what's used (or if that can't be moved, all of it)
+    size_t num_entries = ((size_t)1 << primary_table_bits) + table->num_subtables * ((size_t)1 << subtable_bits);
+    table->entries = realloc(entries, sizeof(decode_entry) * num_entries);
+    if (table->entries == NULL) {
+        table->entries = entries;
+    }
+    return table;
+}
 
-bitstring *encode(const symbol *message, int message_length, const bitstring **symbol_codes) {
-    bitstring *encoded = bitstring_new_empty();
+void decode_table_delete(decode_table *table) {
+    if (table == NULL) return;
+    free(table->entries);
+    free(table);
+}
 
-    for (int i = 0; i < message_length; i++) {
-        symbol s = message[i];
+// reads a byte array most significant bit first, 
+// keeping upcoming bits in a 64 bit buffer
+typedef struct {
+    const unsigned char *bytes;
+    size_t byte_length;
+    // next byte to load into the buffer
+    size_t next_byte;
+    // upcoming bits, left aligned. bits past the end of the input are zero
+    uint64_t buffer;
+    // number of valid bits in the buffer
+    int count;
+} bit_reader;
 
-        const bitstring *codeword = symbol_codes[s]; // TODO: indexing with symbol bad ?
+static inline uint64_t load_big_endian_64(const unsigned char *p) {
+    return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 
+         | (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32
+         | (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16
+         | (uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
 
-        bitstring_concat(encoded, codeword);
+// top up the buffer to at least 56 bits (or all remaining input)
+static inline void bit_reader_refill(bit_reader *r) {
+    if (r->next_byte + 8 <= r->byte_length) {
+        // the bits after the whole bytes loaded are correct too, 
+        // so loading them again next time is harmless
+        r->buffer |= load_big_endian_64(r->bytes + r->next_byte) >> r->count;
+        r->next_byte += (63 - r->count) >> 3;
+        r->count |= 56;
+    }else {
+        while (r->count <= 56 && r->next_byte < r->byte_length) {
+            r->buffer |= (uint64_t)r->bytes[r->next_byte++] << (56 - r->count);
+            r->count += 8;
+        }
     }
+}
 
-    return encoded;
+static inline size_t bit_reader_peek(const bit_reader *r, int n) {
+    return r->buffer >> (64 - n);
+}
+
+static inline void bit_reader_consume(bit_reader *r, int n) {
+    r->buffer <<= n;
+    r->count -= n;
+}
+
+// decode one symbol, which must have been fully loaded into the reader's buffer.
+// invalid codes decode as an entry of length 0
+static inline decode_entry decode_loaded_symbol(bit_reader *r, const decode_entry *entries) {
+    decode_entry entry = entries[bit_reader_peek(r, primary_table_bits)];
+
+    while (entry.is_subtable) {
+        bit_reader_consume(r, entry.length);
+        const decode_entry *subtable = entries + ((size_t)1 << primary_table_bits) 
+                                     + entry.value * ((size_t)1 << subtable_bits);
+        entry = subtable[bit_reader_peek(r, subtable_bits)];
+    }
+    bit_reader_consume(r, entry.length);
+    return entry;
 }
 
-symbol *decode(const bitstring *encoded, const tree_node *tree, int *result_lengthp) {
-    int capacity = 16;
+symbol *decode(const bitstring *encoded, const decode_table *table, size_t *result_lengthp) {
+    size_t bitlength = bitstring_bitlength(encoded);
+
+    // most codes are no longer than a byte
+    size_t capacity = bitlength / 8 + 16;
     symbol *result = malloc(sizeof(symbol) * capacity);
-    *result_lengthp = 0;
-
-    int i = 0;
-    while (i < bitstring_bitlength(encoded)) {
-        const tree_node *current = tree;
-        while (!is_leaf(current)) {
-            
-            if (i >= bitstring_bitlength(encoded)) {
-                // incomplete final symbol   // TODO: or return partial?
-                *result_lengthp = -1;
-                free(result);
-                return NULL;
-            }
+    size_t result_length = 0;
 
-            if (bitstring_get(encoded, i++)) {
-                current = current->right;
-            }else {
-                current = current->left;
+    bit_reader reader = {
+        .bytes = (const unsigned char *)bitstring_to_bytes(encoded),
+        .byte_length = (bitlength + 7) / 8,
+        .next_byte = 0,
+        .buffer = 0,
+        .count = 0
+    };
+
+    const decode_entry *entries = table->entries;
+    const size_t primary_size = (size_t)1 << primary_table_bits;
+    const size_t subtable_size = (size_t)1 << subtable_bits;
+
+    size_t position = 0;
+    while (position < bitlength) {
+        if (reader.count < primary_table_bits) {
+            bit_reader_refill(&reader);
+        }
+        decode_entry entry = entries[bit_reader_peek(&reader, primary_table_bits)];
+
+        while (entry.is_subtable) {
+            bit_reader_consume(&reader, entry.length);
+            position += entry.length;
+            if (reader.count < subtable_bits) {
+                bit_reader_refill(&reader);
             }
+            const decode_entry *subtable = entries + primary_size + entry.value * subtable_size;
+            entry = subtable[bit_reader_peek(&reader, subtable_bits)];
         }
+        
+        position += entry.length;
+        if (entry.length == 0 || position > bitlength) {
+            // invalid code, or incomplete final symbol   // TODO: or return partial?
+            *result_lengthp = 0;
+            free(result);
+            return NULL;
+        }
+        bit_reader_consume(&reader, entry.length);
 
-        if (*result_lengthp == capacity) {
+        if (result_length == capacity) {
             capacity *= 2;
             result = realloc(result, sizeof(symbol) * capacity);
         }
-
-        result[(*result_lengthp)++] = current->symbol;
+        result[result_length++] = entry.value;
     }
+
+    *result_lengthp = result_length;
     return result;
 }
+
+// decode the next symbol from a stream, noting if it's invalid
+static inline symbol decode_next_symbol(bit_reader *r, const decode_entry *entries, bool *invalid) {
+    if (r->count < MAX_CODE_LENGTH) {
+        bit_reader_refill(r);
+    }
+    decode_entry entry = decode_loaded_symbol(r, entries);
+    *invalid |= entry.length == 0;
+    return entry.value;
+}
+
+// how many symbols lockstep decoding goes between checking that no stream has run out.
+// (an exhausted stream reads as zeros, so a corrupt length would otherwise have all of it decoded from nothing)
+static const size_t symbols_between_checks = 4096;
+
+// the table for the next symbol: the one for the symbol before it, with `context_entries`
+#define NEXT_ENTRIES(previous) (context_entries != NULL ? context_entries[previous] : entries)
+
+// decode `count` symbols from each of 4 streams in lockstep.
+// (with a fixed number of streams, their readers can all live in registers)
+static inline bool decode_four_streams(bit_reader *readers, const decode_entry *entries, 
+                                       const decode_entry *const *context_entries,
+                                       symbol *out, size_t segment_length, size_t count) {
+    bit_reader r0 = readers[0], r1 = readers[1], r2 = readers[2], r3 = readers[3];
+    symbol *out0 = out, *out1 = out + segment_length, 
+           *out2 = out + 2 * segment_length, *out3 = out + 3 * segment_length;
+    symbol p0 = 0, p1 = 0, p2 = 0, p3 = 0;
+    bool invalid = false;
+
+    for (size_t start = 0; start < count && !invalid; start += symbols_between_checks) {
+        size_t end = count - start < symbols_between_checks ? count : start + symbols_between_checks;
+        for (size_t i = start; i < end; i++) {
+            out0[i] = p0 = decode_next_symbol(&r0, NEXT_ENTRIES(p0), &invalid);
+            out1[i] = p1 = decode_next_symbol(&r1, NEXT_ENTRIES(p1), &invalid);
+            out2[i] = p2 = decode_next_symbol(&r2, NEXT_ENTRIES(p2), &invalid);
+            out3[i] = p3 = decode_next_symbol(&r3, NEXT_ENTRIES(p3), &invalid);
+        }
+        invalid |= (r0.count | r1.count | r2.count | r3.count) < 0;
+    }
+
+    readers[0] = r0;
+    readers[1] = r1;
+    readers[2] = r2;
+    readers[3] = r3;
+    return !invalid;
+}
+
+// decode_interleaved, with `entries` for every symbol, or if `context_entries` isn't NULL,
+// the entries for the symbol before each one
+static inline bool decode_streams(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                  const decode_entry *entries, const decode_entry *const *context_entries,
+                                  symbol *out, size_t length) {
+    size_t segment_length = (length + num_streams - 1) / num_streams;
+
+    bit_reader readers[num_streams];
+    size_t counts[num_streams];
+    size_t shortest = segment_length;
+    for (int k = 0; k < num_streams; k++) {
+        readers[k] = (bit_reader) {
+            .bytes = streams[k],
+            .byte_length = stream_lengths[k],
+            .next_byte = 0,
+            .buffer = 0,
+            .count = 0
+        };
+        size_t start = k * segment_length;
+        counts[k] = start >= length ? 0 : (length - start < segment_length ? length - start : segment_length);
+        if (counts[k] < shortest) shortest = counts[k];
+    }
+
+    bool invalid = false;
+
+    // one symbol from each stream in turn, so their (independent) 
+    // chains of lookups overlap in the processor's pipeline
+    if (num_streams == 4) {
+        invalid = !decode_four_streams(readers, entries, context_entries, out, segment_length, shortest);
+    }else {
+        for (size_t i = 0; i < shortest && !invalid; i++) {
+            for (int k = 0; k < num_streams; k++) {
+                symbol *next = out + k * segment_length + i;
+                *next = decode_next_symbol(&readers[k], NEXT_ENTRIES(i == 0 ? 0 : next[-1]), &invalid);
+            }
+            if (i % symbols_between_checks == symbols_between_checks - 1) {
+                for (int k = 0; k < num_streams; k++) {
+                    invalid |= readers[k].count < 0;
+                }
+            }
+        }
+    }
+    // the shorter final segment leaves the others with a few more
+    for (int k = 0; k < num_streams && !invalid; k++) {
+        for (size_t i = shortest; i < counts[k] && readers[k].count >= 0; i++) {
+            symbol *next = out + k * segment_length + i;
+            *next = decode_next_symbol(&readers[k], NEXT_ENTRIES(i == 0 ? 0 : next[-1]), &invalid);
+        }
+    }
+
+    // reading past the end of a stream leaves a negative count
+    for (int k = 0; k < num_streams; k++) {
+        invalid |= readers[k].count < 0;
+    }
+    return !invalid;
+}
+
+bool decode_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                        const decode_table *table, symbol *out, size_t length) {
+    return decode_streams(streams, stream_lengths, num_streams, table->entries, NULL, out, length);
+}
+
+bool decode_interleaved_in_context(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                   const decode_entry *const *context_entries, symbol *out, size_t length) {
+    return decode_streams(streams, stream_lengths, num_streams, NULL, context_entries, out, length);
+}
+
+typedef struct {
+    long frequency;
+    wide_symbol symbol;
+} weighted_wide_symbol;
+
+static int compare_wide_frequency(const void *a, const void *b) {
+    const weighted_wide_symbol *wa = a, *wb = b;
+    if (wa->frequency != wb->frequency) {
+        return wa->frequency < wb->frequency ? -1 : 1;
+    }
+    return wa->symbol - wb->symbol;
+}
+
+bool build_wide_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths) {
+    memset(code_lengths, 0, sizeof(uint8_t) * NUM_WIDE_SYMBOLS);
+    int limit = max_code_length == 0 || max_code_length > MAX_CODE_LENGTH ? MAX_CODE_LENGTH : max_code_length;
+
+    weighted_wide_symbol *leaves = malloc(sizeof(weighted_wide_symbol) * NUM_WIDE_SYMBOLS);
+    long n = 0;
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        if (symbol_frequencies[i] > 0) {
+            leaves[n++] = (weighted_wide_symbol) { .frequency = symbol_frequencies[i], .symbol = i };
+        }
+    }
+    bool fits = true;
+    if (n == 1) {
+        code_lengths[leaves[0].symbol] = 1;
+    }else if (n > 1 && (limit < 1 || n > (long)1 << limit)) {
+        fits = false;
+    }else if (n > 1) {
+        qsort(leaves, n, sizeof(weighted_wide_symbol), compare_wide_frequency);
+        long *lengths = malloc(sizeof(long) * n);
+        for (long i = 0; i < n; i++) {
+            lengths[i] = leaves[i].frequency;
+        }
+        minimum_redundancy_lengths(lengths, n);
+        // (lengths[0] is the longest. only then is package-merge's memory worth spending)
+        if (lengths[0] > limit) {
+            bool *is_leaf_item = malloc(sizeof(bool) * limit * 2 * n);
+            long *list_weights = malloc(sizeof(long) * 2 * 2 * n);
+            long *weights = malloc(sizeof(long) * n);
+            for (long i = 0; i < n; i++) {
+                weights[i] = leaves[i].frequency;
+            }
+            package_merge(weights, n, limit, is_leaf_item, list_weights, lengths);
+            free(is_leaf_item);
+            free(list_weights);
+            free(weights);
+        }
+        for (long i = 0; i < n; i++) {
+            code_lengths[leaves[i].symbol] = lengths[i];
+        }
+        free(lengths);
+    }
+    free(leaves);
+    return fits;
+}
+
+bool get_wide_code_table(const uint8_t *code_lengths, code_entry *table) {
+    uint32_t *codes = malloc(sizeof(uint32_t) * NUM_WIDE_SYMBOLS);
+    bool valid = assign_canonical_codes(code_lengths, NUM_WIDE_SYMBOLS, codes);
+    for (long i = 0; valid && i < NUM_WIDE_SYMBOLS; i++) {
+        table[i] = (code_entry) {
+            .bits = codes[i],
+            .length = code_lengths[i]
+        };
+    }
+    free(codes);
+    return valid;
+}
+
+decode_table *wide_decode_table_from_code_lengths(const uint8_t *code_lengths) {
+    uint32_t *codes = malloc(sizeof(uint32_t) * NUM_WIDE_SYMBOLS);
+    decode_table *table = malloc(sizeof(decode_table));
+    if (codes == NULL || table == NULL) {
+        free(codes);
+        free(table);
+        return NULL;
+    }
+    // (most wide codes need only a few of the many subtables they could)
+    table->entries = malloc(sizeof(decode_entry) << primary_table_bits);
+    bool valid = table->entries != NULL && assign_canonical_codes(code_lengths, NUM_WIDE_SYMBOLS, codes)
+              && fill_decode_table(table, code_lengths, codes, NUM_WIDE_SYMBOLS, true);
+    free(codes);
+    if (!valid) {
+        decode_table_delete(table);
+        return NULL;
+    }
+    return table;
+}
+
+size_t wide_encode_bound(size_t length, const code_entry *table) {
+    int longest = 0;
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        if (table[i].length > longest) longest = table[i].length;
+    }
+    return ((length + 1) / 2 * longest + 7) / 8 + 4;
+}
+
+// add a code to the pending bits, storing a word when there are enough (as encode_bits does)
+static inline void put_code(code_entry code, uint64_t *accumulator, int *count, unsigned char **out) {
+    *accumulator = (*accumulator << code.length) | code.bits;
+    *count += code.length;
+    if (*count >= 32) {
+        *count -= 32;
+        store_big_endian_32(*out, *accumulator >> *count);
+        *out += 4;
+    }
+}
+
+size_t encode_wide_bytes(const uint8_t *message, size_t length, const code_entry *table, unsigned char *out) {
+    unsigned char *start = out;
+    uint64_t accumulator = 0;
+    int count = 0;
+
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        put_code(table[message[i] | message[i + 1] << 8], &accumulator, &count, &out);
+    }
+    // a lone final byte is coded as if the byte after it were 0
+    if (i < length) {
+        put_code(table[message[i]], &accumulator, &count, &out);
+    }
+    store_big_endian_32(out, (uint32_t)(accumulator << (32 - count)));
+
+    return ((out - start) * 8 + count + 7) / 8;
+}
+
+static inline wide_symbol decode_next_wide_symbol(bit_reader *r, const decode_entry *entries, bool *invalid) {
+    if (r->count < MAX_CODE_LENGTH) {
+        bit_reader_refill(r);
+    }
+    decode_entry entry = decode_loaded_symbol(r, entries);
+    *invalid |= entry.length == 0;
+    return entry.value;
+}
+
+static inline void put_wide_symbol(wide_symbol s, uint8_t *out) {
+    out[0] = s;
+    out[1] = s >> 8;
+}
+
+// decode `count` symbols from each of 4 streams in lockstep (as decode_four_streams does)
+static bool decode_four_wide_streams(bit_reader *readers, const decode_entry *entries,
+                                     uint8_t *out, size_t segment_length, size_t count) {
+    bit_reader r0 = readers[0], r1 = readers[1], r2 = readers[2], r3 = readers[3];
+    uint8_t *out0 = out, *out1 = out + 2 * segment_length,
+            *out2 = out + 4 * segment_length, *out3 = out + 6 * segment_length;
+    bool invalid = false;
+
+    for (size_t start = 0; start < count && !invalid; start += symbols_between_checks) {
+        size_t end = count - start < symbols_between_checks ? count : start + symbols_between_checks;
+        for (size_t i = start; i < end; i++) {
+            put_wide_symbol(decode_next_wide_symbol(&r0, entries, &invalid), out0 + 2 * i);
+            put_wide_symbol(decode_next_wide_symbol(&r1, entries, &invalid), out1 + 2 * i);
+            put_wide_symbol(decode_next_wide_symbol(&r2, entries, &invalid), out2 + 2 * i);
+            put_wide_symbol(decode_next_wide_symbol(&r3, entries, &invalid), out3 + 2 * i);
+        }
+        invalid |= (r0.count | r1.count | r2.count | r3.count) < 0;
+    }
+
+    readers[0] = r0;
+    readers[1] = r1;
+    readers[2] = r2;
+    readers[3] = r3;
+    return !invalid;
+}
+
+bool decode_wide_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                             const decode_table *table, uint8_t *out, size_t length) {
+    const decode_entry *entries = table->entries;
+    size_t num_wide = (length + 1) / 2;
+    size_t segment_length = (num_wide + num_streams - 1) / num_streams;
+
+    bit_reader readers[num_streams];
+    size_t counts[num_streams];
+    int last_stream = -1;
+    for (int k = 0; k < num_streams; k++) {
+        readers[k] = (bit_reader) {
+            .bytes = streams[k],
+            .byte_length = stream_lengths[k],
+            .next_byte = 0,
+            .buffer = 0,
+            .count = 0
+        };
+        size_t start = k * segment_length;
+        counts[k] = start >= num_wide ? 0 : (num_wide - start < segment_length ? num_wide - start : segment_length);
+        if (counts[k] > 0) last_stream = k;
+    }
+    // the final symbol may be a lone byte, so it's decoded on its own
+    if (last_stream >= 0) {
+        counts[last_stream]--;
+    }
+    size_t shortest = segment_length;
+    for (int k = 0; k < num_streams; k++) {
+        if (counts[k] < shortest) shortest = counts[k];
+    }
+
+    bool invalid = false;
+    if (num_streams == 4) {
+        invalid = !decode_four_wide_streams(readers, entries, out, segment_length, shortest);
+    }else {
+        for (size_t i = 0; i < shortest && !invalid; i++) {
+            for (int k = 0; k < num_streams; k++) {
+                put_wide_symbol(decode_next_wide_symbol(&readers[k], entries, &invalid), 
+                                out + 2 * (k * segment_length + i));
+            }
+            if (i % symbols_between_checks == symbols_between_checks - 1) {
+                for (int k = 0; k < num_streams; k++) {
+                    invalid |= readers[k].count < 0;
+                }
+            }
+        }
+    }
+    for (int k = 0; k < num_streams && !invalid; k++) {
+        for (size_t i = shortest; i < counts[k] && readers[k].count >= 0; i++) {
+            put_wide_symbol(decode_next_wide_symbol(&readers[k], entries, &invalid), 
+                            out + 2 * (k * segment_length + i));
+        }
+    }
+    if (last_stream >= 0 && !invalid) {
+        wide_symbol last = decode_next_wide_symbol(&readers[last_stream], entries, &invalid);
+        out[2 * (num_wide - 1)] = last;
+        if (length % 2 == 0) {
+            out[length - 1] = last >> 8;
+        }else {
+            // (its padding must be what the encoder adds)
+            invalid |= last >> 8 != 0;
+        }
+    }
+
+    for (int k = 0; k < num_streams; k++) {
+        invalid |= readers[k].count < 0;
+    }
+    return !invalid;
+}
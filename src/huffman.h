@@ -1,40 +1,157 @@
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
 
+#include <stdint.h>
+
 #include "bitstring.h"
 
 typedef unsigned char symbol;
 extern const size_t symbol_bitsize;
 extern const size_t num_symbols;
 
-// a tree representing a prefix code
+// longest code the file format (and canonical code assignment) supports
+#define MAX_CODE_LENGTH 32
+
+// a symbol's code: the low `length` bits of `bits`, most significant first
+typedef struct {
+    uint32_t bits;
+    uint8_t length;
+} code_entry;
+
+// a node, by its place in its tree's array of nodes
+typedef uint16_t node_index;
+#define NO_NODE 0xffff
+
+// enough for a leaf per symbol, and the internal nodes joining them
+#define MAX_TREE_NODES (2 * (1 << 8) - 1)
+
+// a node of a tree representing a prefix code
 // either has 2 children, or 
 // none and a symbol
-// every node has a total frequency
-typedef struct tree_node {
-    
-    struct tree_node *parent;
-
-    // rename to zero / one ?
-    struct tree_node *left;
-    struct tree_node *right;
+typedef struct {
+    node_index parent;
+    // the child for a 0 bit, and for a 1 bit
+    node_index left;
+    node_index right;
 
     symbol symbol;
+} tree_node;
 
-    long total_frequency;
+// all the nodes of a tree live in one array, 
+// so a tree can be on the stack, and needs no allocation or freeing
+typedef struct {
+    tree_node nodes[MAX_TREE_NODES];
+    int num_nodes;
+    // NO_NODE for the empty tree
+    node_index root;
+} huffman_tree;
 
-} tree_node;
+void build_huffman_tree(const long *symbol_frequencies, huffman_tree *tree);
+// like build_huffman_code_lengths, but no code is longer than max_code_length.
+// returns false if the present symbols can't all fit in that length
+bool build_length_limited_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths);
+void build_uniform_tree(const long *symbol_frequencies, huffman_tree *tree);
+
+// fill `table` (one entry per symbol) with the tree's codes, length 0 for symbols not in it.
+// returns false if a code is longer than MAX_CODE_LENGTH
+bool get_codes_from_tree(const huffman_tree *tree, code_entry *table);
+// build the tree with the codes in `table`.
+// returns false if they need more than MAX_TREE_NODES nodes
+bool get_tree_from_codes(const code_entry *table, huffman_tree *tree);
+
+// code lengths have one entry per symbol, 0 for symbols without a code
+void get_code_lengths_from_tree(const huffman_tree *tree, uint8_t *code_lengths);
+void build_huffman_code_lengths(const long *symbol_frequencies, uint8_t *code_lengths);
+// build_huffman_code_lengths, or if max_code_length isn't 0, build_length_limited_code_lengths
+bool build_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths);
+// the number of bits symbols with these frequencies take to encode with a code of these lengths,
+// or UINT64_MAX if a symbol which is present has no code
+uint64_t encoded_size_bits(const long *symbol_frequencies, const uint8_t *code_lengths);
+
+// fill `table` (one entry per symbol) with the canonical prefix code with these lengths.
+// returns false if no prefix code has these lengths
+bool get_code_table(const uint8_t *code_lengths, code_entry *table);
+
+// one entry of a decode table, indexed by the next few bits of input.
+// either the symbol whose code starts with those bits,
+// or a link to a subtable for the remaining bits of a longer code
+typedef struct {
+    // the symbol, or the subtable number
+    uint16_t value;
+    // number of bits this entry consumes (0 if no code starts with them)
+    uint8_t length;
+    bool is_subtable;
+} decode_entry;
+
+// a lookup table for decoding several bits at a time:
+// a primary table indexed by the next `primary_table_bits` bits,
+// followed by `num_subtables` tables indexed by `subtable_bits` bits each
+typedef struct {
+    decode_entry *entries;
+    int num_subtables;
+} decode_table;
+
+extern const int primary_table_bits;
+extern const int subtable_bits;
+
+// table for decoding the canonical code with these lengths.
+// returns NULL if no prefix code has these lengths, or there's no memory
+decode_table *decode_table_from_code_lengths(const uint8_t *code_lengths);
+void decode_table_delete(decode_table *);
+// the most entries any decode table needs
+size_t decode_table_max_entries();
+// like decode_table_from_code_lengths, but without allocating:
+// into `table`, using `entries` (with space for decode_table_max_entries()) as its storage.
+// returns false if no prefix code has these lengths
+bool decode_table_init(decode_table *table, decode_entry *entries, const uint8_t *code_lengths);
+
+// an upper bound on the bytes encode_bytes will write (including slack past the end)
+size_t encode_bound(size_t message_length, const code_entry *table);
+// encode a message into `out`, zero padding the last byte.
+// returns the number of bytes of encoded message
+size_t encode_bytes(const symbol *message, size_t message_length, const code_entry *table, unsigned char *out);
+// like encode_bytes, but coding each symbol with the code for the symbol before it
+// (`context_codes` has one per symbol, and the first symbol is coded as if after a 0)
+size_t encode_bytes_in_context(const symbol *message, size_t message_length, 
+                               const code_entry *const *context_codes, unsigned char *out);
+bitstring *encode(const symbol *message, size_t message_length, const code_entry *table);
 
+// returns NULL if the bits aren't a whole number of valid codes
+symbol *decode(const bitstring *encoded, const decode_table *table, size_t *result_lengthp);
+// decode `length` symbols, which were split into `num_streams` equal segments 
+// (the last perhaps shorter) and each encoded with encode_bytes, decoding the streams in lockstep.
+// returns false if any stream is invalid or too short
+bool decode_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                        const decode_table *table, symbol *out, size_t length);
+// like decode_interleaved, for segments encoded with encode_bytes_in_context:
+// each symbol is decoded with the entries of the table for the symbol before it
+// (`context_entries` has one per symbol)
+bool decode_interleaved_in_context(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                                   const decode_entry *const *context_entries, symbol *out, size_t length);
 
-tree_node *build_huffman_tree(const long *symbol_frequencies);
-tree_node *build_uniform_tree(const long *symbol_frequencies);
-void tree_delete(tree_node *t);
+// 16 bit symbols, for text in UTF-16 or 16 bit samples: each a little endian pair of bytes,
+// and in a message of an odd length, the last byte with a 0 after it.
+// they have their own builder, tables and coders (each like its counterpart for bytes, with
+// NUM_WIDE_SYMBOLS entries where that has num_symbols), so coding bytes is no slower for them
+typedef uint16_t wide_symbol;
+#define NUM_WIDE_SYMBOLS (1 << 16)
 
-bitstring **get_codes_from_tree(const tree_node *tree);
-tree_node *get_tree_from_codes(const bitstring **symbol_codes);
-void delete_codes(bitstring **codes);
+// like build_code_lengths. the code is found in place (rather than with a tree of up to 2^17 nodes),
+// and only if it's too long for max_code_length (or if that's 0, MAX_CODE_LENGTH) is it found
+// again by package-merge, with its lists for every length.
+// returns false if the present symbols can't all fit in max_code_length
+bool build_wide_code_lengths(const long *symbol_frequencies, int max_code_length, uint8_t *code_lengths);
+bool get_wide_code_table(const uint8_t *code_lengths, code_entry *table);
+// with only as many subtables as the code needs (unlike decode_table_init, which has room for any).
+// returns NULL if no prefix code has these lengths, it needs too many subtables, or there's no memory
+decode_table *wide_decode_table_from_code_lengths(const uint8_t *code_lengths);
 
-bitstring *encode(const symbol *message, int message_length, const bitstring **symbol_codes);
-symbol *decode(const bitstring *encoded, const tree_node *tree, int *result_lengthp);
+// these take the message's length in bytes
+size_t wide_encode_bound(size_t length, const code_entry *table);
+size_t encode_wide_bytes(const uint8_t *message, size_t length, const code_entry *table, unsigned char *out);
+// decode `length` bytes, whose symbols were split into `num_streams` equal segments
+// (the last perhaps shorter) and each encoded with encode_wide_bytes
+bool decode_wide_interleaved(const unsigned char *const *streams, const size_t *stream_lengths, int num_streams,
+                             const decode_table *table, uint8_t *out, size_t length);
 
 #endif // HUFFMAN_H
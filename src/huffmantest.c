@@ -3,43 +3,44 @@
 #include <string.h>
 
 #include "assert.h"
+#include "histogram.h"
 #include "huffman.h"
 
-typedef tree_node *(*tree_builder)(const long *);
+typedef void (*tree_builder)(const long *, huffman_tree *);
 
-void assert_tree_valid(tree_node *t) {
-    // assert(t->total_frequency >= 0, "frequency cannot be negative");
+void assert_tree_valid(const huffman_tree *tree) {
+    assert(tree->root != NO_NODE && tree->nodes[tree->root].parent == NO_NODE, "root must have no parent");
+    assert(tree->num_nodes <= MAX_TREE_NODES, "tree must fit in its nodes");
 
-    if (t->left != NULL && t->right != NULL) {
+    for (int i = 0; i < tree->num_nodes; i++) {
+        const tree_node *t = &tree->nodes[i];
+        if (t->left != NO_NODE && t->right != NO_NODE) {
 
-        assert(t->left->parent == t, "left child's parent must be self");
-        assert(t->right->parent == t, "right child's parent must be self");
+            assert(tree->nodes[t->left].parent == i, "left child's parent must be self");
+            assert(tree->nodes[t->right].parent == i, "right child's parent must be self");
 
-        assert_tree_valid(t->left);
-        assert_tree_valid(t->right);
-
-    }else {
-        assert(t->left == NULL && t->right == NULL, "node must have 2 or 0 children");
+        }else {
+            assert(t->left == NO_NODE && t->right == NO_NODE, "node must have 2 or 0 children");
+        }
     }
 }
 
-bool trees_equal(const tree_node *t1, const tree_node *t2) {
-    if (t1 != NULL && t2 != NULL) {
-        if (t1->left == NULL && t1->right == NULL 
-         && t2->left == NULL && t2->right == NULL) {
+bool trees_equal(const huffman_tree *tree1, node_index i1, const huffman_tree *tree2, node_index i2) {
+    if (i1 != NO_NODE && i2 != NO_NODE) {
+        const tree_node *t1 = &tree1->nodes[i1], *t2 = &tree2->nodes[i2];
+        if (t1->left == NO_NODE && t1->right == NO_NODE 
+         && t2->left == NO_NODE && t2->right == NO_NODE) {
             return t1->symbol == t2->symbol;
         }
-        return trees_equal(t1->left, t2->left)
-            && trees_equal(t1->right, t2->right);
+        return trees_equal(tree1, t1->left, tree2, t2->left)
+            && trees_equal(tree1, t1->right, tree2, t2->right);
     }
-    return t1 == NULL && t2 == NULL;
+    return i1 == NO_NODE && i2 == NO_NODE;
 }
 
 long *count_symbols(const symbol *message, int message_length) {
     long *symbol_frequencies = calloc(num_symbols, sizeof(long));
-    for (int i = 0; i < message_length; i++) {
-        symbol_frequencies[message[i]]++;
-    }
+    histogram(message, message_length, symbol_frequencies);
     return symbol_frequencies;
 }
 
@@ -47,32 +48,111 @@ void test_for_input(tree_builder build_tree, const symbol *message, int message_
 
     long *symbol_frequencies = count_symbols(message, message_length);
 
-    tree_node *tree = build_tree(symbol_frequencies);
-    assert_tree_valid(tree);
+    huffman_tree tree;
+    build_tree(symbol_frequencies, &tree);
+    assert_tree_valid(&tree);
 
-    bitstring **symbol_codes = get_codes_from_tree(tree);
+    code_entry tree_codes[num_symbols];
+    bool success = get_codes_from_tree(&tree, tree_codes);
+    assert(success, "get codes from tree should succeed");
     for (int i = 0; i < num_symbols; i++) {
         if (symbol_frequencies[i] > 0) {
-            assert(symbol_codes[i] != NULL, "present symbols should be assigned a code");
+            assert(tree_codes[i].length > 0, "present symbols should be assigned a code");
         }
     }
     free(symbol_frequencies);
 
-    tree_node *tree_again = get_tree_from_codes((const bitstring **)symbol_codes);
-    assert(trees_equal(tree, tree_again), "get_codes_from_tree and get_tree_from_codes should be inverses");
+    huffman_tree tree_again;
+    success = get_tree_from_codes(tree_codes, &tree_again);
+    assert(success, "get tree from codes should succeed");
+    assert(trees_equal(&tree, tree.root, &tree_again, tree_again.root), 
+        "get_codes_from_tree and get_tree_from_codes should be inverses");
+
+    uint8_t code_lengths[num_symbols];
+    get_code_lengths_from_tree(&tree, code_lengths);
+    code_entry code_table[num_symbols];
+    success = get_code_table(code_lengths, code_table);
+    assert(success, "a tree's code lengths should have a canonical code");
+    for (int i = 0; i < num_symbols; i++) {
+        assert(code_lengths[i] == tree_codes[i].length, "code lengths should match the tree's codes");
+        assert(code_table[i].length == tree_codes[i].length, "canonical codes should have the given lengths");
+    }
+
+    decode_table *table = decode_table_from_code_lengths(code_lengths);
+    assert(table != NULL, "a tree's code lengths should give a decode table");
 
-    bitstring *encoded = encode(message, message_length, (const bitstring **)symbol_codes);
-    int decoded_length;
-    symbol *decoded = decode(encoded, tree_again, &decoded_length);
+    bitstring *encoded = encode(message, message_length, code_table);
+    size_t decoded_length;
+    symbol *decoded = decode(encoded, table, &decoded_length);
     assert(message_length == decoded_length, "encoding & decoding should preserve message length");
     assert(memcmp(message, decoded, decoded_length) == 0, "encode and decode should be inverses");
 
     bitstring_delete(encoded);
     free(decoded);
+    decode_table_delete(table);
+}
 
-    delete_codes(symbol_codes);
-    tree_delete(tree);
-    tree_delete(tree_again);
+// check the lengths form a complete prefix code, no longer than the limit
+void assert_code_lengths_valid(const uint8_t *code_lengths, int max_length) {
+    uint64_t kraft_sum = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        assert(code_lengths[i] <= max_length, "code lengths should be within the limit");
+        if (code_lengths[i] > 0) {
+            kraft_sum += (uint64_t)1 << (MAX_CODE_LENGTH - code_lengths[i]);
+        }
+    }
+    assert(kraft_sum == (uint64_t)1 << MAX_CODE_LENGTH, "code lengths should form a complete code");
+}
+
+// encode bytes as wide symbols split into streams, and check they decode back
+void test_wide_round_trip(const uint8_t *data, size_t length, int num_streams, int max_code_length) {
+    long *frequencies = calloc(NUM_WIDE_SYMBOLS, sizeof(long));
+    wide_histogram(data, length, frequencies);
+    uint8_t *code_lengths = malloc(NUM_WIDE_SYMBOLS);
+    assert(build_wide_code_lengths(frequencies, max_code_length, code_lengths), "build wide code lengths should succeed");
+    code_entry *table = malloc(sizeof(code_entry) * NUM_WIDE_SYMBOLS);
+    assert(get_wide_code_table(code_lengths, table), "get wide code table should succeed");
+    decode_table *decoding = wide_decode_table_from_code_lengths(code_lengths);
+    assert(decoding != NULL, "wide decode table should build");
+
+    // segments of whole symbols
+    size_t segment = 2 * (((length + 1) / 2 + num_streams - 1) / num_streams);
+    unsigned char *encoded = malloc(wide_encode_bound(length, table) + num_streams);
+    const unsigned char *streams[num_streams];
+    size_t stream_lengths[num_streams];
+    unsigned char *out = encoded;
+    for (int k = 0; k < num_streams; k++) {
+        size_t start = k * segment;
+        size_t count = start >= length ? 0 : (length - start < segment ? length - start : segment);
+        stream_lengths[k] = encode_wide_bytes(data + start, count, table, out);
+        streams[k] = out;
+        out += stream_lengths[k];
+    }
+    assert((size_t)(out - encoded) <= wide_encode_bound(length, table) + num_streams,
+        "encoded streams should be within the bound");
+
+    uint8_t *decoded = malloc(length + 1);
+    assert(decode_wide_interleaved(streams, stream_lengths, num_streams, decoding, decoded, length),
+        "decode wide should succeed");
+    assert(memcmp(decoded, data, length) == 0, "decoded bytes should match the original");
+    if (length % 2 == 0 && length > 0 && data[length - 1] != 0) {
+        // (the last symbol's second byte isn't the padding a lone byte has)
+        assert(!decode_wide_interleaved(streams, stream_lengths, num_streams, decoding, decoded, length - 1),
+            "decode wide should reject a lone last byte with more after it");
+    }
+    // (the streams run out long before this, and reading on would only decode zeros)
+    size_t too_long = 2 * length + 100000;
+    uint8_t *more = malloc(too_long);
+    assert(!decode_wide_interleaved(streams, stream_lengths, num_streams, decoding, more, too_long),
+        "decode wide should reject a length the streams don't have enough bits for");
+    free(more);
+
+    free(frequencies);
+    free(code_lengths);
+    free(table);
+    decode_table_delete(decoding);
+    free(encoded);
+    free(decoded);
 }
 
 int main() {
@@ -107,8 +187,182 @@ int main() {
         }
         test_for_input(builders[i], all, num_symbols);
         free(all);
+
+        printf("test for codes longer than the primary decode table\n");
+        // fibonacci frequencies give a maximally deep huffman tree
+        int fib_symbols = 30;
+        int fib_length = 0;
+        long a = 1, b = 1;
+        for (int j = 0; j < fib_symbols; j++) {
+            fib_length += a;
+            long next = a + b;
+            a = b;
+            b = next;
+        }
+        symbol *fib = malloc(sizeof(symbol) * fib_length);
+        a = 1, b = 1;
+        for (int j = 0, k = 0; j < fib_symbols; j++) {
+            for (int c = 0; c < a; c++) {
+                fib[k++] = (symbol)('a' + j);
+            }
+            long next = a + b;
+            a = b;
+            b = next;
+        }
+        test_for_input(builders[i], fib, fib_length);
+        free(fib);
+    }
+
+    printf("test code lengths are limited\n");
+    // would give a tree 50 deep
+    long frequencies[num_symbols];
+    memset(frequencies, 0, sizeof(frequencies));
+    frequencies[0] = frequencies[1] = 1;
+    for (int i = 2; i < 51; i++) {
+        frequencies[i] = frequencies[i - 1] + frequencies[i - 2];
     }
+    uint8_t code_lengths[num_symbols];
+    build_huffman_code_lengths(frequencies, code_lengths);
+    assert_code_lengths_valid(code_lengths, MAX_CODE_LENGTH);
+    for (int i = 1; i < 51; i++) {
+        assert(code_lengths[i] <= code_lengths[i - 1], "more frequent symbols should have shorter codes");
+    }
+    huffman_tree deep_tree;
+    build_huffman_tree(frequencies, &deep_tree);
+    assert_tree_valid(&deep_tree);
+    code_entry codes[num_symbols];
+    assert(!get_codes_from_tree(&deep_tree, codes), "get codes from tree should reject codes too long to store");
 
+    printf("test trees are limited to their nodes\n");
+    // 24 zero bits, then every 8 bit suffix
+    for (int i = 0; i < num_symbols; i++) {
+        codes[i] = (code_entry) { .bits = i, .length = MAX_CODE_LENGTH };
+    }
+    assert(!get_tree_from_codes(codes, &deep_tree), "get tree from codes should reject too many nodes");
+
+    printf("test package-merge matches huffman when the limit isn't reached\n");
+    srand(42);
+    for (int k = 0; k < 100; k++) {
+        for (int i = 0; i < num_symbols; i++) {
+            frequencies[i] = rand() % 4 == 0 ? 0 : 1 + rand() % (1 << (rand() % 20));
+        }
+        uint8_t limited_lengths[num_symbols];
+        build_huffman_code_lengths(frequencies, code_lengths);
+        bool success = build_length_limited_code_lengths(frequencies, MAX_CODE_LENGTH, limited_lengths);
+        assert(success, "package-merge should succeed with a long enough limit");
+        assert_code_lengths_valid(limited_lengths, MAX_CODE_LENGTH);
+        assert(encoded_size_bits(frequencies, limited_lengths) == encoded_size_bits(frequencies, code_lengths),
+            "package-merge should be optimal");
+    }
+    code_lengths[0] = 0;
+    frequencies[0] = 1;
+    assert(encoded_size_bits(frequencies, code_lengths) == UINT64_MAX, 
+        "encoded size should be unbounded for a symbol without a code");
+
+    printf("test code lengths match the tree's\n");
+    for (int k = 0; k < 100; k++) {
+        // from a few symbols, to all of them
+        for (int i = 0; i < num_symbols; i++) {
+            frequencies[i] = rand() % num_symbols < k * 3 ? 1 + rand() % (1 << (rand() % 20)) : 0;
+        }
+        frequencies[rand() % num_symbols] += 1 + k;
+        huffman_tree tree;
+        uint8_t tree_lengths[num_symbols];
+        build_huffman_tree(frequencies, &tree);
+        get_code_lengths_from_tree(&tree, tree_lengths);
+        build_huffman_code_lengths(frequencies, code_lengths);
+        // (with a single symbol, the tree adds another)
+        if (k > 0) {
+            assert_code_lengths_valid(code_lengths, MAX_CODE_LENGTH);
+            assert(encoded_size_bits(frequencies, code_lengths) == encoded_size_bits(frequencies, tree_lengths),
+                "code lengths should be as short as the tree's");
+        }
+    }
+    memset(frequencies, 0, sizeof(frequencies));
+    frequencies['x'] = 5;
+    build_huffman_code_lengths(frequencies, code_lengths);
+    assert(code_lengths['x'] == 1 && encoded_size_bits(frequencies, code_lengths) == 5,
+        "a single symbol should have the only code");
+
+    printf("test package-merge respects the limit\n");
+    memset(frequencies, 0, sizeof(frequencies));
+    frequencies[0] = frequencies[1] = 1;
+    for (int i = 2; i < 51; i++) {
+        frequencies[i] = frequencies[i - 1] + frequencies[i - 2];
+    }
+    for (int limit = 6; limit <= 15; limit++) {
+        bool success = build_length_limited_code_lengths(frequencies, limit, code_lengths);
+        assert(success, "package-merge should succeed if the symbols fit");
+        assert_code_lengths_valid(code_lengths, limit);
+        for (int i = 1; i < 51; i++) {
+            assert(code_lengths[i] <= code_lengths[i - 1], "more frequent symbols should have shorter codes");
+        }
+    }
+    assert(!build_length_limited_code_lengths(frequencies, 5, code_lengths),
+        "package-merge should fail if the symbols can't fit in the limit");
+
+    printf("test oversubscribed code lengths are rejected\n");
+    memset(code_lengths, 0, sizeof(code_lengths));
+    code_lengths[0] = code_lengths[1] = code_lengths[2] = 1;
+    assert(decode_table_from_code_lengths(code_lengths) == NULL, "decode table should reject invalid lengths");
+    code_entry code_table[num_symbols];
+    assert(!get_code_table(code_lengths, code_table), "canonical codes should reject invalid lengths");
+
+    printf("test wide code lengths match huffman's\n");
+    long *wide_frequencies = calloc(NUM_WIDE_SYMBOLS, sizeof(long));
+    uint8_t *wide_lengths = malloc(NUM_WIDE_SYMBOLS);
+    for (int k = 0; k < 100; k++) {
+        for (int i = 0; i < num_symbols; i++) {
+            frequencies[i] = rand() % 4 == 0 ? 0 : 1 + rand() % (1 << (rand() % 20));
+            wide_frequencies[i] = frequencies[i];
+        }
+        build_huffman_code_lengths(frequencies, code_lengths);
+        assert(build_wide_code_lengths(wide_frequencies, 0, wide_lengths), "build wide code lengths should succeed");
+        assert(encoded_size_bits(wide_frequencies, wide_lengths) == encoded_size_bits(frequencies, code_lengths),
+            "wide code lengths should be optimal");
+        assert(build_length_limited_code_lengths(frequencies, 9, code_lengths), "package-merge should succeed");
+        assert(build_wide_code_lengths(wide_frequencies, 9, wide_lengths), "build wide code lengths should succeed");
+        assert(encoded_size_bits(wide_frequencies, wide_lengths) == encoded_size_bits(frequencies, code_lengths),
+            "limited wide code lengths should be optimal");
+    }
+    for (int i = 0; i < num_symbols; i++) {
+        wide_frequencies[i] = 0;
+    }
+    // every wide symbol, which need at least 16 bits
+    for (long i = 0; i < NUM_WIDE_SYMBOLS; i++) {
+        wide_frequencies[i] = 1 + i % 1000;
+    }
+    assert(!build_wide_code_lengths(wide_frequencies, 15, wide_lengths), 
+        "build wide code lengths should fail if the symbols can't fit in the limit");
+    assert(build_wide_code_lengths(wide_frequencies, 16, wide_lengths)
+        && build_wide_code_lengths(wide_frequencies, 0, wide_lengths), "build wide code lengths should succeed");
+    free(wide_frequencies);
+    free(wide_lengths);
+
+    printf("test wide symbols round trip\n");
+    const size_t n = 100003;
+    uint8_t *data = malloc(n);
+    // text in UTF-16: mostly ascii, and a few symbols past it
+    for (size_t i = 0; i < n; i += 2) {
+        int c = rand() % 10 == 0 ? 0x3b1 + rand() % 20 : 'a' + rand() % 26;
+        data[i] = c;
+        if (i + 1 < n) data[i + 1] = c >> 8;
+    }
+    for (int streams = 1; streams <= 5; streams++) {
+        test_wide_round_trip(data, n, streams, 0);
+        test_wide_round_trip(data, n - 1, streams, 0);
+    }
+    for (size_t length = 0; length < 20; length++) {
+        test_wide_round_trip(data, length, 4, 0);
+        test_wide_round_trip(data, length, 3, 0);
+    }
+    // long codes, which need subtables
+    for (size_t i = 0; i < n; i++) {
+        data[i] = rand();
+    }
+    test_wide_round_trip(data, n, 4, 0);
+    test_wide_round_trip(data, n, 4, 17);
+    free(data);
 
     return 0;
 }
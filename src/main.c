@@ -4,162 +4,1504 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "bitstring.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ans.h"
+#include "block.h"
+#include "codec.h"
+#include "context.h"
+#include "format.h"
+#include "histogram.h"
 #include "huffman.h"
+#include "mapfile.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "writeutils.h"
+
+typedef struct {
+    // 0 for no limit (other than MAX_CODE_LENGTH)
+    int max_code_length;
+    // number of threads encoding or decoding blocks
+    int num_threads;
+    // end compressed files with an index of their blocks
+    bool write_index;
+    // number of interleaved streams each block is split into
+    int num_streams;
+    // read the source only once, giving each block its own code table
+    bool streaming;
+    // print where the time went, and what came of it
+    bool stats;
+    // code each symbol with a code chosen by the symbol before it, when that's smaller
+    bool order1;
+    // code blocks with tANS rather than a prefix code
+    bool ans;
+    // code pairs of bytes as 16 bit symbols
+    bool wide;
+    // give each block a checksum of its content, to check it against when decompressing
+    bool checksums;
+    // bytes of source per block, or 0 to choose from the source's size, the threads and the cache
+    size_t block_size;
+    // a table file (made by --train) to code with, which compressed files refer to
+    // rather than carrying a code of their own, or NULL
+    const char *table_filename;
+    // compress lines as records, each of which can be decompressed on its own
+    bool records;
+    // decompress only this record of a file of records, or -1 for all of them
+    long long record;
+    // decompress only this range of what a file of blocks decompresses to
+    bool range;
+    uint64_t range_offset;
+    size_t range_length;
+} program_options;
+
+
+// shared state for encoding the blocks of a file
+typedef struct {
+    FILE *f_src;
+    // the source's content, if it's mapped (then blocks are read straight from it)
+    const mapped_file *src_map;
+    size_t src_position;
+    FILE *f_dest;
+    // the code for the whole file, or NULL if each block chooses its own
+    const code_entry *codes;
+    // if the file has an order-1 code instead, its code for each context
+    const code_entry *const *context_codes;
+    // or if blocks are coded with tANS, its table
+    const ans_encode_table *ans_table;
+    // or if they're coded as wide symbols, their code
+    const code_entry *wide_codes;
+    int max_code_length;
+    size_t block_size;
+    int num_streams;
+    // give each block a checksum
+    bool checksums;
+    // when blocks choose their own code, the current one
+    // (that of the last block with a code table)
+    current_code current;
+    // a block's code couldn't be limited to max_code_length
+    bool codes_failed;
+    // NULL if not keeping stats
+    run_stats *stats;
+
+    // where the next block will be written
+    uint64_t offset;
+    // index of the blocks written so far
+    block_index_entry *index;
+    uint64_t num_blocks;
+    uint64_t index_capacity;
+    // the index couldn't grow (which has been said)
+    bool index_failed;
+} compress_context;
+
+// a block of the source, and its encoding
+typedef struct {
+    unsigned char *buf;
+    // the block: in `buf`, or in the mapped source
+    const unsigned char *data;
+    size_t length;
+    uint8_t *encoded;
+    size_t encoded_size;
+    // when blocks choose their own code, the block's code,
+    // and its packed table (of num_symbols + 1 bytes), if it has one
+    code_entry *codes;
+    uint8_t *table;
+    size_t table_size;
+    // time encoding, and finding the checksum, for the stats
+    phase_time encode_time;
+    phase_time checksum_time;
+} block_job;
+
+bool read_source_block(void *context, void *slot) {
+    compress_context *c = context;
+    block_job *job = slot;
+    phase_time start = stats_clock(c->stats);
+    if (c->src_map != NULL) {
+        size_t remaining = c->src_map->size - c->src_position;
+        job->data = c->src_map->data + c->src_position;
+        job->length = remaining < c->block_size ? remaining : c->block_size;
+        c->src_position += job->length;
+    }else {
+        job->data = job->buf;
+        job->length = fread(job->buf, sizeof(unsigned char), c->block_size, c->f_src);
+    }
+    stats_phase_done(c->stats, PHASE_READ, &start);
+    if (job->length == 0 || c->codes != NULL) {
+        return job->length > 0;
+    }
+
+    // blocks are read in order, so they can keep track of the current code
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    start = stats_clock(c->stats);
+    histogram(job->data, job->length, symbol_frequencies);
+    stats_phase_done(c->stats, PHASE_HISTOGRAM, &start);
+
+    start = stats_clock(c->stats);
+    if (!choose_code_for_frequencies(symbol_frequencies, c->max_code_length, &c->current,
+                                     job->codes, job->table, &job->table_size)) {
+        c->codes_failed = true;
+        return false;
+    }
+    stats_phase_done(c->stats, PHASE_CODES, &start);
+    stats_count_codes(c->stats, symbol_frequencies, job->codes);
+    return true;
+}
+
+void encode_source_block(void *context, void *slot) {
+    compress_context *c = context;
+    block_job *job = slot;
+    job->encode_time = (phase_time) { .wall = 0, .cpu = 0 };
+    phase_time start = stats_clock(c->stats);
+    if (c->context_codes != NULL) {
+        job->encoded_size = encode_context_block(job->data, job->length, c->context_codes, c->num_streams, job->encoded);
+    }else if (c->ans_table != NULL) {
+        job->encoded_size = encode_ans_block(job->data, job->length, c->ans_table, c->num_streams, job->encoded);
+    }else if (c->wide_codes != NULL) {
+        job->encoded_size = encode_wide_block(job->data, job->length, c->wide_codes, c->num_streams, job->encoded);
+    }else if (c->codes != NULL) {
+        job->encoded_size = encode_block(job->data, job->length, c->codes, c->num_streams, NULL, 0, job->encoded);
+    }else {
+        job->encoded_size = encode_block(job->data, job->length, job->codes, c->num_streams, 
+                                         job->table, job->table_size, job->encoded);
+    }
+    stats_add_since(c->stats, &start, &job->encode_time);
+
+    job->checksum_time = (phase_time) { .wall = 0, .cpu = 0 };
+    if (c->checksums) {
+        start = stats_clock(c->stats);
+        set_block_checksum(job->encoded, job->data, job->length);
+        stats_add_since(c->stats, &start, &job->checksum_time);
+    }
+}
+
+bool write_encoded_block(void *context, void *slot) {
+    compress_context *c = context;
+    block_job *job = slot;
+
+    if (c->num_blocks == c->index_capacity) {
+        size_t size = sizeof(block_index_entry) * c->index_capacity * 2;
+        block_index_entry *index = realloc(c->index, size);
+        if (index == NULL) {
+            fprintf(stderr, "not enough memory for %zu bytes\n", size);
+            c->index_failed = true;
+            return false;
+        }
+        c->index = index;
+        c->index_capacity *= 2;
+    }
+    c->index[c->num_blocks++] = (block_index_entry) {
+        .offset = c->offset,
+        .length = job->length
+    };
+    c->offset += job->encoded_size;
 
-void compress(const char *src_filename, const char *dest_filename) {
+    // (the stats for reading and choosing codes are kept by the reader, and these by the writer)
+    stats_add_time(c->stats, PHASE_ENCODE, &job->encode_time);
+    stats_add_time(c->stats, PHASE_CHECKSUM, &job->checksum_time);
+    stats_add_sizes(c->stats, job->length, 0);
+    phase_time start = stats_clock(c->stats);
+    bool written = fwrite(job->encoded, sizeof(uint8_t), job->encoded_size, c->f_dest) == job->encoded_size;
+    stats_phase_done(c->stats, PHASE_WRITE, &start);
+    return written;
+}
+
+const pipeline_stages compress_stages = {
+    .read = read_source_block,
+    .work = encode_source_block,
+    .write = write_encoded_block
+};
+
+// open a file, or stdin / stdout for "-"
+FILE *open_file(const char *filename, const char *mode) {
+    if (strcmp(filename, "-") == 0) {
+        return mode[0] == 'r' ? stdin : stdout;
+    }
+    return fopen(filename, mode);
+}
 
-    FILE *f_src = fopen(src_filename, "rb");
+// count pairs of symbols in the blocks `data` will be split into
+void count_block_pairs(const symbol *data, size_t length, size_t block_size, int num_streams, long *pair_frequencies) {
+    for (size_t start = 0; start < length; start += block_size) {
+        size_t n = length - start < block_size ? length - start : block_size;
+        count_context_pairs(data + start, n, num_streams, pair_frequencies);
+    }
+}
+
+// count the symbols coded with each group of an order-1 code, and the lengths of their codes
+void count_context_stats(run_stats *stats, const context_code *code, const long *pair_frequencies,
+                         const code_entry *group_codes) {
+    if (stats == NULL) {
+        return;
+    }
+    for (int g = 0; g < code->num_groups; g++) {
+        long symbol_frequencies[num_symbols];
+        memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+        for (int c = 0; c < NUM_CONTEXTS; c++) {
+            for (int s = 0; code->group_of[c] == g && s < num_symbols; s++) {
+                symbol_frequencies[s] += pair_frequencies[c * num_symbols + s];
+            }
+        }
+        stats_count_codes(stats, symbol_frequencies, group_codes + g * num_symbols);
+    }
+}
+
+// count the bytes wide symbols are made of, for the stats
+void count_wide_stats(run_stats *stats, const long *wide_frequencies) {
+    if (stats == NULL) {
+        return;
+    }
+    long symbol_frequencies[num_symbols];
+    memset(symbol_frequencies, 0, sizeof(symbol_frequencies));
+    for (long s = 0; s < NUM_WIDE_SYMBOLS; s++) {
+        symbol_frequencies[s & 0xff] += wide_frequencies[s];
+        symbol_frequencies[s >> 8] += wide_frequencies[s];
+    }
+    stats_count_codes(stats, symbol_frequencies, NULL);
+}
+
+// read the code lengths of a table file (see write_table_file), and its ID
+void load_table(const char *filename, uint8_t *code_lengths, uint32_t *idp) {
+    FILE *f = open_file(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open %s\n", filename);
+        exit(1);
+    }
+    if (!read_table_file(code_lengths, idp, f)) {
+        fprintf(stderr, "%s is not a table file (or is from another version)\n", filename);
+        fclose(f);
+        exit(1);
+    }
+    fclose(f);
+}
+
+// build a table from samples of what's to be compressed, for compressed files to share.
+// every byte gets a code, so anything can be coded with it
+void train(const char *src_filename, const char *dest_filename, const program_options *options) {
+    FILE *f_src = open_file(src_filename, "rb");
     if (f_src == NULL) {
         fprintf(stderr, "failed to open %s\n", src_filename);
         exit(1);
     }
-    
-    long *symbol_frequencies = calloc(num_symbols, sizeof(long));
+    // (bytes missing from the samples count once)
+    long symbol_frequencies[num_symbols];
+    for (int i = 0; i < num_symbols; i++) {
+        symbol_frequencies[i] = 1;
+    }
+    unsigned char *buf = malloc(1 << 16);
+    size_t nread;
+    while ((nread = fread(buf, sizeof(unsigned char), 1 << 16, f_src)) > 0) {
+        histogram(buf, nread, symbol_frequencies);
+    }
+    free(buf);
+    bool read = !ferror(f_src);
+    fclose(f_src);
+    if (!read) {
+        fprintf(stderr, "error reading %s\n", src_filename);
+        exit(1);
+    }
 
-    int capacity = 1 << 15;  // TODO: find a good size
-    unsigned char *buf = malloc(sizeof(unsigned char) * capacity);
-    int nread;
-    while ((nread = fread(buf, sizeof(unsigned char), capacity, f_src)) > 0) {
-        for (int i = 0; i < nread; i++) {
-            symbol_frequencies[buf[i]]++;
+    uint8_t code_lengths[num_symbols];
+    if (!build_code_lengths(symbol_frequencies, options->max_code_length, code_lengths)) {
+        fprintf(stderr, "too many different bytes for codes of at most %d bits\n", options->max_code_length);
+        exit(1);
+    }
+    FILE *f_dest = open_file(dest_filename, "wb");
+    if (f_dest == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", dest_filename);
+        exit(1);
+    }
+    bool saved = write_table_file(code_lengths, f_dest);
+    if (fclose(f_dest) != 0 || !saved) {
+        fprintf(stderr, "error saving table\n");
+        exit(1);
+    }
+}
+
+// read the rest of a file into memory, after `prefix_size` bytes of `prefix` (already read from it).
+// returns NULL on failure
+uint8_t *read_rest(FILE *f, const uint8_t *prefix, size_t prefix_size, size_t *sizep) {
+    size_t capacity = prefix_size + (1 << 16);
+    uint8_t *data = malloc(capacity);
+    if (prefix_size > 0) {
+        memcpy(data, prefix, prefix_size);
+    }
+    size_t size = prefix_size;
+    size_t nread;
+    while ((nread = fread(data + size, sizeof(uint8_t), capacity - size, f)) > 0) {
+        size += nread;
+        if (size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
         }
     }
+    if (ferror(f)) {
+        free(data);
+        return NULL;
+    }
+    *sizep = size;
+    return data;
+}
 
-    tree_node *tree = build_huffman_tree(symbol_frequencies);
-    free(symbol_frequencies);
+// a table file, for the codec
+codec_table *load_codec_table(const char *filename) {
+    uint8_t code_lengths[num_symbols];
+    uint32_t id;
+    load_table(filename, code_lengths, &id);
+    uint8_t packed[MAX_TABLE_FILE_SIZE];
+    codec_status status;
+    codec_table *table = codec_table_new(packed, pack_table_file(code_lengths, packed), &status);
+    if (table == NULL) {
+        fprintf(stderr, "%s is not a valid code (%s)\n", filename, codec_status_message(status));
+        exit(1);
+    }
+    return table;
+}
 
-    bitstring **codes = get_codes_from_tree(tree);
-    tree_delete(tree);
+// compress the lines of the source (each keeping its newline) as records, each of which can be
+// decompressed on its own, with one code for them all (or a shared table)
+void compress_records_file(const char *src_filename, const char *dest_filename, const program_options *options) {
+    FILE *f_src = open_file(src_filename, "rb");
+    if (f_src == NULL) {
+        fprintf(stderr, "failed to open %s\n", src_filename);
+        exit(1);
+    }
+    mapped_file src_map;
+    bool src_mapped = map_for_reading(fileno(f_src), &src_map);
+    if (!src_mapped) {
+        src_map.data = read_rest(f_src, NULL, 0, &src_map.size);
+        if (src_map.data == NULL) {
+            fprintf(stderr, "error reading %s\n", src_filename);
+            fclose(f_src);
+            exit(1);
+        }
+    }
+    fclose(f_src);
+
+    size_t num_records = 0;
+    size_t records_capacity = 1 << 10;
+    const uint8_t **records = malloc(sizeof(uint8_t *) * records_capacity);
+    size_t *lengths = malloc(sizeof(size_t) * records_capacity);
+    for (size_t start = 0; start < src_map.size; start += lengths[num_records++]) {
+        if (num_records == records_capacity) {
+            records_capacity *= 2;
+            records = realloc(records, sizeof(uint8_t *) * records_capacity);
+            lengths = realloc(lengths, sizeof(size_t) * records_capacity);
+        }
+        const uint8_t *newline = memchr(src_map.data + start, '\n', src_map.size - start);
+        records[num_records] = src_map.data + start;
+        lengths[num_records] = newline != NULL ? (size_t)(newline - records[num_records]) + 1 : src_map.size - start;
+    }
+
+    codec_table *table = options->table_filename != NULL ? load_codec_table(options->table_filename) : NULL;
+    encoder_options codec_options = {
+        .block_size = 1,
+        .num_streams = 1,
+        .max_code_length = options->max_code_length,
+        .table = table
+    };
+    size_t bound = compress_records_bound(num_records, src_map.size, &codec_options);
+    uint8_t *compressed = malloc(bound);
+    size_t compressed_size;
+    codec_status status = compress_records(records, lengths, num_records, compressed, bound, &compressed_size,
+                                           &codec_options);
+    free(records);
+    free(lengths);
+    codec_table_delete(table);
+    if (src_mapped) {
+        unmap(&src_map);
+    }else {
+        free(src_map.data);
+    }
+    if (status != CODEC_OK) {
+        fprintf(stderr, "error compressing %s: %s\n", src_filename, codec_status_message(status));
+        free(compressed);
+        exit(1);
+    }
+
+    FILE *f_dest = open_file(dest_filename, "wb");
+    if (f_dest == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", dest_filename);
+        free(compressed);
+        exit(1);
+    }
+    bool saved = fwrite(compressed, sizeof(uint8_t), compressed_size, f_dest) == compressed_size;
+    free(compressed);
+    if (fclose(f_dest) != 0 || !saved) {
+        fprintf(stderr, "error saving content\n");
+        exit(1);
+    }
+}
+
+// the whole of a compressed file (whose header has been read) in memory, closing it:
+// mapped if it can be, so only the parts of it that are used are read, or else read in.
+// returns whether it was mapped
+bool load_compressed(FILE *f_src, const file_header *header, const char *src_filename, mapped_file *src_map) {
+    bool mapped = map_for_reading(fileno(f_src), src_map);
+    if (!mapped) {
+        uint8_t header_bytes[file_header_size];
+        put_file_header(header, header_bytes);
+        src_map->data = read_rest(f_src, header_bytes, file_header_size, &src_map->size);
+        if (src_map->data == NULL) {
+            fprintf(stderr, "error reading %s\n", src_filename);
+            fclose(f_src);
+            exit(1);
+        }
+    }
+    fclose(f_src);
+    return mapped;
+}
+
+void unload_compressed(mapped_file *src_map, bool mapped) {
+    if (mapped) {
+        unmap(src_map);
+    }else {
+        free(src_map->data);
+    }
+}
+
+// exit with why the codec failed to decompress a file
+void decompress_failed(const char *src_filename, codec_status status) {
+    if (status == CODEC_WRONG_TABLE) {
+        fprintf(stderr, "%s was compressed with a table, which decompressing it needs (--table), "
+                "and not another\n", src_filename);
+    }else {
+        fprintf(stderr, "error decompressing %s: %s\n", src_filename, codec_status_message(status));
+    }
+    exit(1);
+}
+
+// decompress a file of records (whose header has been read): all of them, one after another,
+// or just options->record. when the source can be mapped, only that record's part of it is read.
+// with no dest_filename, only decode them, to test them
+void decompress_records_file(FILE *f_src, const file_header *header, const char *src_filename,
+                             const char *dest_filename, const program_options *options) {
+    mapped_file src_map;
+    bool src_mapped = load_compressed(f_src, header, src_filename, &src_map);
+
+    codec_table *table = options->table_filename != NULL ? load_codec_table(options->table_filename) : NULL;
+    codec_status status;
+    record_reader *reader = record_reader_new(src_map.data, src_map.size, table, &status);
+    FILE *f_dest = reader != NULL && dest_filename != NULL ? open_file(dest_filename, "wb") : NULL;
+    if (reader != NULL && dest_filename != NULL && f_dest == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", dest_filename);
+        exit(1);
+    }
+    uint64_t first = options->record >= 0 ? (uint64_t)options->record : 0;
+    uint64_t end = reader == NULL ? 0 : options->record >= 0 ? first + 1 : record_count(reader);
+    uint8_t *decoded = NULL;
+    size_t capacity = 0;
+    bool saved = true;
+    for (uint64_t i = first; i < end && status == CODEC_OK && saved; i++) {
+        uint64_t length;
+        status = record_length(reader, i, &length);
+        if (status == CODEC_OK && length > capacity) {
+            capacity = length;
+            free(decoded);
+            decoded = malloc(capacity);
+            if (decoded == NULL) {
+                status = CODEC_OUT_OF_MEMORY;
+            }
+        }
+        size_t decoded_length;
+        if (status == CODEC_OK && (status = read_record(reader, i, decoded, capacity, &decoded_length)) == CODEC_OK) {
+            saved = f_dest == NULL || fwrite(decoded, sizeof(uint8_t), decoded_length, f_dest) == decoded_length;
+        }
+    }
+    free(decoded);
+    record_reader_delete(reader);
+    codec_table_delete(table);
+    unload_compressed(&src_map, src_mapped);
+    saved = (f_dest == NULL || fclose(f_dest) == 0) && saved;
+
+    if (status != CODEC_OK) {
+        decompress_failed(src_filename, status);
+    }
+    if (!saved) {
+        fprintf(stderr, "error saving content\n");
+        exit(1);
+    }
+}
+
+// decompress only options->range_length bytes from options->range_offset of a file of blocks
+// (whose header has been read), decoding only the blocks they're in
+void decompress_range_file(FILE *f_src, const file_header *header, const char *src_filename,
+                           const char *dest_filename, const program_options *options) {
+    mapped_file src_map;
+    bool src_mapped = load_compressed(f_src, header, src_filename, &src_map);
+
+    codec_table *table = options->table_filename != NULL ? load_codec_table(options->table_filename) : NULL;
+    uint8_t *decoded = malloc(options->range_length > 0 ? options->range_length : 1);
+    if (decoded == NULL) {
+        fprintf(stderr, "not enough memory for %zu bytes\n", options->range_length);
+        exit(1);
+    }
+    size_t decoded_length;
+    codec_status status = decompress_range(src_map.data, src_map.size, options->range_offset, options->range_length,
+                                           decoded, options->range_length, &decoded_length, table);
+    codec_table_delete(table);
+    unload_compressed(&src_map, src_mapped);
+    if (status != CODEC_OK) {
+        decompress_failed(src_filename, status);
+    }
+
+    FILE *f_dest = open_file(dest_filename, "wb");
+    if (f_dest == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", dest_filename);
+        exit(1);
+    }
+    bool saved = fwrite(decoded, sizeof(uint8_t), decoded_length, f_dest) == decoded_length;
+    free(decoded);
+    if (fclose(f_dest) != 0 || !saved) {
+        fprintf(stderr, "error saving content\n");
+        exit(1);
+    }
+}
+
+void compress(const char *src_filename, const char *dest_filename, const program_options *options) {
+
+    run_stats *stats = options->stats ? stats_new(true) : NULL;
+    FILE *f_src = open_file(src_filename, "rb");
+    if (f_src == NULL) {
+        fprintf(stderr, "failed to open %s\n", src_filename);
+        exit(1);
+    }
+    // a pipe can't be read twice
+    bool streaming = options->streaming || fseek(f_src, 0, SEEK_CUR) != 0;
+    if (streaming && (options->order1 || options->ans || options->wide)) {
+        fprintf(stderr, "%s codes need the whole source counted first, so can't be streamed\n",
+                options->order1 ? "order-1" : options->ans ? "tANS" : "wide");
+        fclose(f_src);
+        exit(1);
+    }
+    // with a shared table, there's nothing to count, and blocks never need codes of their own
+    bool shared = options->table_filename != NULL;
+    bool block_tables = streaming && !shared;
+    size_t capacity = options->block_size;
+    if (capacity == 0) {
+        struct stat src_stat;
+        uint64_t src_size = !streaming && fstat(fileno(f_src), &src_stat) == 0 ? src_stat.st_size : UINT64_MAX;
+        capacity = choose_block_size(src_size, options->num_threads, block_tables);
+    }
+    // (so blocks hold whole wide symbols)
+    if (options->wide) {
+        capacity += capacity % 2;
+    }
+    unsigned char *buf = malloc(sizeof(unsigned char) * capacity);
+
+    // when it can be, read the source through a mapping, rather than copying it into buffers
+    mapped_file src_map;
+    bool src_mapped = !streaming && map_for_reading(fileno(f_src), &src_map);
+
+    uint8_t code_lengths[num_symbols];
+    code_entry codes[num_symbols];
+    // with an order-1 code (if it's worth having), each group's code, and the code for each context
+    context_code *order1_code = NULL;
+    code_entry *group_codes = NULL;
+    const code_entry *context_codes[NUM_CONTEXTS];
+    // or with tANS, the normalised counts and their table
+    uint16_t ans_counts[num_symbols];
+    ans_encode_table *ans_table = NULL;
+    // or with wide symbols, their code
+    uint8_t *wide_lengths = NULL;
+    code_entry *wide_codes = NULL;
+    uint32_t shared_id = 0;
+    if (shared) {
+        phase_time start = stats_clock(stats);
+        load_table(options->table_filename, code_lengths, &shared_id);
+        if (!get_code_table(code_lengths, codes)) {
+            fprintf(stderr, "%s is not a valid code\n", options->table_filename);
+            fclose(f_src);
+            free(buf);
+            exit(1);
+        }
+        stats_phase_done(stats, PHASE_CODES, &start);
+    }else if (!streaming) {
+        long *symbol_frequencies = calloc(num_symbols, sizeof(long));
+        long *wide_frequencies = options->wide ? calloc(NUM_WIDE_SYMBOLS, sizeof(long)) : NULL;
+        // (how often each symbol follows each other)
+        long *pair_frequencies = options->order1 ? calloc(NUM_CONTEXTS * num_symbols, sizeof(long)) : NULL;
+        if (src_mapped) {
+            phase_time start = stats_clock(stats);
+            if (wide_frequencies != NULL) {
+                wide_histogram(src_map.data, src_map.size, wide_frequencies);
+            }else {
+                histogram(src_map.data, src_map.size, symbol_frequencies);
+            }
+            if (pair_frequencies != NULL) {
+                count_block_pairs(src_map.data, src_map.size, capacity, options->num_streams, pair_frequencies);
+            }
+            stats_phase_done(stats, PHASE_HISTOGRAM, &start);
+        }else {
+            while (true) {
+                phase_time start = stats_clock(stats);
+                int nread = fread(buf, sizeof(unsigned char), capacity, f_src);
+                stats_phase_done(stats, PHASE_READ, &start);
+                if (nread <= 0) {
+                    break;
+                }
+                start = stats_clock(stats);
+                if (wide_frequencies != NULL) {
+                    wide_histogram(buf, nread, wide_frequencies);
+                }else {
+                    histogram(buf, nread, symbol_frequencies);
+                }
+                if (pair_frequencies != NULL) {
+                    count_context_pairs(buf, nread, options->num_streams, pair_frequencies);
+                }
+                stats_phase_done(stats, PHASE_HISTOGRAM, &start);
+            }
+            rewind(f_src);
+        }
+        phase_time start = stats_clock(stats);
+        if (options->ans) {
+            normalize_frequencies(symbol_frequencies, ans_counts);
+            ans_table = malloc(sizeof(ans_encode_table));
+            ans_encode_table_init(ans_counts, ans_table);
+            stats_phase_done(stats, PHASE_CODES, &start);
+            stats_count_codes(stats, symbol_frequencies, NULL);
+        }
+        if (wide_frequencies != NULL) {
+            wide_lengths = malloc(sizeof(uint8_t) * NUM_WIDE_SYMBOLS);
+            wide_codes = malloc(sizeof(code_entry) * NUM_WIDE_SYMBOLS);
+        }
+        bool built = wide_frequencies != NULL 
+            ? build_wide_code_lengths(wide_frequencies, options->max_code_length, wide_lengths)
+            : options->ans || build_code_lengths(symbol_frequencies, options->max_code_length, code_lengths);
+        if (built && pair_frequencies != NULL) {
+            order1_code = malloc(sizeof(context_code));
+            built = build_context_code(pair_frequencies, options->max_code_length, order1_code);
+            // (one group is no better than the plain code)
+            if (!built || order1_code->num_groups == 1) {
+                free(order1_code);
+                order1_code = NULL;
+            }
+        }
+        if (!built) {
+            fprintf(stderr, "too many different %s for codes of at most %d bits\n", 
+                    options->wide ? "symbols" : "bytes", options->max_code_length);
+            fclose(f_src);
+            free(buf);
+            exit(1);
+        }
+        if (wide_frequencies != NULL) {
+            get_wide_code_table(wide_lengths, wide_codes);
+            stats_phase_done(stats, PHASE_CODES, &start);
+            count_wide_stats(stats, wide_frequencies);
+        }else if (order1_code != NULL) {
+            group_codes = malloc(sizeof(code_entry) * order1_code->num_groups * num_symbols);
+            get_context_code_tables(order1_code, group_codes, context_codes);
+            stats_phase_done(stats, PHASE_CODES, &start);
+            count_context_stats(stats, order1_code, pair_frequencies, group_codes);
+        }else if (!options->ans) {
+            get_code_table(code_lengths, codes);
+            stats_phase_done(stats, PHASE_CODES, &start);
+            stats_count_codes(stats, symbol_frequencies, codes);
+        }
+        free(symbol_frequencies);
+        free(pair_frequencies);
+        free(wide_frequencies);
+    }
 
     // TODO: don't overwrite an existing file -- (avoid race condition when fix)
-    FILE *f_dest = fopen(dest_filename, "wb");
+    FILE *f_dest = open_file(dest_filename, "wb");
     if (f_dest == NULL) {
         fprintf(stderr, "failed to open %s for writing\n", dest_filename);
         
         fclose(f_src);
-        delete_codes(codes);
+        free(buf);
 
         exit(1);
     }
 
-    // write the symbols' codes
-    bitstring *empty_bitstring = bitstring_new_empty();
-    for (int i = 0; i < num_symbols; i++) {
-        
-        const bitstring *code = (codes[i] == NULL) ? empty_bitstring : codes[i];
-        bool success = bitstring_write(code, f_dest);
+    // write the header and (unless each block has its own) symbols' code lengths, the order-1 code,
+    // tANS counts, wide symbols' code lengths, or the shared table's ID
+    file_header header = {
+        .flags = (options->write_index ? FLAG_BLOCK_INDEX : 0) | (block_tables ? FLAG_BLOCK_TABLES : 0)
+               | (order1_code != NULL ? FLAG_CONTEXT_CODE : 0) | (ans_table != NULL ? FLAG_ANS_CODE : 0)
+               | (wide_codes != NULL ? FLAG_WIDE_SYMBOLS : 0) | (shared ? FLAG_SHARED_TABLE : 0)
+               | (options->checksums ? FLAG_BLOCK_CHECKSUMS : 0),
+        .num_streams = options->num_streams
+    };
+    // (the biggest of them)
+    uint8_t *packed = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+    put_uint(shared_id, packed);
+    size_t table_size = block_tables ? 0 
+                      : shared ? sizeof(uint32_t)
+                      : order1_code != NULL ? pack_context_code(order1_code, packed) 
+                      : ans_table != NULL ? pack_ans_counts(ans_counts, packed)
+                      : wide_codes != NULL ? pack_wide_code_lengths(wide_lengths, packed) : pack_code_lengths(code_lengths, packed);
+    bool saved = write_file_header(&header, f_dest) && fwrite(packed, sizeof(uint8_t), table_size, f_dest) == table_size;
+    free(packed);
+    if (!saved) {
+        fprintf(stderr, "error saving codes\n");
+
+        fclose(f_src);
+        fclose(f_dest);
+        free(buf);
+
+        exit(1);
+    }
+
+    // encode blocks in parallel, using a few spare slots per thread
+    // so workers don't wait for the reader or writer.
+    // (the destination mightn't be seekable, so count the offsets of blocks ourselves)
+    compress_context context = {
+        .f_src = f_src,
+        .src_map = src_mapped ? &src_map : NULL,
+        .src_position = 0,
+        .f_dest = f_dest,
+        .codes = block_tables ? NULL : codes,
+        .context_codes = order1_code != NULL ? context_codes : NULL,
+        .ans_table = ans_table,
+        .wide_codes = wide_codes,
+        .max_code_length = options->max_code_length,
+        .block_size = capacity,
+        .num_streams = options->num_streams,
+        .checksums = options->checksums,
+        .current = { .lengths = malloc(sizeof(uint8_t) * num_symbols), .has_code = false },
+        .codes_failed = false,
+        .stats = stats,
+        .offset = file_header_size + table_size,
+        .index = malloc(sizeof(block_index_entry) * 16),
+        .num_blocks = 0,
+        .index_capacity = 16,
+        .index_failed = false
+    };
+    int num_slots = options->num_threads <= 1 ? 1 : 4 * options->num_threads;
+    block_job *jobs = malloc(sizeof(block_job) * num_slots);
+    void **slots = malloc(sizeof(void *) * num_slots);
+    size_t encoded_capacity = block_tables ? chosen_block_bound(capacity, options->num_streams) 
+                            : order1_code != NULL ? context_block_bound(capacity, options->num_streams, order1_code)
+                            : ans_table != NULL ? ans_block_bound(capacity, options->num_streams)
+                            : wide_codes != NULL ? wide_block_bound(capacity, options->num_streams, wide_codes)
+                                                 : block_bound(capacity, options->num_streams, codes);
+    for (int i = 0; i < num_slots; i++) {
+        // (a mapped source needs no buffers)
+        jobs[i].buf = i == 0 ? buf : (src_mapped ? NULL : malloc(sizeof(unsigned char) * capacity));
+        jobs[i].encoded = malloc(sizeof(uint8_t) * encoded_capacity);
+        jobs[i].codes = block_tables ? malloc(sizeof(code_entry) * num_symbols) : NULL;
+        jobs[i].table = block_tables ? malloc(sizeof(uint8_t) * (num_symbols + 1)) : NULL;
+        slots[i] = &jobs[i];
+    }
+
+    bool success = run_pipeline(&compress_stages, &context, slots, num_slots, options->num_threads)
+                && write_end_of_blocks(f_dest);
+    // after the empty block marking the end
+    uint64_t index_offset = context.offset + END_OF_BLOCKS_SIZE;
+    if (success && options->write_index) {
+        success = write_block_index(context.index, context.num_blocks, index_offset, f_dest);
+    }
+    stats_add_sizes(stats, 0, index_offset + (options->write_index ? block_index_size(context.num_blocks) : 0));
+
+    for (int i = 0; i < num_slots; i++) {
+        free(jobs[i].buf);
+        free(jobs[i].encoded);
+        free(jobs[i].codes);
+        free(jobs[i].table);
+    }
+    free(jobs);
+    free(slots);
+    free(context.index);
+    free(context.current.lengths);
+    free(order1_code);
+    free(group_codes);
+    free(ans_table);
+    free(wide_lengths);
+    free(wide_codes);
+    if (src_mapped) {
+        unmap(&src_map);
+    }
+    fclose(f_src);
+    success = fclose(f_dest) == 0 && success;
+
+    if (context.codes_failed) {
+        fprintf(stderr, "too many different bytes for codes of at most %d bits\n", options->max_code_length);
+        exit(1);
+    }
+    if (context.index_failed) {
+        exit(1);
+    }
+    if (!success) {
+        fprintf(stderr, "error saving content\n");
+        exit(1);
+    }
+    print_stats(stats, stderr);
+    stats_delete(stats);
+}
 
+// find the decoded length of the block at `offset` in a mapped file (with these flags).
+// returns false if its header is malformed, or it doesn't fit in the file
+bool parse_mapped_block(const mapped_file *src, uint64_t offset, int num_streams, uint8_t flags,
+                        size_t *decoded_lengthp) {
+    size_t block_size;
+    return offset <= src->size && src->size - offset >= block_header_size(num_streams)
+        && parse_block_header(src->data + offset, num_streams, flags, decoded_lengthp, &block_size)
+        && block_size <= src->size - offset;
+}
+
+// the code for a whole file: its code lengths (and their table), an order-1 code, tANS counts' table,
+// or wide symbols' table. all NULL if blocks bring their own codes
+typedef struct {
+    const uint8_t *lengths;
+    const decode_table *table;
+    // the entries for each context of an order-1 code
+    const decode_entry *const *contexts;
+    const ans_decode_table *ans;
+    const decode_table *wide;
+} file_code;
+
+// decode a block with the file's code (as blocks are, until one brings a code of its own).
+// returns false if the block is malformed, or the file has no code
+bool decode_with_file_code(const uint8_t *block, int num_streams, const file_code *code, symbol *out) {
+    if (code->contexts != NULL) {
+        return decode_context_block(block, num_streams, code->contexts, out);
+    }
+    if (code->ans != NULL) {
+        return decode_ans_block(block, num_streams, code->ans, out);
+    }
+    if (code->wide != NULL) {
+        return decode_wide_block(block, num_streams, code->wide, out);
+    }
+    return code->table != NULL && decode_block(block, num_streams, code->table, out);
+}
+
+// time decoding, for the stats
+typedef struct {
+    phase_time decode;
+    phase_time checksum;
+} block_times;
+
+// shared state for decoding the blocks of a mapped file, straight into the mapped output
+typedef struct {
+    const mapped_file *src;
+    // or if NULL, when testing, into a buffer for each block, which is dropped
+    uint8_t *dest;
+    int num_streams;
+    // the file's
+    uint8_t flags;
+    // check blocks against their checksums
+    bool checksums;
+    const file_code *file;
+    // the decode table of each code blocks bring with them,
+    // and which each block is decoded with (-1 for the file's)
+    decode_table *const *block_tables;
+    const long *code_of_block;
+    const block_index_entry *index;
+    // where each block's content starts in the decompressed file
+    const uint64_t *output_offsets;
+    // NULL if not keeping stats, and otherwise the time each block took
+    run_stats *stats;
+    block_times *times;
+} decompress_context;
+
+// decode a block into its place in the output
+bool decompress_block(void *context, long i) {
+    decompress_context *c = context;
+    const uint8_t *block = c->src->data + c->index[i].offset;
+    size_t decoded_length;
+    if (!parse_mapped_block(c->src, c->index[i].offset, c->num_streams, c->flags, &decoded_length)
+        || decoded_length != c->index[i].length) {
+        return false;
+    }
+
+    // (blocks which share a code share its table, which is only read)
+    phase_time start = stats_clock(c->stats);
+    symbol *out = c->dest != NULL ? c->dest + c->output_offsets[i] : malloc(decoded_length > 0 ? decoded_length : 1);
+    bool success = out != NULL && (c->code_of_block[i] >= 0 
+        ? decode_block(block, c->num_streams, c->block_tables[c->code_of_block[i]], out)
+        : decode_with_file_code(block, c->num_streams, c->file, out));
+    stats_add_since(c->stats, &start, &c->times[i].decode);
+
+    if (success && c->checksums) {
+        start = stats_clock(c->stats);
+        success = check_block_checksum(block, out);
+        stats_add_since(c->stats, &start, &c->times[i].checksum);
         if (!success) {
-            fprintf(stderr, "error saving codes\n");
+            fprintf(stderr, "block %ld doesn't match its checksum\n", i);
+        }
+    }
+    if (c->dest == NULL) {
+        free(out);
+    }
+    return success;
+}
 
-            fclose(f_src);
-            delete_codes(codes);
-            fclose(f_dest);
-            bitstring_delete(empty_bitstring);
+// decode the blocks of a mapped file (listed in `index`, or if that's NULL, found from
+// their headers starting at `blocks_offset`) on several threads, into the output
+// (or with no f_dest, nowhere, to test them), checking them against their checksums if `checksums`.
+// returns false on failure
+bool decompress_mapped(const mapped_file *src, uint64_t blocks_offset, FILE *f_dest, int num_streams, 
+                       uint8_t flags, bool checksums, const file_code *file,
+                       const block_index_entry *index, uint64_t num_blocks, int num_threads, run_stats *stats) {
+    block_index_entry *found_index = NULL;
+    if (index == NULL) {
+        phase_time start = stats_clock(stats);
+        found_index = find_blocks(src->data, src->size, blocks_offset, num_streams, flags, &num_blocks);
+        stats_phase_done(stats, PHASE_READ, &start);
+        if (found_index == NULL) {
+            return false;
+        }
+        index = found_index;
+    }
 
-            exit(1);
+    // follow the code from block to block (which only needs their tables), building a decode table
+    // for each code once, so the blocks can be decoded in any order
+    long *code_of_block = malloc(sizeof(long) * (num_blocks + 1));
+    decode_table **block_tables = NULL;
+    long num_block_codes = 0;
+    long block_codes_capacity = 0;
+    uint8_t current_lengths[num_symbols];
+    current_code current = { .lengths = current_lengths, .has_code = file->lengths != NULL };
+    if (current.has_code) {
+        memcpy(current_lengths, file->lengths, num_symbols);
+    }
+    long current_index = -1;
+    bool success = true;
+    phase_time start = stats_clock(stats);
+    for (uint64_t i = 0; i < num_blocks && success; i++) {
+        size_t decoded_length;
+        bool changed;
+        success = parse_mapped_block(src, index[i].offset, num_streams, flags, &decoded_length)
+            && decoded_length == index[i].length
+            && update_current_code(src->data + index[i].offset, num_streams, &current, &changed)
+            && (current.has_code || file->contexts != NULL || file->ans != NULL || file->wide != NULL);
+        if (success && changed) {
+            if (num_block_codes == block_codes_capacity) {
+                long capacity = block_codes_capacity == 0 ? 16 : 2 * block_codes_capacity;
+                decode_table **tables = realloc(block_tables, sizeof(decode_table *) * capacity);
+                if (tables == NULL) {
+                    fprintf(stderr, "not enough memory for %zu bytes\n", sizeof(decode_table *) * capacity);
+                    success = false;
+                    break;
+                }
+                block_tables = tables;
+                block_codes_capacity = capacity;
+            }
+            block_tables[num_block_codes] = decode_table_from_code_lengths(current_lengths);
+            success = block_tables[num_block_codes] != NULL;
+            current_index = num_block_codes++;
         }
+        code_of_block[i] = current_index;
     }
-    bitstring_delete(empty_bitstring);
+    stats_phase_done(stats, PHASE_CODES, &start);
 
-    
-    rewind(f_src);
-    while ((nread = fread(buf, sizeof(unsigned char), capacity, f_src)) > 0) {
-        bitstring *encoded = encode(buf, nread, (const bitstring **)codes);
-        bool success = bitstring_write(encoded, f_dest);
-        bitstring_delete(encoded);
-        if (!success) {
-            fprintf(stderr, "error saving content\n");
+    uint64_t *output_offsets = malloc(sizeof(uint64_t) * (num_blocks + 1));
+    output_offsets[0] = 0;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        // (a corrupt index could add up to more than can be addressed)
+        success = success && index[i].length <= SIZE_MAX - output_offsets[i];
+        output_offsets[i + 1] = success ? output_offsets[i] + index[i].length : output_offsets[i];
+    }
 
-            fclose(f_src);
-            delete_codes(codes);
-            fclose(f_dest);
-            free(buf);
+    // (an empty output needs no mapping)
+    mapped_file dest_map = { .data = NULL, .size = 0 };
+    success = success && (output_offsets[num_blocks] == 0 || f_dest == NULL
+        || map_for_writing(fileno(f_dest), output_offsets[num_blocks], &dest_map));
+    block_times *times = calloc(num_blocks + 1, sizeof(block_times));
+    if (success) {
+        decompress_context context = {
+            .src = src,
+            .dest = dest_map.data,
+            .num_streams = num_streams,
+            .flags = flags,
+            .checksums = checksums,
+            .file = file,
+            .block_tables = block_tables,
+            .code_of_block = code_of_block,
+            .index = index,
+            .output_offsets = output_offsets,
+            .stats = stats,
+            .times = times
+        };
+        success = run_parallel(decompress_block, &context, num_blocks, num_threads);
+        start = stats_clock(stats);
+        if (dest_map.data != NULL) {
+            success = unmap(&dest_map) && success;
+        }
+        stats_phase_done(stats, PHASE_WRITE, &start);
+    }
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        stats_add_time(stats, PHASE_DECODE, &times[i].decode);
+        stats_add_time(stats, PHASE_CHECKSUM, &times[i].checksum);
+    }
+    stats_add_sizes(stats, src->size, output_offsets[num_blocks]);
 
-            exit(1);
+    free(times);
+    free(output_offsets);
+    free(code_of_block);
+    for (long k = 0; k < num_block_codes; k++) {
+        decode_table_delete(block_tables[k]);
+    }
+    free(block_tables);
+    free(found_index);
+    return success;
+}
+
+// decode blocks one after another, until the end of blocks marker, writing them to f_dest
+// (or if it's NULL, nowhere, to test them), checking them against their checksums if `checksums`.
+// returns false on failure (or exits, if there isn't memory for a block)
+bool decompress_serially(FILE *f_src, const char *src_filename, FILE *f_dest, int num_streams, uint8_t flags,
+                         bool checksums, const file_code *file, run_stats *stats) {
+    uint8_t *block = NULL;
+    size_t block_capacity = 0;
+    symbol *decoded = NULL;
+    size_t decoded_capacity = 0;
+
+    // the code the next block is decoded with, and its table if it came with a block
+    uint8_t current_lengths[num_symbols];
+    current_code current = { .lengths = current_lengths, .has_code = file->lengths != NULL };
+    if (current.has_code) {
+        memcpy(current_lengths, file->lengths, num_symbols);
+    }
+    decode_table *block_table = NULL;
+
+    long block_size;
+    uint64_t block_number = 0;
+    while (true) {
+        phase_time start = stats_clock(stats);
+        block_size = read_block(f_src, num_streams, flags, &block, &block_capacity);
+        stats_phase_done(stats, PHASE_READ, &start);
+        if (block_size <= 0) {
+            break;
+        }
+        // (read_block has checked the header, so its length is one the block's streams could hold)
+        size_t decoded_length, parsed_size;
+        if (!parse_block_header(block, num_streams, flags, &decoded_length, &parsed_size)) {
+            break;
+        }
+        if (decoded_length > decoded_capacity) {
+            symbol *grown = realloc(decoded, sizeof(symbol) * decoded_length);
+            if (grown == NULL) {
+                decompress_failed(src_filename, CODEC_OUT_OF_MEMORY);
+            }
+            decoded = grown;
+            decoded_capacity = decoded_length;
+        }
+
+        // only build a new table when the code changes
+        start = stats_clock(stats);
+        bool changed;
+        if (!update_current_code(block, num_streams, &current, &changed)) {
+            break;
+        }
+        if (changed) {
+            decode_table_delete(block_table);
+            block_table = decode_table_from_code_lengths(current_lengths);
+            if (block_table == NULL) {
+                break;
+            }
         }
+        stats_phase_done(stats, PHASE_CODES, &start);
+
+        start = stats_clock(stats);
+        bool decoded_block = block_table != NULL ? decode_block(block, num_streams, block_table, decoded)
+                                                 : decode_with_file_code(block, num_streams, file, decoded);
+        if (!decoded_block) {
+            break;
+        }
+        stats_phase_done(stats, PHASE_DECODE, &start);
+
+        if (checksums) {
+            start = stats_clock(stats);
+            if (!check_block_checksum(block, decoded)) {
+                fprintf(stderr, "block %llu doesn't match its checksum\n", (unsigned long long)block_number);
+                break;
+            }
+            stats_phase_done(stats, PHASE_CHECKSUM, &start);
+        }
+
+        start = stats_clock(stats);
+        if (f_dest != NULL && fwrite(decoded, sizeof(symbol), decoded_length, f_dest) != decoded_length) {
+            break;
+        }
+        stats_phase_done(stats, PHASE_WRITE, &start);
+        stats_add_sizes(stats, block_size, decoded_length);
+        block_number++;
     }
-    fclose(f_src);
-    delete_codes(codes);
-    fclose(f_dest);
-    free(buf);
+    // only successful if we reached the end of blocks marker
+    bool success = block_size == 0;
+    stats_add_sizes(stats, success ? END_OF_BLOCKS_SIZE : 0, 0);
+
+    free(block);
+    free(decoded);
+    decode_table_delete(block_table);
+    return success;
 }
 
-void decompress(const char *src_filename, const char *dest_filename) {
+// decompress a file into dest_filename, or with none, only decode it (checking any checksums), to test it
+void decompress(const char *src_filename, const char *dest_filename, const program_options *options) {
 
-    FILE *f_src = fopen(src_filename, "rb");
+    run_stats *stats = options->stats ? stats_new(false) : NULL;
+    phase_time start = stats_clock(stats);
+    FILE *f_src = open_file(src_filename, "rb");
     if (f_src == NULL) {
         fprintf(stderr, "failed to open %s\n", src_filename);
         exit(1);
     }
 
-    bitstring **codes = malloc(sizeof(bitstring *) * num_symbols);
-    for (int i = 0; i < num_symbols; i++) {
-        bitstring *code = bitstring_read(f_src);
+    file_header header;
+    if (!read_file_header(&header, f_src)) {
+        fprintf(stderr, "%s is not a compressed file (or is from another version)\n", src_filename);
+        fclose(f_src);
+        exit(1);
+    }
+    if ((header.flags & FLAG_RECORDS) && options->range) {
+        fprintf(stderr, "%s is a file of records, which are read with --record\n", src_filename);
+        fclose(f_src);
+        exit(1);
+    }
+    if (header.flags & FLAG_RECORDS) {
+        stats_delete(stats);
+        decompress_records_file(f_src, &header, src_filename, dest_filename, options);
+        return;
+    }
+    if (options->range) {
+        stats_delete(stats);
+        decompress_range_file(f_src, &header, src_filename, dest_filename, options);
+        return;
+    }
+    if (options->record >= 0) {
+        fprintf(stderr, "%s is not a file of records (from --records)\n", src_filename);
+        fclose(f_src);
+        exit(1);
+    }
 
-        if (code == NULL) {
-            fprintf(stderr, "error reading codes from %s\n", src_filename);
-            fclose(f_src);
-            delete_codes(codes);
-            exit(1);
+    // if blocks bring their own code tables, there's none for the whole file,
+    // and otherwise it's one code (perhaps a shared table's), an order-1 code with a table
+    // for each group of contexts, tANS counts, or wide symbols' code
+    uint8_t code_lengths[num_symbols];
+    decode_table *table = NULL;
+    context_code context;
+    decode_table *group_tables[MAX_CONTEXT_GROUPS];
+    const decode_entry *context_entries[NUM_CONTEXTS];
+    int num_group_tables = 0;
+    uint16_t ans_counts[num_symbols];
+    ans_decode_table *ans_table = NULL;
+    bool block_tables = header.flags & FLAG_BLOCK_TABLES;
+    bool context_coded = header.flags & FLAG_CONTEXT_CODE;
+    bool ans_coded = header.flags & FLAG_ANS_CODE;
+    bool wide_coded = header.flags & FLAG_WIDE_SYMBOLS;
+    bool shared = header.flags & FLAG_SHARED_TABLE;
+    uint8_t *wide_lengths = wide_coded ? malloc(sizeof(uint8_t) * NUM_WIDE_SYMBOLS) : NULL;
+    decode_table *wide_table = NULL;
+    uint32_t file_id, shared_id;
+    if (shared && options->table_filename == NULL) {
+        fprintf(stderr, "%s was compressed with a table, which decompressing it needs (--table)\n", src_filename);
+        fclose(f_src);
+        exit(1);
+    }
+    if (shared) {
+        load_table(options->table_filename, code_lengths, &shared_id);
+    }
+    bool codes_read = !block_tables 
+        && (context_coded ? read_context_code(&context, f_src) 
+            : ans_coded ? read_ans_counts(ans_counts, f_src)
+            : wide_coded ? read_wide_code_lengths(wide_lengths, f_src)
+            : shared ? read_uint(&file_id, f_src) : read_code_lengths(code_lengths, f_src));
+    if (codes_read && shared && file_id != shared_id) {
+        fprintf(stderr, "%s was compressed with another table than %s\n", src_filename, options->table_filename);
+        fclose(f_src);
+        exit(1);
+    }
+    stats_phase_done(stats, PHASE_READ, &start);
+    start = stats_clock(stats);
+    bool codes_built = false;
+    if (codes_read && context_coded) {
+        codes_built = get_context_decode_tables(&context, group_tables, context_entries);
+        num_group_tables = codes_built ? context.num_groups : 0;
+    }else if (codes_read && ans_coded) {
+        ans_table = malloc(sizeof(ans_decode_table));
+        codes_built = ans_decode_table_init(ans_counts, ans_table);
+    }else if (codes_read && wide_coded) {
+        wide_table = wide_decode_table_from_code_lengths(wide_lengths);
+        codes_built = wide_table != NULL;
+    }else if (codes_read) {
+        table = decode_table_from_code_lengths(code_lengths);
+        codes_built = table != NULL;
+    }
+    stats_phase_done(stats, PHASE_CODES, &start);
+    file_code file = {
+        .lengths = block_tables || context_coded || ans_coded || wide_coded ? NULL : code_lengths,
+        .table = table,
+        .contexts = context_coded ? context_entries : NULL,
+        .ans = ans_coded ? ans_table : NULL,
+        .wide = wide_table
+    };
+    if (!block_tables && !codes_built) {
+        fprintf(stderr, "error reading codes from %s\n", src_filename);
+        fclose(f_src);
+        exit(1);
+    }
 
-        }else if (bitstring_bitlength(code) == 0) {
-            // a zero bitstring is saved to indicate this symbol has no code
-            codes[i] = NULL;
-            bitstring_delete(code);
-        }else {
-            codes[i] = code;
+    // (readable too, as mapping it needs)
+    FILE *f_dest = dest_filename != NULL ? open_file(dest_filename, "w+b") : NULL;
+    if (dest_filename != NULL && f_dest == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", dest_filename);
+        fclose(f_src);
+        decode_table_delete(table);
+        exit(1);
+    }
+
+    // when both can be, decode from a mapping of the source straight into a mapping of the output,
+    // which must be a regular file (and not stdout, which mightn't start empty), or when testing, nowhere
+    struct stat dest_stat;
+    bool dest_regular = f_dest == NULL
+        || (f_dest != stdout && fstat(fileno(f_dest), &dest_stat) == 0 && S_ISREG(dest_stat.st_mode));
+    bool checksums = header.flags & FLAG_BLOCK_CHECKSUMS;
+    mapped_file src_map;
+    long blocks_offset = ftell(f_src);
+    bool success;
+    if (dest_regular && blocks_offset >= 0 && map_for_reading(fileno(f_src), &src_map)) {
+        uint64_t num_blocks = 0;
+        block_index_entry *index = NULL;
+        if (header.flags & FLAG_BLOCK_INDEX) {
+            start = stats_clock(stats);
+            index = read_block_index(f_src, &num_blocks);
+            stats_phase_done(stats, PHASE_READ, &start);
         }
+        success = decompress_mapped(&src_map, blocks_offset, f_dest, header.num_streams, header.flags, checksums, &file,
+                                    index, num_blocks, options->num_threads, stats);
+        free(index);
+        unmap(&src_map);
+    }else {
+        success = decompress_serially(f_src, src_filename, f_dest, header.num_streams, header.flags, checksums, &file, stats);
+        // (the source mightn't be seekable, so count the header and code as they'd be written)
+        uint8_t *packed = malloc(MAX_PACKED_WIDE_CODE_LENGTHS);
+        size_t code_size = block_tables ? 0 
+                         : context_coded ? pack_context_code(&context, packed) 
+                         : ans_coded ? pack_ans_counts(ans_counts, packed)
+                         : wide_coded ? pack_wide_code_lengths(wide_lengths, packed)
+                         : shared ? sizeof(uint32_t) : pack_code_lengths(code_lengths, packed);
+        free(packed);
+        stats_add_sizes(stats, file_header_size + code_size, 0);
     }
 
-    tree_node *tree = get_tree_from_codes((const bitstring **)codes);
-    delete_codes(codes);
+    fclose(f_src);
+    success = (f_dest == NULL || fclose(f_dest) == 0) && success;
+    decode_table_delete(table);
+    free(ans_table);
+    decode_table_delete(wide_table);
+    free(wide_lengths);
+    for (int g = 0; g < num_group_tables; g++) {
+        decode_table_delete(group_tables[g]);
+    }
 
-    FILE *f_dest = fopen(dest_filename, "wb");
+    if (!success) {
+        fprintf(stderr, "error decompressing %s\n", src_filename);
+        exit(1);
+    }
+    print_stats(stats, stderr);
+    stats_delete(stats);
+}
 
-    bitstring *encoded;
-    while ((encoded = bitstring_read(f_src)) != NULL) {
-        int decoded_length;
-        unsigned char *decoded = decode(encoded, tree, &decoded_length);
-        bitstring_delete(encoded);
-        if (fwrite(decoded, sizeof(unsigned char), decoded_length, f_dest) != decoded_length) {
-            fprintf(stderr, "error writing to file\n");
-            fclose(f_src);
-            fclose(f_dest);
-            tree_delete(tree);
-            free(decoded);
-            exit(1);
-        }
-        free(decoded);
+// smallest and largest blocks --block-size allows
+#define MIN_BLOCK_SIZE (1 << 10)
+#define MAX_BLOCK_SIZE (1 << 30)
+
+// a number of bytes, perhaps with a k, m or g suffix (for KiB, MiB or GiB).
+// returns 0 if it isn't one
+static size_t parse_size(const char *text) {
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text) {
+        return 0;
     }
+    int shift = *end == 'k' || *end == 'K' ? 10
+              : *end == 'm' || *end == 'M' ? 20
+              : *end == 'g' || *end == 'G' ? 30 : 0;
+    if ((shift > 0 && end[1] != '\0') || (shift == 0 && *end != '\0') || n > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+    return (size_t)n << shift;
+}
 
-    fclose(f_src);
-    fclose(f_dest);
-    tree_delete(tree);
+// an <offset>:<length> range, each a number of bytes with an optional suffix (as for parse_size).
+// returns false if it isn't one
+static bool parse_range(const char *text, uint64_t *offsetp, size_t *lengthp) {
+    const char *colon = strchr(text, ':');
+    char offset[32];
+    if (colon == NULL || colon - text >= (long)sizeof(offset)) {
+        return false;
+    }
+    memcpy(offset, text, colon - text);
+    offset[colon - text] = '\0';
+    *offsetp = strcmp(offset, "0") == 0 ? 0 : parse_size(offset);
+    *lengthp = strcmp(colon + 1, "0") == 0 ? 0 : parse_size(colon + 1);
+    return (*offsetp > 0 || strcmp(offset, "0") == 0) && (*lengthp > 0 || strcmp(colon + 1, "0") == 0);
 }
 
+void usage() {
+    fprintf(stderr, 
+        "usage: huffman [-c | -d | --train] [options] <src> <dest>\n"
+        "       huffman -t [options] <src>\n"
+        "  -c, --compress                 compress src into dest (default)\n"
+        "  -d, --decompress               decompress src into dest\n"
+        "  -t, --test                     decompress src without writing it anywhere, to check that\n"
+        "                                 it decompresses (and matches its checksums, if it has them)\n"
+        "      --train                    build a table from src, samples of what's to be compressed,\n"
+        "                                 into the table file dest (for --table)\n"
+        "  -l, --max-code-length <bits>   limit codes to at most this many bits (1 to %d)\n"
+        "  -T, --threads <n>              use n threads (0 for one per core)\n"
+        "      --no-index                 don't end the compressed file with an index of its blocks\n"
+        "                                 (which lets it be decompressed on several threads)\n"
+        "      --streams <n>              split each block into n interleaved streams (1 to %d)\n"
+        "  -b, --block-size <bytes|auto>  bytes of src per block, with an optional k, m or g suffix\n"
+        "                                 (%dk to %dm), or auto to choose from src's size, the number\n"
+        "                                 of threads and the cache size (the default)\n"
+        "  -s, --stream                   read src only once, giving each block its own code\n"
+        "                                 (always so when src can't be reread, like a pipe)\n"
+        "  -o, --order1                   code each byte with a code chosen by the byte before it,\n"
+        "                                 when that's smaller (not when streaming)\n"
+        "  -a, --ans                      code with tANS rather than prefix codes, which can spend\n"
+        "                                 under a bit on common bytes (not when streaming)\n"
+        "  -w, --wide                     code pairs of bytes as 16 bit symbols (little endian), for\n"
+        "                                 text in UTF-16 or 16 bit samples (not when streaming)\n"
+        "      --checksums                give each block a CRC-32C of its content, which decompressing\n"
+        "                                 checks it against (not with --records)\n"
+        "      --table <file>             code with a table made by --train, which the compressed file\n"
+        "                                 refers to rather than carrying a code (for small files),\n"
+        "                                 and which decompressing it needs\n"
+        "      --records                  compress src's lines as records, each of which can be\n"
+        "                                 decompressed on its own (with --record)\n"
+        "      --record <n>               decompress only record n (from 0) of a file of records\n"
+        "      --range <offset>:<length>  decompress only length bytes from offset (each with an\n"
+        "                                 optional k, m or g suffix), decoding only the blocks they're in\n"
+        "      --stats                    print where the time went, sizes, entropy and memory to stderr\n"
+        "src or dest may be - for stdin or stdout\n",
+        MAX_CODE_LENGTH, MAX_STREAMS, MIN_BLOCK_SIZE >> 10, MAX_BLOCK_SIZE >> 20);
+    exit(1);
+}
+
+typedef enum {
+    MODE_COMPRESS,
+    MODE_DECOMPRESS,
+    MODE_TEST,
+    MODE_TRAIN
+} program_mode;
+
 int main(int argc, char const *argv[]) {
     
-    bool mode_compress = true;
+    program_mode mode = MODE_COMPRESS;
+    program_options options = {
+        .max_code_length = 0,
+        .num_threads = 1,
+        .write_index = true,
+        .num_streams = 4,
+        .streaming = false,
+        .stats = false,
+        .order1 = false,
+        .ans = false,
+        .wide = false,
+        .checksums = false,
+        .block_size = 0,
+        .table_filename = NULL,
+        .records = false,
+        .record = -1,
+        .range = false,
+        .range_offset = 0,
+        .range_length = 0
+    };
+
     int i = 1;
-    if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--compress") == 0) {
-        mode_compress = true;
-        i++;
-    }else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--decompress") == 0) {
-        mode_compress = false;
-        i++;
+    // (a lone - is a filename)
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--compress") == 0) {
+            mode = MODE_COMPRESS;
+        }else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--decompress") == 0) {
+            mode = MODE_DECOMPRESS;
+        }else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--test") == 0) {
+            mode = MODE_TEST;
+        }else if (strcmp(argv[i], "--train") == 0) {
+            mode = MODE_TRAIN;
+        }else if ((strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--max-code-length") == 0) && i + 1 < argc) {
+            options.max_code_length = atoi(argv[++i]);
+            if (options.max_code_length < 1 || options.max_code_length > MAX_CODE_LENGTH) {
+                usage();
+            }
+        }else if ((strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc) {
+            options.num_threads = atoi(argv[++i]);
+            if (options.num_threads < 0) {
+                usage();
+            }else if (options.num_threads == 0) {
+                options.num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }else if ((strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--block-size") == 0) && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                options.block_size = 0;
+            }else {
+                options.block_size = parse_size(argv[i]);
+                if (options.block_size < MIN_BLOCK_SIZE || options.block_size > MAX_BLOCK_SIZE) {
+                    usage();
+                }
+            }
+        }else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stream") == 0) {
+            options.streaming = true;
+        }else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--order1") == 0) {
+            options.order1 = true;
+        }else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--ans") == 0) {
+            options.ans = true;
+        }else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--wide") == 0) {
+            options.wide = true;
+        }else if (strcmp(argv[i], "--checksums") == 0) {
+            options.checksums = true;
+        }else if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+            options.table_filename = argv[++i];
+        }else if (strcmp(argv[i], "--records") == 0) {
+            options.records = true;
+        }else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            char *end;
+            options.record = strtoll(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || options.record < 0) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+            options.range = true;
+            if (!parse_range(argv[++i], &options.range_offset, &options.range_length)) {
+                usage();
+            }
+        }else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        }else if (strcmp(argv[i], "--no-index") == 0) {
+            options.write_index = false;
+        }else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            options.num_streams = atoi(argv[++i]);
+            if (options.num_streams < 1 || options.num_streams > MAX_STREAMS) {
+                usage();
+            }
+        }else {
+            usage();
+        }
+    }
+    // (an order-1 code is a prefix code for each context, and wide symbols have only prefix codes of their own.
+    // a shared table is a code for single bytes)
+    // (testing has no dest)
+    if (argc - i != (mode == MODE_TEST ? 1 : 2)
+        || options.order1 + options.ans + options.wide + (options.table_filename != NULL) > 1) {
+        usage();
+    }
+    // (records are coded with one prefix code, and counted first, and have no blocks to check)
+    if ((options.records && (mode != MODE_COMPRESS || options.order1 || options.ans || options.wide || options.streaming
+                             || options.checksums))
+        || (options.checksums && mode != MODE_COMPRESS)
+        || ((options.record >= 0 || options.range) && mode != MODE_DECOMPRESS)
+        || (options.record >= 0 && options.range)) {
+        usage();
     }
 
     const char *src_filename = argv[i++];
-    const char *dest_filename = argv[i++];
+    const char *dest_filename = mode == MODE_TEST ? NULL : argv[i++];
 
-    if (mode_compress) {
-        compress(src_filename, dest_filename);
+    if (mode == MODE_COMPRESS && options.records) {
+        compress_records_file(src_filename, dest_filename, &options);
+    }else if (mode == MODE_COMPRESS) {
+        compress(src_filename, dest_filename, &options);
+    }else if (mode == MODE_DECOMPRESS || mode == MODE_TEST) {
+        decompress(src_filename, dest_filename, &options);
     }else {
-        decompress(src_filename, dest_filename);
+        train(src_filename, dest_filename, &options);
     }
 
     return 0;
 }
-
@@ -0,0 +1,23 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the content of a file, mapped into memory
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} mapped_file;
+
+// map the whole of a regular file to read, from start to end.
+// returns false if it can't be mapped (it's a pipe, or empty, ...)
+bool map_for_reading(int fd, mapped_file *);
+// resize a regular file (open to read and write) to `size` bytes, and map it to write.
+// returns false on failure, or if `size` is 0
+bool map_for_writing(int fd, size_t size, mapped_file *);
+// returns false if writing back the mapped content failed
+bool unmap(mapped_file *);
+
+#endif // MAPFILE_H
@@ -0,0 +1,45 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "assert.h"
+#include "mapfile.h"
+
+int main() {
+    const char *text = "the quick brown fox jumps over the lazy dog.";
+    size_t length = strlen(text);
+
+    FILE *f = tmpfile();
+    mapped_file map;
+    assert(!map_for_reading(fileno(f), &map), "map for reading should refuse an empty file");
+    fputs(text, f);
+    fflush(f);
+    assert(map_for_reading(fileno(f), &map), "map for reading should succeed");
+    assert(map.size == length && memcmp(map.data, text, length) == 0, "mapping should hold the file's content");
+    assert(unmap(&map), "unmap should succeed");
+    fclose(f);
+
+    f = tmpfile();
+    fputs("some longer content, that will be cut short", f);
+    fflush(f);
+    assert(map_for_writing(fileno(f), length, &map), "map for writing should succeed");
+    memcpy(map.data, text, length);
+    assert(unmap(&map), "unmap should succeed");
+    char buf[100];
+    rewind(f);
+    assert(fread(buf, 1, sizeof(buf), f) == length && memcmp(buf, text, length) == 0, 
+        "written mapping should become the file's content");
+    fclose(f);
+
+    int fds[2];
+    assert(pipe(fds) == 0, "pipe should succeed");
+    assert(!map_for_reading(fds[0], &map), "map for reading should refuse a pipe");
+    assert(!map_for_writing(fds[1], length, &map), "map for writing should refuse a pipe");
+    close(fds[0]);
+    close(fds[1]);
+
+    return 0;
+}
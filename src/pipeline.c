@@ -0,0 +1,229 @@
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_READ,
+    SLOT_DONE
+} slot_state;
+
+typedef struct {
+    const pipeline_stages *stages;
+    void *context;
+
+    void **slots;
+    slot_state *states;
+    int num_slots;
+
+    // sequence numbers of the next job to be read, worked on, and written.
+    // job k lives in slot k % num_slots
+    long next_read;
+    long next_work;
+    long next_write;
+
+    // no more jobs will be read
+    bool finished;
+    // a write failed
+    bool failed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_read;
+    pthread_cond_t job_done;
+    pthread_cond_t slot_freed;
+} pipeline;
+
+static void *worker_thread(void *arg) {
+    pipeline *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->next_work == p->next_read && !p->finished) {
+            pthread_cond_wait(&p->job_read, &p->lock);
+        }
+        if (p->next_work == p->next_read) {
+            break; // finished, and nothing left to do
+        }
+        int slot = p->next_work++ % p->num_slots;
+        pthread_mutex_unlock(&p->lock);
+
+        p->stages->work(p->context, p->slots[slot]);
+
+        pthread_mutex_lock(&p->lock);
+        p->states[slot] = SLOT_DONE;
+        pthread_cond_signal(&p->job_done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void *writer_thread(void *arg) {
+    pipeline *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        int slot = p->next_write % p->num_slots;
+        while (p->next_write < p->next_read && p->states[slot] != SLOT_DONE) {
+            pthread_cond_wait(&p->job_done, &p->lock);
+        }
+        if (p->next_write == p->next_read) {
+            if (p->finished) break;
+            pthread_cond_wait(&p->job_done, &p->lock);
+            continue;
+        }
+        bool failed = p->failed;
+        pthread_mutex_unlock(&p->lock);
+
+        // after a failure, keep draining jobs (without writing) so everyone can finish
+        bool success = failed || p->stages->write(p->context, p->slots[slot]);
+
+        pthread_mutex_lock(&p->lock);
+        if (!success) p->failed = true;
+        p->states[slot] = SLOT_FREE;
+        p->next_write++;
+        pthread_cond_signal(&p->slot_freed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static bool run_serially(const pipeline_stages *stages, void *context, void *slot) {
+    while (stages->read(context, slot)) {
+        stages->work(context, slot);
+        if (!stages->write(context, slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_pipeline(const pipeline_stages *stages, void *context, 
+                  void **slots, int num_slots, int num_threads) {
+    if (num_threads <= 1 || num_slots <= 1) {
+        return run_serially(stages, context, slots[0]);
+    }
+
+    pipeline p = {
+        .stages = stages,
+        .context = context,
+        .slots = slots,
+        .states = malloc(sizeof(slot_state) * num_slots),
+        .num_slots = num_slots,
+        .next_read = 0,
+        .next_work = 0,
+        .next_write = 0,
+        .finished = false,
+        .failed = false
+    };
+    for (int i = 0; i < num_slots; i++) {
+        p.states[i] = SLOT_FREE;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.job_read, NULL);
+    pthread_cond_init(&p.job_done, NULL);
+    pthread_cond_init(&p.slot_freed, NULL);
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&workers[i], NULL, worker_thread, &p);
+    }
+    pthread_t writer;
+    pthread_create(&writer, NULL, writer_thread, &p);
+
+    // read jobs into slots as they become free
+    pthread_mutex_lock(&p.lock);
+    while (!p.failed) {
+        int slot = p.next_read % p.num_slots;
+        while (p.states[slot] != SLOT_FREE) {
+            pthread_cond_wait(&p.slot_freed, &p.lock);
+        }
+        pthread_mutex_unlock(&p.lock);
+
+        bool has_job = stages->read(context, slots[slot]);
+
+        pthread_mutex_lock(&p.lock);
+        if (!has_job) break;
+        p.states[slot] = SLOT_READ;
+        p.next_read++;
+        pthread_cond_signal(&p.job_read);
+    }
+    p.finished = true;
+    pthread_cond_broadcast(&p.job_read);
+    pthread_cond_broadcast(&p.job_done);
+    pthread_mutex_unlock(&p.lock);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+
+    bool success = !p.failed;
+
+    free(workers);
+    free(p.states);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.job_read);
+    pthread_cond_destroy(&p.job_done);
+    pthread_cond_destroy(&p.slot_freed);
+
+    return success;
+}
+
+typedef struct {
+    bool (*job)(void *context, long i);
+    void *context;
+    long num_jobs;
+
+    // the next job to start
+    long next_job;
+    bool failed;
+    pthread_mutex_t lock;
+} parallel_jobs;
+
+static void *parallel_thread(void *arg) {
+    parallel_jobs *p = arg;
+    while (true) {
+        pthread_mutex_lock(&p->lock);
+        long i = p->next_job++;
+        bool stop = p->failed || i >= p->num_jobs;
+        pthread_mutex_unlock(&p->lock);
+        if (stop) break;
+
+        if (!p->job(p->context, i)) {
+            pthread_mutex_lock(&p->lock);
+            p->failed = true;
+            pthread_mutex_unlock(&p->lock);
+        }
+    }
+    return NULL;
+}
+
+bool run_parallel(bool (*job)(void *context, long i), void *context, long num_jobs, int num_threads) {
+    parallel_jobs p = {
+        .job = job,
+        .context = context,
+        .num_jobs = num_jobs,
+        .next_job = 0,
+        .failed = false
+    };
+    pthread_mutex_init(&p.lock, NULL);
+
+    if (num_threads <= 1) {
+        parallel_thread(&p);
+    }else {
+        pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], NULL, parallel_thread, &p);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    pthread_mutex_destroy(&p.lock);
+    return !p.failed;
+}
@@ -0,0 +1,32 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+
+// the stages of processing a sequence of independent jobs.
+// each is given the shared context, and the slot holding the job
+typedef struct {
+    // fill the slot with the next job.
+    // returns false when there are no more jobs
+    bool (*read)(void *context, void *slot);
+    // process a job. called concurrently on different slots
+    void (*work)(void *context, void *slot);
+    // consume a processed job. called in the order the jobs were read.
+    // returns false on failure, which stops further jobs being read
+    bool (*write)(void *context, void *slot);
+} pipeline_stages;
+
+// run jobs through the stages, reading on the calling thread, 
+// working on `num_threads` worker threads, and writing on another thread.
+// `slots` are reused for jobs in flight, so more slots than threads keeps every worker busy.
+// with num_threads <= 1, runs each job through every stage in turn on the calling thread.
+// returns false if any write failed
+bool run_pipeline(const pipeline_stages *stages, void *context, 
+                  void **slots, int num_slots, int num_threads);
+
+// run job(context, i) for each i from 0 to num_jobs - 1, in any order, on `num_threads` threads.
+// once a job fails (returns false), no more are started.
+// returns false if any job failed
+bool run_parallel(bool (*job)(void *context, long i), void *context, long num_jobs, int num_threads);
+
+#endif // PIPELINE_H
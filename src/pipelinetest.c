@@ -0,0 +1,125 @@
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "assert.h"
+
+const int n = 10000;
+
+typedef struct {
+    int next_input;
+    int next_output;
+    // write fails at this job, or -1
+    int fail_at;
+} squares_context;
+
+typedef struct {
+    int input;
+    long output;
+} square_job;
+
+bool read_number(void *context, void *slot) {
+    squares_context *c = context;
+    square_job *job = slot;
+    if (c->next_input == n) {
+        return false;
+    }
+    job->input = c->next_input++;
+    return true;
+}
+
+void square(void *context, void *slot) {
+    square_job *job = slot;
+    // vary how long jobs take, so they finish out of order
+    for (int i = 0; i < (job->input * 7919) % 1000; i++) {
+        job->output += i % 3;
+    }
+    job->output = (long)job->input * job->input;
+}
+
+bool check_square(void *context, void *slot) {
+    squares_context *c = context;
+    square_job *job = slot;
+    assert(job->input == c->next_output, "jobs should be written in the order they're read");
+    assert(job->output == (long)job->input * job->input, "jobs should be worked on before being written");
+    c->next_output++;
+    return job->input != c->fail_at;
+}
+
+const pipeline_stages stages = {
+    .read = read_number,
+    .work = square,
+    .write = check_square
+};
+
+void test_with_threads(int num_threads, int num_slots, int fail_at) {
+    squares_context context = { .next_input = 0, .next_output = 0, .fail_at = fail_at };
+
+    square_job *jobs = calloc(num_slots, sizeof(square_job));
+    void **slots = malloc(sizeof(void *) * num_slots);
+    for (int i = 0; i < num_slots; i++) {
+        slots[i] = &jobs[i];
+    }
+
+    bool success = run_pipeline(&stages, &context, slots, num_slots, num_threads);
+    if (fail_at < 0) {
+        assert(success, "pipeline should succeed if every write succeeds");
+        assert(context.next_output == n, "every job should be written");
+    }else {
+        assert(!success, "pipeline should fail if a write fails");
+        assert(context.next_output == fail_at + 1, "no jobs should be written after a failure");
+    }
+
+    free(jobs);
+    free(slots);
+}
+
+typedef struct {
+    int *counts;
+    int fail_at;
+} parallel_context;
+
+bool count_job(void *context, long i) {
+    parallel_context *c = context;
+    c->counts[i]++;
+    return i != c->fail_at;
+}
+
+void test_parallel(int num_threads, int fail_at) {
+    parallel_context context = {
+        .counts = calloc(n, sizeof(int)),
+        .fail_at = fail_at
+    };
+    bool success = run_parallel(count_job, &context, n, num_threads);
+    assert(success == (fail_at < 0), "run parallel should fail only if a job fails");
+    if (fail_at < 0) {
+        for (int i = 0; i < n; i++) {
+            assert(context.counts[i] == 1, "run parallel should run each job once");
+        }
+    }
+    free(context.counts);
+}
+
+int main() {
+    printf("test serial\n");
+    test_with_threads(1, 1, -1);
+
+    printf("test with more slots than threads\n");
+    test_with_threads(4, 16, -1);
+
+    printf("test with as many slots as threads\n");
+    test_with_threads(8, 8, -1);
+
+    printf("test write failure\n");
+    test_with_threads(1, 1, 100);
+    test_with_threads(4, 16, 100);
+
+    printf("test parallel jobs\n");
+    test_parallel(1, -1);
+    test_parallel(8, -1);
+    test_parallel(8, 100);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include "huffman.h"
+#include "stats.h"
+
+static const char *phase_names[NUM_PHASES] = {
+    [PHASE_READ] = "read",
+    [PHASE_HISTOGRAM] = "histogram",
+    [PHASE_CODES] = "codes",
+    [PHASE_ENCODE] = "encode",
+    [PHASE_DECODE] = "decode",
+    [PHASE_CHECKSUM] = "checksum",
+    [PHASE_WRITE] = "write"
+};
+
+static double seconds(clockid_t clock) {
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+run_stats *stats_new(bool compressing) {
+    run_stats *stats = calloc(1, sizeof(run_stats));
+    stats->compressing = compressing;
+    stats->symbol_frequencies = calloc(num_symbols, sizeof(long));
+    stats->start = (phase_time) {
+        .wall = seconds(CLOCK_MONOTONIC),
+        .cpu = seconds(CLOCK_PROCESS_CPUTIME_ID)
+    };
+    return stats;
+}
+
+void stats_delete(run_stats *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    free(stats->symbol_frequencies);
+    free(stats);
+}
+
+phase_time stats_clock(const run_stats *stats) {
+    if (stats == NULL) {
+        return (phase_time) { .wall = 0, .cpu = 0 };
+    }
+    return (phase_time) {
+        .wall = seconds(CLOCK_MONOTONIC),
+        .cpu = seconds(CLOCK_THREAD_CPUTIME_ID)
+    };
+}
+
+void stats_add_since(const run_stats *stats, const phase_time *start, phase_time *total) {
+    if (stats == NULL) {
+        return;
+    }
+    phase_time now = stats_clock(stats);
+    total->wall += now.wall - start->wall;
+    total->cpu += now.cpu - start->cpu;
+}
+
+void stats_phase_done(run_stats *stats, phase p, const phase_time *start) {
+    if (stats != NULL) {
+        stats_add_since(stats, start, &stats->phases[p]);
+    }
+}
+
+void stats_add_time(run_stats *stats, phase p, const phase_time *time) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->phases[p].wall += time->wall;
+    stats->phases[p].cpu += time->cpu;
+}
+
+void stats_add_sizes(run_stats *stats, uint64_t input_size, uint64_t output_size) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->input_size += input_size;
+    stats->output_size += output_size;
+}
+
+void stats_count_codes(run_stats *stats, const long *symbol_frequencies, const code_entry *codes) {
+    if (stats == NULL) {
+        return;
+    }
+    for (int i = 0; i < num_symbols; i++) {
+        stats->symbol_frequencies[i] += symbol_frequencies[i];
+        if (codes != NULL) {
+            stats->code_length_counts[codes[i].length] += symbol_frequencies[i];
+        }
+    }
+}
+
+// bits per symbol of the best code for symbols with these frequencies
+static double entropy(const long *symbol_frequencies) {
+    double total = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        total += symbol_frequencies[i];
+    }
+    double bits = 0;
+    for (int i = 0; i < num_symbols; i++) {
+        if (symbol_frequencies[i] > 0) {
+            double p = symbol_frequencies[i] / total;
+            bits -= p * log2(p);
+        }
+    }
+    return bits;
+}
+
+void print_stats(const run_stats *stats, FILE *f) {
+    if (stats == NULL) {
+        return;
+    }
+    fprintf(f, "%-10s %10s %10s\n", "phase", "wall (s)", "cpu (s)");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        if (stats->phases[p].wall > 0) {
+            fprintf(f, "%-10s %10.4f %10.4f\n", phase_names[p], stats->phases[p].wall, stats->phases[p].cpu);
+        }
+    }
+    fprintf(f, "%-10s %10.4f %10.4f\n", "total",
+            seconds(CLOCK_MONOTONIC) - stats->start.wall, seconds(CLOCK_PROCESS_CPUTIME_ID) - stats->start.cpu);
+    fprintf(f, "(phases on several threads at once may add up to more than the total)\n");
+
+    uint64_t original = stats->compressing ? stats->input_size : stats->output_size;
+    uint64_t compressed = stats->compressing ? stats->output_size : stats->input_size;
+    fprintf(f, "input:  %llu bytes\n", (unsigned long long)stats->input_size);
+    fprintf(f, "output: %llu bytes\n", (unsigned long long)stats->output_size);
+    if (original > 0) {
+        fprintf(f, "ratio:  %.2f%% (%.4f bits per byte)\n",
+                100.0 * compressed / original, 8.0 * compressed / original);
+    }
+
+    if (stats->compressing && stats->input_size > 0) {
+        uint64_t coded_bits = 0;
+        for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+            coded_bits += stats->code_length_counts[length] * length;
+        }
+        // (tANS codes have no lengths)
+        if (coded_bits == 0) {
+            fprintf(f, "entropy: %.4f bits per byte, coded with %.4f with headers and tables\n",
+                    entropy(stats->symbol_frequencies), 8.0 * stats->output_size / stats->input_size);
+        }else {
+            fprintf(f, "entropy: %.4f bits per byte, coded with %.4f (%.4f with headers and tables)\n",
+                    entropy(stats->symbol_frequencies), (double)coded_bits / stats->input_size,
+                    8.0 * stats->output_size / stats->input_size);
+            fprintf(f, "bytes coded with codes of each length:\n");
+        }
+        for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+            if (stats->code_length_counts[length] > 0) {
+                fprintf(f, "  %2d bits %14llu %6.2f%%\n", length, (unsigned long long)stats->code_length_counts[length],
+                        100.0 * stats->code_length_counts[length] / stats->input_size);
+            }
+        }
+    }
+
+    // (in kilobytes, on linux)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(f, "peak memory: %.1f MB resident\n", usage.ru_maxrss / 1024.0);
+    }
+}
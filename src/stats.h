@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "huffman.h"
+
+// where the time goes when compressing or decompressing a file, and what came of it.
+// every function accepts NULL for the stats, doing nothing, so callers needn't check
+// whether stats are being kept
+
+typedef enum {
+    PHASE_READ,
+    PHASE_HISTOGRAM,
+    PHASE_CODES,
+    PHASE_ENCODE,
+    PHASE_DECODE,
+    PHASE_CHECKSUM,
+    PHASE_WRITE,
+    NUM_PHASES
+} phase;
+
+// seconds by the clock, and of processor time
+typedef struct {
+    double wall;
+    double cpu;
+} phase_time;
+
+typedef struct {
+    bool compressing;
+    // the time in each phase, summed over the threads which ran it
+    phase_time phases[NUM_PHASES];
+    // when the stats were started (by the clock, and the whole process's processor time)
+    phase_time start;
+    uint64_t input_size;
+    uint64_t output_size;
+    // when compressing, how often each symbol appears in the input,
+    // and how many of them were coded with codes of each length
+    long *symbol_frequencies;
+    uint64_t code_length_counts[MAX_CODE_LENGTH + 1];
+} run_stats;
+
+run_stats *stats_new(bool compressing);
+void stats_delete(run_stats *);
+
+// the time now: by the clock, and the calling thread's processor time
+phase_time stats_clock(const run_stats *);
+// add the time since `start` (from stats_clock, on the same thread) to `*total`
+void stats_add_since(const run_stats *, const phase_time *start, phase_time *total);
+// add the time since `start` to a phase
+void stats_phase_done(run_stats *, phase, const phase_time *start);
+// add time measured elsewhere (such as on another thread) to a phase
+void stats_add_time(run_stats *, phase, const phase_time *time);
+
+void stats_add_sizes(run_stats *, uint64_t input_size, uint64_t output_size);
+// count symbols of the input, and the lengths of the codes they were given (if `codes` isn't NULL)
+void stats_count_codes(run_stats *, const long *symbol_frequencies, const code_entry *codes);
+
+void print_stats(const run_stats *, FILE *);
+
+#endif // STATS_H
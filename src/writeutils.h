@@ -1,6 +1,7 @@
 #ifndef WRITEUTILS_H
 #define WRITEUTILS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -14,4 +15,10 @@ bool write_long(int64_t, FILE *);
 bool read_ulong(uint64_t *, FILE *);
 bool read_long(int64_t *, FILE *);
 
+// the same big endian layouts, in memory
+void put_uint(uint32_t, uint8_t *);
+uint32_t get_uint(const uint8_t *);
+void put_ulong(uint64_t, uint8_t *);
+uint64_t get_ulong(const uint8_t *);
+
 #endif // WRITEUTILS_H